@@ -0,0 +1,77 @@
+#include "pch.h"
+#include "BloomFilter.h"
+
+BloomFilter::BloomFilter(std::size_t expected_items, double false_positive_rate)
+{
+    // m = -n ln p / ln2^2, k = m/n ln2
+    const double ln2 = 0.6931471805599453;
+    double n = static_cast<double>(std::max<std::size_t>(expected_items, 1));
+    double p = std::clamp(false_positive_rate, 1e-6, 0.5);
+    double m = std::ceil(-n * std::log(p) / (ln2 * ln2));
+    bit_count_ = static_cast<std::uint32_t>(std::clamp(m, 64.0, double(1u << 30)));
+    hash_count_ = static_cast<std::uint8_t>(std::clamp(std::lround(bit_count_ / n * ln2), 1l, 16l));
+    words_.assign((bit_count_ + 63) / 64, 0);
+}
+
+void BloomFilter::hashes(std::uint64_t sender_id, std::uint64_t seq, std::uint64_t &h1, std::uint64_t &h2)
+{
+    auto mix = [](std::uint64_t x)
+    {
+        x ^= x >> 30;
+        x *= 0xBF58476D1CE4E5B9ull;
+        x ^= x >> 27;
+        x *= 0x94D049BB133111EBull;
+        return x ^ (x >> 31);
+    };
+    h1 = mix(sender_id ^ mix(seq));
+    // double hashing, h2 odd so the probes don't collapse
+    h2 = mix(h1 + 0x9E3779B97F4A7C15ull) | 1;
+}
+
+void BloomFilter::add(std::uint64_t sender_id, std::uint64_t seq)
+{
+    if (empty())
+        return;
+    std::uint64_t h1, h2;
+    hashes(sender_id, seq, h1, h2);
+    for (std::uint8_t i = 0; i < hash_count_; ++i)
+    {
+        std::uint64_t bit = (h1 + i * h2) % bit_count_;
+        words_[bit >> 6] |= std::uint64_t(1) << (bit & 63);
+    }
+}
+
+bool BloomFilter::maybe_contains(std::uint64_t sender_id, std::uint64_t seq) const
+{
+    if (empty())
+        return false;
+    std::uint64_t h1, h2;
+    hashes(sender_id, seq, h1, h2);
+    for (std::uint8_t i = 0; i < hash_count_; ++i)
+    {
+        std::uint64_t bit = (h1 + i * h2) % bit_count_;
+        if (!(words_[bit >> 6] & (std::uint64_t(1) << (bit & 63))))
+            return false;
+    }
+    return true;
+}
+
+std::string BloomFilter::serialize() const
+{
+    std::string out((bit_count_ + 7) / 8, '\0');
+    for (std::size_t i = 0; i < out.size(); ++i)
+        out[i] = static_cast<char>(words_[i / 8] >> (8 * (i % 8)));
+    return out;
+}
+
+bool BloomFilter::deserialize(std::uint32_t bit_count, std::uint8_t hash_count, std::string_view bits)
+{
+    if (bit_count == 0 || hash_count == 0 || hash_count > 16 || bits.size() != (std::size_t(bit_count) + 7) / 8)
+        return false;
+    bit_count_ = bit_count;
+    hash_count_ = hash_count;
+    words_.assign((bit_count_ + 63) / 64, 0);
+    for (std::size_t i = 0; i < bits.size(); ++i)
+        words_[i / 8] |= std::uint64_t(static_cast<unsigned char>(bits[i])) << (8 * (i % 8));
+    return true;
+}
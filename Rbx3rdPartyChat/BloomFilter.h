@@ -0,0 +1,32 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// bloom filter over (sender, seq) message ids. a miss is certain, a hit may be a false
+// positive, sized for a target rate when built. the bit array goes on the wire as is
+class BloomFilter
+{
+public:
+    BloomFilter() = default;
+    BloomFilter(std::size_t expected_items, double false_positive_rate);
+
+    void add(std::uint64_t sender_id, std::uint64_t seq);
+    bool maybe_contains(std::uint64_t sender_id, std::uint64_t seq) const;
+
+    std::uint32_t bit_count() const { return bit_count_; }
+    std::uint8_t hash_count() const { return hash_count_; }
+    bool empty() const { return bit_count_ == 0; }
+
+    // little endian words, bit_count rounded up to whole bytes
+    std::string serialize() const;
+    bool deserialize(std::uint32_t bit_count, std::uint8_t hash_count, std::string_view bits);
+
+private:
+    static void hashes(std::uint64_t sender_id, std::uint64_t seq, std::uint64_t &h1, std::uint64_t &h2);
+
+    std::uint32_t bit_count_ = 0;
+    std::uint8_t hash_count_ = 0;
+    std::vector<std::uint64_t> words_;
+};
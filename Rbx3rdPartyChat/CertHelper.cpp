@@ -1,22 +1,41 @@
 #include "pch.h"
 #include "CertHelper.h"
 
-void CertHelper::load_self_signed_cert(boost::asio::ssl::context& ctx) {
+static EVP_PKEY *generate_key(CertKeyType type) {
+
+    int id = EVP_PKEY_RSA;
+    if (type == CertKeyType::EcdsaP256) id = EVP_PKEY_EC;
+    else if (type == CertKeyType::Ed25519) id = EVP_PKEY_ED25519;
+
+    EVP_PKEY_CTX* kctx = EVP_PKEY_CTX_new_id(id, NULL);
+    if (!kctx) throw std::runtime_error("EVP_PKEY_CTX_new_id failed");
+
+    bool ok = EVP_PKEY_keygen_init(kctx) == 1;
+    if (ok && type == CertKeyType::Rsa2048)
+        ok = EVP_PKEY_CTX_set_rsa_keygen_bits(kctx, 2048) == 1;
+    if (ok && type == CertKeyType::EcdsaP256)
+        ok = EVP_PKEY_CTX_set_ec_paramgen_curve_nid(kctx, NID_X9_62_prime256v1) == 1 &&
+             EVP_PKEY_CTX_set_ec_param_enc(kctx, OPENSSL_EC_NAMED_CURVE) == 1;
+
+    EVP_PKEY* pkey = nullptr;
+    if (!ok || EVP_PKEY_keygen(kctx, &pkey) != 1) {
+        EVP_PKEY_CTX_free(kctx);
+        throw std::runtime_error("EVP_PKEY_keygen failed");
+    }
 
-    EVP_PKEY* pkey = EVP_PKEY_new();
-    if (!pkey) throw std::runtime_error("EVP_PKEY_new failed");
+    EVP_PKEY_CTX_free(kctx);
+    return pkey;
+}
 
-    RSA* rsa = RSA_generate_key(2048, RSA_F4, NULL, NULL);
-    if (!rsa) {
-        EVP_PKEY_free(pkey);
-        throw std::runtime_error("RSA_generate_key failed");
-    }
+static std::string bio_to_string(BIO* bio) {
+    char* data = nullptr;
+    long len = BIO_get_mem_data(bio, &data);
+    return std::string(data, len);
+}
 
-    if (EVP_PKEY_assign_RSA(pkey, rsa) != 1) {
-        RSA_free(rsa);
-        EVP_PKEY_free(pkey);
-        throw std::runtime_error("EVP_PKEY_assign_RSA failed");
-    }
+SelfSignedCert CertHelper::generate(CertKeyType type) {
+
+    EVP_PKEY* pkey = generate_key(type);
 
     X509* x509 = X509_new();
     if (!x509) {
@@ -45,7 +64,9 @@ void CertHelper::load_self_signed_cert(boost::asio::ssl::context& ctx) {
 
     X509_set_issuer_name(x509, name);
 
-    if (X509_sign(x509, pkey, EVP_sha256()) == 0) {
+    // ed25519 hashes internally and wants no digest
+    const EVP_MD* md = type == CertKeyType::Ed25519 ? NULL : EVP_sha256();
+    if (X509_sign(x509, pkey, md) == 0) {
         X509_free(x509);
         EVP_PKEY_free(pkey);
         throw std::runtime_error("X509_sign failed");
@@ -69,18 +90,31 @@ void CertHelper::load_self_signed_cert(boost::asio::ssl::context& ctx) {
         throw std::runtime_error("PEM_write_bio failed");
     }
 
-    char* cert_data = nullptr;
-    long cert_len = BIO_get_mem_data(cert_bio, &cert_data);
-
-    ctx.use_certificate_chain(boost::asio::buffer(cert_data, cert_len));
-
-    char* key_data = nullptr;
-    long key_len = BIO_get_mem_data(key_bio, &key_data);
-
-    ctx.use_private_key(boost::asio::buffer(key_data, key_len), boost::asio::ssl::context::pem);
+    SelfSignedCert out;
+    out.cert_pem = bio_to_string(cert_bio);
+    out.key_pem = bio_to_string(key_bio);
 
     BIO_free(cert_bio);
     BIO_free(key_bio);
     X509_free(x509);
     EVP_PKEY_free(pkey);
-}
\ No newline at end of file
+    return out;
+}
+
+void CertHelper::use(boost::asio::ssl::context& ctx, const SelfSignedCert& cert) {
+    ctx.use_certificate_chain(boost::asio::buffer(cert.cert_pem));
+    ctx.use_private_key(boost::asio::buffer(cert.key_pem), boost::asio::ssl::context::pem);
+}
+
+void CertHelper::load_self_signed_cert(boost::asio::ssl::context& ctx, CertKeyType type) {
+    use(ctx, generate(type));
+}
+
+const char* CertHelper::key_type_name(CertKeyType type) {
+    switch (type) {
+    case CertKeyType::Rsa2048: return "RSA-2048";
+    case CertKeyType::EcdsaP256: return "ECDSA-P256";
+    case CertKeyType::Ed25519: return "Ed25519";
+    }
+    return "?";
+}
@@ -7,8 +7,30 @@
 #include <openssl/x509.h>
 #include <openssl/pem.h>
 #include <openssl/evp.h>
+#include <openssl/ec.h>
+#include <string>
+
+// rsa keygen is tens to hundreds of ms and varies a lot, the curves are well under 1 ms
+enum class CertKeyType
+{
+    Rsa2048,
+    EcdsaP256,
+    Ed25519,
+};
+
+struct SelfSignedCert
+{
+    std::string cert_pem;
+    std::string key_pem;
+};
+
 class CertHelper
 {
 public:
-    static void load_self_signed_cert(boost::asio::ssl::context &ctx);
+    // only touches openssl, safe to call off the io threads
+    static SelfSignedCert generate(CertKeyType type);
+    static void use(boost::asio::ssl::context &ctx, const SelfSignedCert &cert);
+
+    static void load_self_signed_cert(boost::asio::ssl::context &ctx, CertKeyType type = CertKeyType::EcdsaP256);
+    static const char *key_type_name(CertKeyType type);
 };
\ No newline at end of file
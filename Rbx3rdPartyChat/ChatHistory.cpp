@@ -0,0 +1,210 @@
+#include "pch.h"
+#include "ChatHistory.h"
+
+static_assert(sizeof(ChatHistory::Record) == 48, "history record grew");
+
+ChatHistory::ChatHistory(std::size_t capacity) : capacity_(std::max<std::size_t>(capacity, 1))
+{
+    // slots and ids grow with use, a big capacity costs nothing until it fills
+    ids_.reserve(std::min<std::size_t>(capacity_, 1024));
+}
+
+bool ChatHistory::before(const ChatMessage &a, const ChatMessage &b)
+{
+    if (a.hlc != b.hlc)
+        return a.hlc < b.hlc;
+    if (a.senderId != b.senderId)
+        return a.senderId < b.senderId;
+    return a.seq < b.seq;
+}
+
+ChatMessage ChatHistory::view(const Record &r) const
+{
+    ChatMessage m;
+    m.name = names_[r.nameId].text;
+    m.text = text_.get(r.text);
+    m.isMine = r.isMine;
+    m.senderId = r.senderId;
+    m.seq = r.seq;
+    m.hlc = r.hlc;
+    return m;
+}
+
+std::uint32_t ChatHistory::intern(std::string_view name)
+{
+    auto it = name_ids_.find(name);
+    if (it != name_ids_.end())
+    {
+        names_[it->second].refs++;
+        return it->second;
+    }
+
+    std::uint32_t id;
+    if (!free_names_.empty())
+    {
+        id = free_names_.back();
+        free_names_.pop_back();
+    }
+    else
+    {
+        id = static_cast<std::uint32_t>(names_.size());
+        names_.emplace_back();
+    }
+    names_[id].text.assign(name);
+    names_[id].refs = 1;
+    name_ids_.emplace(names_[id].text, id);
+    return id;
+}
+
+void ChatHistory::release_name(std::uint32_t id)
+{
+    // nicks nobody in the window uses anymore go away, random nick spam can't pile up
+    Name &n = names_[id];
+    if (--n.refs)
+        return;
+    name_ids_.erase(n.text);
+    n.text.clear();
+    n.text.shrink_to_fit();
+    free_names_.push_back(id);
+}
+
+bool ChatHistory::insert(const ChatMessage &msg)
+{
+    if (size_ >= capacity_ && before(msg, front()))
+        return false;
+    if (has_id(msg))
+    {
+        if (!ids_.insert({ msg.senderId, msg.seq }).second)
+            return false;
+        auto &mark = high_[msg.senderId];
+        mark.first = mark.inserted ? std::min(mark.first, msg.seq) : msg.seq;
+        mark.seq = std::max(mark.seq, msg.seq);
+        mark.held++;
+        mark.inserted++;
+    }
+
+    // live traffic almost always lands at the end, sync backfill binary searches
+    std::size_t pos = size_;
+    if (size_ && before(msg, back()))
+    {
+        pos = static_cast<std::size_t>(std::upper_bound(begin(), end(), msg, before) - begin());
+        ++reorders_;
+    }
+
+    if (size_ >= capacity_)
+    {
+        // msg is not older than the front, so it never lands in front of the evicted slot
+        evict_front();
+        --pos;
+    }
+    if (ring_.size() < capacity_)
+    {
+        // grow like a vector would but never past capacity, a full ring has no slack
+        if (ring_.size() == ring_.capacity())
+            ring_.reserve(std::min(capacity_, std::max<std::size_t>(ring_.size() * 2, 16)));
+        ring_.emplace_back();
+    }
+    ++size_;
+
+    // a late message shifts only the ones after it, usually a handful
+    for (std::size_t i = size_ - 1; i > pos; --i)
+        at(i) = at(i - 1);
+
+    Record &r = at(pos);
+    r.hlc = msg.hlc;
+    r.senderId = msg.senderId;
+    r.seq = msg.seq;
+    r.text = text_.add(msg.text);
+    r.nameId = intern(msg.name);
+    r.isMine = msg.isMine;
+    return true;
+}
+
+void ChatHistory::evict_front()
+{
+    Record &old = ring_[head_];
+    if (spill_)
+        spill_(view(old));
+    if (old.senderId || old.seq)
+    {
+        ids_.erase({ old.senderId, old.seq });
+        auto mark = high_.find(old.senderId);
+        if (mark != high_.end() && --mark->second.held == 0)
+            high_.erase(mark);
+    }
+    text_.release(old.text);
+    release_name(old.nameId);
+    old = Record();
+    // the freed slot becomes the one past the back
+    head_ = slot(1);
+    --size_;
+    ++evicted_;
+}
+
+void ChatHistory::drop_back(std::size_t count)
+{
+    if (!count || !size_)
+        return;
+    for (; count && size_; --count)
+    {
+        Record &old = at(size_ - 1);
+        if (old.senderId || old.seq)
+        {
+            ids_.erase({ old.senderId, old.seq });
+            auto mark = high_.find(old.senderId);
+            if (mark != high_.end() && --mark->second.held == 0)
+                high_.erase(mark);
+        }
+        text_.release(old.text);
+        release_name(old.nameId);
+        old = Record();
+        --size_;
+        // below capacity the ring is exactly the messages, keep it that way
+        if (ring_.size() < capacity_)
+            ring_.pop_back();
+    }
+    ++reorders_;
+}
+
+bool ChatHistory::contains(std::uint64_t senderId, std::uint64_t seq) const
+{
+    return ids_.count({ senderId, seq }) != 0;
+}
+
+void ChatHistory::clear()
+{
+    ring_.clear();
+    head_ = 0;
+    size_ = 0;
+    text_.clear();
+    names_.clear();
+    free_names_.clear();
+    name_ids_.clear();
+    ids_.clear();
+    high_.clear();
+    ++reorders_;
+}
+
+void ChatHistory::set_capacity(std::size_t capacity)
+{
+    capacity = std::max<std::size_t>(capacity, 1);
+    while (size_ > capacity)
+        evict_front();
+
+    // straighten the ring so head_ is 0 again and growth can push_back
+    std::vector<Record> ring;
+    ring.reserve(std::min(capacity, std::max<std::size_t>(size_, 1)));
+    for (std::size_t i = 0; i < size_; ++i)
+        ring.push_back(at(i));
+    ring_ = std::move(ring);
+    head_ = 0;
+    capacity_ = capacity;
+}
+
+std::size_t ChatHistory::storage_bytes() const
+{
+    std::size_t bytes = ring_.capacity() * sizeof(Record) + text_.bytes_reserved();
+    for (const auto &n : names_)
+        bytes += sizeof(Name) + (n.text.capacity() > 15 ? n.text.capacity() + 1 : 0);
+    return bytes;
+}
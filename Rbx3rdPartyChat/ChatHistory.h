@@ -0,0 +1,175 @@
+#pragma once
+#include "ChatMessage.h"
+#include "TextArena.h"
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <iterator>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+struct MessageKey
+{
+    std::uint64_t senderId = 0;
+    std::uint64_t seq = 0;
+
+    bool operator==(const MessageKey &o) const { return senderId == o.senderId && seq == o.seq; }
+};
+
+struct MessageKeyHash
+{
+    std::size_t operator()(const MessageKey &k) const
+    {
+        std::uint64_t x = k.senderId ^ (k.seq * 0x9E3779B97F4A7C15ull);
+        x ^= x >> 31;
+        x *= 0xBF58476D1CE4E5B9ull;
+        return static_cast<std::size_t>(x ^ (x >> 29));
+    }
+};
+
+// messages kept in (hlc, sender, seq) order so every peer shows the same interleaving,
+// with a hash of ids next to it so a duplicate is found without scanning.
+// storage is a ring of capacity fixed-size records: once full, a new message takes over the
+// oldest slot, so appending and evicting never move the other messages. text lives in a
+// TextArena as utf-8 and nicks are interned, a record only holds where to find them
+class ChatHistory
+{
+public:
+    // 48 bytes per message whatever the text, strings are reached through the arena and name table
+    struct Record
+    {
+        std::uint64_t hlc = 0;
+        std::uint64_t senderId = 0;
+        std::uint64_t seq = 0;
+        TextArena::Ref text;
+        std::uint32_t nameId = 0;
+        bool isMine = false;
+    };
+
+    // hands out ChatMessage views, valid until the message is evicted or the history cleared
+    class const_iterator
+    {
+    public:
+        using iterator_category = std::random_access_iterator_tag;
+        using value_type = ChatMessage;
+        using difference_type = std::ptrdiff_t;
+        using pointer = void;
+        using reference = ChatMessage;
+
+        const_iterator() = default;
+        const_iterator(const ChatHistory *h, std::size_t i) : h_(h), i_(i) {}
+
+        reference operator*() const { return (*h_)[i_]; }
+        reference operator[](difference_type n) const { return (*h_)[i_ + n]; }
+        const_iterator &operator++() { ++i_; return *this; }
+        const_iterator operator++(int) { auto t = *this; ++i_; return t; }
+        const_iterator &operator--() { --i_; return *this; }
+        const_iterator operator--(int) { auto t = *this; --i_; return t; }
+        const_iterator &operator+=(difference_type n) { i_ += n; return *this; }
+        const_iterator &operator-=(difference_type n) { i_ -= n; return *this; }
+        friend const_iterator operator+(const_iterator it, difference_type n) { return it += n; }
+        friend const_iterator operator+(difference_type n, const_iterator it) { return it += n; }
+        friend const_iterator operator-(const_iterator it, difference_type n) { return it -= n; }
+        friend difference_type operator-(const const_iterator &a, const const_iterator &b)
+        {
+            return static_cast<difference_type>(a.i_) - static_cast<difference_type>(b.i_);
+        }
+        friend bool operator==(const const_iterator &a, const const_iterator &b) { return a.i_ == b.i_; }
+        friend auto operator<=>(const const_iterator &a, const const_iterator &b) { return a.i_ <=> b.i_; }
+
+    private:
+        const ChatHistory *h_ = nullptr;
+        std::size_t i_ = 0;
+    };
+
+    explicit ChatHistory(std::size_t capacity);
+
+    // copies name and text in. false if the id is already here, or the history is full and
+    // msg is older than all of it
+    bool insert(const ChatMessage &msg);
+    bool contains(std::uint64_t senderId, std::uint64_t seq) const;
+    struct SenderMark
+    {
+        // highest seq inserted, evicted ones included
+        std::uint64_t seq = 0;
+        // messages of this sender in the window right now
+        std::uint32_t held = 0;
+        // lowest seq inserted and how many were, evicted ones included. fewer than the span
+        // means a hole below seq, a line dropped on the way that the mark alone never asks for
+        std::uint64_t first = 0;
+        std::uint64_t inserted = 0;
+
+        bool has_gaps() const { return inserted < seq - first + 1; }
+    };
+    // per sender with a message still in the window, what a sync request advertises. a sender
+    // whose last message was evicted is forgotten, peer ids change every run so the set would
+    // otherwise grow with every restart anyone ever made
+    const std::unordered_map<std::uint64_t, SenderMark> &high_water() const { return high_; }
+    void clear();
+    // drops the newest count messages without spilling them, caches following the history see a reorder
+    void drop_back(std::size_t count);
+    // shrinking drops the oldest messages, they count as evicted
+    void set_capacity(std::size_t capacity);
+    // sees every message right before eviction drops it, oldest first
+    void set_spill(std::function<void(const ChatMessage &)> fn) { spill_ = std::move(fn); }
+
+    // for caches that follow the history: message i is the (evicted() + i)th ever kept as long as
+    // reorders() stays the same, a middle insert or clear bumps it
+    std::uint64_t evicted() const { return evicted_; }
+    std::uint64_t reorders() const { return reorders_; }
+
+    std::size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+    std::size_t capacity() const { return capacity_; }
+    ChatMessage operator[](std::size_t i) const { return view(ring_[slot(i)]); }
+    ChatMessage front() const { return view(ring_[head_]); }
+    ChatMessage back() const { return view(ring_[slot(size_ - 1)]); }
+
+    const_iterator begin() const { return const_iterator(this, 0); }
+    const_iterator end() const { return const_iterator(this, size_); }
+
+    // heap held for message storage: records, arena chunks, name table
+    std::size_t storage_bytes() const;
+    std::size_t name_count() const { return names_.size() - free_names_.size(); }
+
+private:
+    struct Name
+    {
+        std::string text;
+        std::uint32_t refs = 0;
+    };
+
+    static bool before(const ChatMessage &a, const ChatMessage &b);
+    static bool has_id(const ChatMessage &m) { return m.senderId != 0 || m.seq != 0; }
+
+    ChatMessage view(const Record &r) const;
+    std::uint32_t intern(std::string_view name);
+    void release_name(std::uint32_t id);
+
+    // ring_ only grows up to capacity_, head_ stays 0 until the first eviction
+    std::size_t slot(std::size_t i) const
+    {
+        std::size_t s = head_ + i;
+        return s >= ring_.size() ? s - ring_.size() : s;
+    }
+    Record &at(std::size_t i) { return ring_[slot(i)]; }
+    void evict_front();
+
+    std::size_t capacity_;
+    std::vector<Record> ring_;
+    std::size_t head_ = 0;
+    std::size_t size_ = 0;
+    TextArena text_;
+    // deque so the views name_ids_ is keyed by stay put as names are added
+    std::deque<Name> names_;
+    std::vector<std::uint32_t> free_names_;
+    std::unordered_map<std::string_view, std::uint32_t> name_ids_;
+    std::unordered_set<MessageKey, MessageKeyHash> ids_;
+    std::unordered_map<std::uint64_t, SenderMark> high_;
+    std::uint64_t evicted_ = 0;
+    std::uint64_t reorders_ = 0;
+    std::function<void(const ChatMessage &)> spill_;
+};
@@ -0,0 +1,484 @@
+#include "pch.h"
+#include "ChatJournal.h"
+#include "WireProtocol.h"
+#include <shlobj.h>
+
+#pragma comment(lib, "shell32.lib")
+#pragma comment(lib, "ole32.lib")
+
+// slicing-by-8, ~1 byte per cycle, enough that recovery is bound by the disk
+std::uint32_t ChatJournal::crc32c(const void *data, std::size_t size)
+{
+    static const auto table = []
+    {
+        std::array<std::array<std::uint32_t, 256>, 8> t{};
+        for (std::uint32_t i = 0; i < 256; ++i)
+        {
+            std::uint32_t c = i;
+            for (int k = 0; k < 8; ++k)
+                c = (c >> 1) ^ (0x82F63B78u & (0u - (c & 1)));
+            t[0][i] = c;
+        }
+        for (std::uint32_t i = 0; i < 256; ++i)
+        {
+            for (int s = 1; s < 8; ++s)
+                t[s][i] = (t[s - 1][i] >> 8) ^ t[0][t[s - 1][i] & 0xFF];
+        }
+        return t;
+    }();
+
+    const auto *p = static_cast<const unsigned char *>(data);
+    std::uint32_t crc = 0xFFFFFFFFu;
+    while (size >= 8)
+    {
+        std::uint32_t lo = crc ^ (std::uint32_t(p[0]) | (std::uint32_t(p[1]) << 8) | (std::uint32_t(p[2]) << 16) | (std::uint32_t(p[3]) << 24));
+        crc = table[7][lo & 0xFF] ^ table[6][(lo >> 8) & 0xFF] ^ table[5][(lo >> 16) & 0xFF] ^ table[4][lo >> 24] ^
+              table[3][p[4]] ^ table[2][p[5]] ^ table[1][p[6]] ^ table[0][p[7]];
+        p += 8;
+        size -= 8;
+    }
+    while (size--)
+        crc = (crc >> 8) ^ table[0][(crc ^ *p++) & 0xFF];
+    return crc ^ 0xFFFFFFFFu;
+}
+
+std::wstring ChatJournal::data_dir()
+{
+    PWSTR base = nullptr;
+    if (FAILED(SHGetKnownFolderPath(FOLDERID_LocalAppData, 0, nullptr, &base)))
+        return std::wstring();
+    std::wstring dir = std::wstring(base) + L"\\Rbx3rdPartyChat";
+    CoTaskMemFree(base);
+    CreateDirectoryW(dir.c_str(), nullptr);
+    return dir;
+}
+
+std::wstring ChatJournal::default_path()
+{
+    std::wstring dir = data_dir();
+    return dir.empty() ? dir : dir + L"\\history.journal";
+}
+
+ChatJournal::~ChatJournal()
+{
+    close();
+}
+
+bool ChatJournal::open(const std::wstring &path, const std::function<void(const ChatMessage &)> &fn)
+{
+    close();
+    path_ = path;
+    file_records_ = 0;
+    file_ = CreateFileW(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, nullptr, OPEN_ALWAYS,
+                        FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file_ == INVALID_HANDLE_VALUE)
+        return false;
+
+    if (!recover(fn))
+    {
+        CloseHandle(file_);
+        file_ = INVALID_HANDLE_VALUE;
+        return false;
+    }
+
+    stopping_ = false;
+    open_ = true;
+    writer_ = std::thread([this]
+                          { writer_loop(); });
+    return true;
+}
+
+bool ChatJournal::recover(const std::function<void(const ChatMessage &)> &fn)
+{
+    auto t0 = std::chrono::steady_clock::now();
+
+    LARGE_INTEGER size{};
+    if (!GetFileSizeEx(file_, &size))
+        return false;
+    const std::uint64_t total = static_cast<std::uint64_t>(size.QuadPart);
+
+    // a chunk at a time, a record cut by the chunk end is carried over to the next read.
+    // buf[pos] sits at file offset base + pos
+    std::string buf;
+    std::size_t pos = 0;
+    std::uint64_t base = 0;
+    std::uint64_t read_total = 0;
+    bool read_failed = false;
+    auto have = [&](std::size_t need)
+    {
+        while (buf.size() - pos < need && read_total < total)
+        {
+            buf.erase(0, pos);
+            base += pos;
+            pos = 0;
+            std::size_t want = static_cast<std::size_t>(
+                std::min<std::uint64_t>(std::max(need - buf.size(), READ_CHUNK), total - read_total));
+            std::size_t old = buf.size();
+            buf.resize(old + want);
+            DWORD n = 0;
+            if (!ReadFile(file_, buf.data() + old, static_cast<DWORD>(want), &n, nullptr) || n == 0)
+            {
+                // the bytes are there but we could not read them, cutting them off would lose history
+                read_failed = true;
+                buf.resize(old);
+                return false;
+            }
+            buf.resize(old + n);
+            read_total += n;
+        }
+        return buf.size() - pos >= need;
+    };
+
+    std::uint64_t good = FILE_HEADER_SIZE;
+    bool header_ok = have(FILE_HEADER_SIZE) && wire::get_u32(buf.data()) == FILE_MAGIC &&
+                     wire::get_u32(buf.data() + 4) == FILE_VERSION;
+    if (read_failed)
+        return false;
+    if (header_ok)
+    {
+        pos = FILE_HEADER_SIZE;
+        while (have(RECORD_HEADER_SIZE))
+        {
+            std::uint32_t len = wire::get_u32(buf.data() + pos);
+            std::uint32_t crc = wire::get_u32(buf.data() + pos + 4);
+            if (len < 1 || len > total - (base + pos) - RECORD_HEADER_SIZE || !have(RECORD_HEADER_SIZE + len))
+                break;
+            const char *body = buf.data() + pos + RECORD_HEADER_SIZE;
+            if (crc32c(body, len) != crc)
+                break;
+
+            wire::FrameView frame;
+            frame.count = 1;
+            frame.body = std::string_view(body + 1, len - 1);
+            wire::RecordReader reader(frame);
+            wire::RecordView rec;
+            if (!reader.next(rec))
+                break;
+
+            ChatMessage m;
+            m.name = rec.nick;
+            m.text = rec.text;
+            m.isMine = (static_cast<std::uint8_t>(body[0]) & FLAG_MINE) != 0;
+            m.senderId = rec.sender_id;
+            m.seq = rec.msg_id;
+            m.hlc = rec.timestamp;
+            fn(m);
+
+            pos += RECORD_HEADER_SIZE + len;
+            good = base + pos;
+            stats_.recovered_records++;
+        }
+        if (read_failed)
+            return false;
+    }
+    else if (total)
+    {
+        // not ours or a header that never made it to disk, start over
+        good = 0;
+    }
+
+    if (!header_ok)
+    {
+        std::string header;
+        wire::put_u32(header, FILE_MAGIC);
+        wire::put_u32(header, FILE_VERSION);
+        LARGE_INTEGER zero{};
+        if (!SetFilePointerEx(file_, zero, nullptr, FILE_BEGIN) || !SetEndOfFile(file_) || !write_all(file_, header) ||
+            !FlushFileBuffers(file_))
+            return false;
+        stats_.truncated_bytes = total;
+    }
+    else if (good < total)
+    {
+        stats_.truncated_bytes = total - good;
+        LARGE_INTEGER at{};
+        at.QuadPart = static_cast<LONGLONG>(good);
+        if (!SetFilePointerEx(file_, at, nullptr, FILE_BEGIN) || !SetEndOfFile(file_) || !FlushFileBuffers(file_))
+            return false;
+    }
+
+    LARGE_INTEGER zero{}, end{};
+    SetFilePointerEx(file_, zero, &end, FILE_END);
+    committed_end_ = static_cast<std::uint64_t>(end.QuadPart);
+    torn_ = false;
+    file_records_ = stats_.recovered_records;
+    stats_.recovery_us = static_cast<std::uint64_t>(
+        std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - t0).count());
+    return true;
+}
+
+void ChatJournal::encode_record(std::string &out, const ChatMessage &m)
+{
+    std::size_t at = out.size();
+    out.resize(at + RECORD_HEADER_SIZE);
+    out.push_back(static_cast<char>(m.isMine ? FLAG_MINE : 0));
+    wire::append_record(out, m.seq, m.senderId, m.hlc, m.name, m.text);
+    std::uint32_t len = static_cast<std::uint32_t>(out.size() - at - RECORD_HEADER_SIZE);
+    std::uint32_t crc = crc32c(out.data() + at + RECORD_HEADER_SIZE, len);
+    for (int i = 0; i < 4; ++i)
+    {
+        out[at + i] = static_cast<char>(len >> (8 * i));
+        out[at + 4 + i] = static_cast<char>(crc >> (8 * i));
+    }
+}
+
+void ChatJournal::append(const ChatMessage &m)
+{
+    if (!is_open())
+        return;
+
+    // encode outside the lock, the writer only ever swaps the buffer
+    std::string rec;
+    rec.reserve(RECORD_HEADER_SIZE + 1 + wire::record_size(m.name, m.text));
+    encode_record(rec, m);
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        pending_.append(rec);
+        ++pending_records_;
+        ++appended_;
+        ++file_records_;
+    }
+    wake_.notify_one();
+}
+
+bool ChatJournal::flush()
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    std::uint64_t target = appended_;
+    std::uint64_t errors = stats_.write_errors;
+    committed_.wait(lock, [&]
+                    { return (durable_ >= target && !compacting_) || stats_.write_errors != errors || stopping_; });
+    return durable_ >= target;
+}
+
+bool ChatJournal::compact(const std::function<void(const std::function<void(const ChatMessage &)> &)> &fill)
+{
+    if (!is_open())
+        return false;
+
+    // only the encode happens here, the file work is the writer's. everything appended so far
+    // is in the snapshot, so the pending bytes up to here are not written after it
+    Snapshot snap;
+    wire::put_u32(snap.data, FILE_MAGIC);
+    wire::put_u32(snap.data, FILE_VERSION);
+    fill([&](const ChatMessage &m)
+         {
+             encode_record(snap.data, m);
+             ++snap.records; });
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        snap.dropped = file_records_ > snap.records ? file_records_ - snap.records : 0;
+        // a snapshot the writer has not picked up yet is simply replaced by the newer one
+        if (snapshot_)
+            snap.dropped += snapshot_->dropped;
+        snap.split = pending_.size();
+        snapshot_ = std::move(snap);
+        compacting_ = true;
+        file_records_ = snapshot_->records;
+    }
+    wake_.notify_one();
+    return true;
+}
+
+std::uint64_t ChatJournal::file_records() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return file_records_;
+}
+
+void ChatJournal::writer_loop()
+{
+    std::string batch;
+    std::optional<Snapshot> snap;
+    bool retry = false;
+    for (;;)
+    {
+        std::uint64_t records = 0;
+        std::uint64_t upto = 0;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            // a failing disk is not hammered, but close still gets one more try in right away
+            if (retry)
+                wake_.wait_for(lock, RETRY_DELAY, [&]
+                               { return stopping_; });
+            wake_.wait(lock, [&]
+                       { return !pending_.empty() || snapshot_ || stopping_; });
+            if (pending_.empty() && !snapshot_ && stopping_)
+                return;
+            // whatever arrived while the last flush ran goes out together
+            batch.clear();
+            batch.swap(pending_);
+            records = pending_records_;
+            pending_records_ = 0;
+            upto = appended_;
+            snap.swap(snapshot_);
+        }
+
+        // a rewrite that fails leaves the old file, and the batch goes to its end as usual
+        auto t0 = std::chrono::steady_clock::now();
+        bool compacted = snap && rewrite(snap->data, batch, snap->split);
+        auto took = std::chrono::steady_clock::now() - t0;
+        bool ok = compacted || commit(batch);
+
+        bool give_up = false;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stats_.commits++;
+            stats_.failing = !ok;
+            if (compacted)
+            {
+                stats_.compactions++;
+                stats_.compacted_records += snap->dropped;
+                stats_.compaction_us = static_cast<std::uint64_t>(
+                    std::chrono::duration_cast<std::chrono::microseconds>(took).count());
+            }
+            else if (snap)
+            {
+                // the old file still holds what the snapshot would have dropped
+                if (snapshot_)
+                    snapshot_->dropped += snap->dropped;
+                else
+                    file_records_ += snap->dropped;
+            }
+            snap.reset();
+            compacting_ = snapshot_.has_value();
+            if (ok)
+            {
+                stats_.records_appended += records;
+                stats_.bytes_written += batch.size();
+                stats_.max_batch_records = std::max(stats_.max_batch_records, records);
+                durable_ = upto;
+            }
+            else
+            {
+                // back in front of whatever was appended meanwhile, durable_ stays where it was.
+                // a snapshot queued since then already holds these records too
+                stats_.write_errors++;
+                if (snapshot_)
+                    snapshot_->split += batch.size();
+                batch.append(pending_);
+                pending_.swap(batch);
+                pending_records_ += records;
+                // closing and the retry failed too, the file keeps what it had
+                give_up = retry && stopping_;
+            }
+        }
+        committed_.notify_all();
+        if (give_up)
+            return;
+        retry = !ok;
+    }
+}
+
+// a failed write can leave part of its batch in the file. recovery would stop at that torn
+// record and drop every good one after it, so it is cut off before the next try
+bool ChatJournal::commit(const std::string &batch)
+{
+    if (file_ == INVALID_HANDLE_VALUE && !reopen())
+        return false;
+    if (torn_)
+    {
+        LARGE_INTEGER at{};
+        at.QuadPart = static_cast<LONGLONG>(committed_end_);
+        if (!SetFilePointerEx(file_, at, nullptr, FILE_BEGIN) || !SetEndOfFile(file_))
+            return false;
+        torn_ = false;
+    }
+    if (!write_all(file_, batch) || !FlushFileBuffers(file_))
+    {
+        torn_ = true;
+        return false;
+    }
+    committed_end_ += batch.size();
+    return true;
+}
+
+// the snapshot plus the appends that came after it, on disk in full under the temp name
+// before it replaces the old file, so a crash in between leaves one complete journal or the other
+bool ChatJournal::rewrite(const std::string &data, const std::string &batch, std::size_t split)
+{
+    std::wstring tmp = path_ + L".tmp";
+    HANDLE h = CreateFileW(tmp.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (h == INVALID_HANDLE_VALUE)
+        return false;
+    std::string tail = batch.substr(split);
+    bool ok = write_all(h, data) && write_all(h, tail) && FlushFileBuffers(h);
+    CloseHandle(h);
+    if (!ok)
+    {
+        DeleteFileW(tmp.c_str());
+        return false;
+    }
+
+    if (file_ != INVALID_HANDLE_VALUE)
+    {
+        CloseHandle(file_);
+        file_ = INVALID_HANDLE_VALUE;
+    }
+    if (!MoveFileExW(tmp.c_str(), path_.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH))
+    {
+        // commit reopens the old file
+        DeleteFileW(tmp.c_str());
+        return false;
+    }
+    committed_end_ = data.size() + tail.size();
+    torn_ = false;
+    // the records are on disk already, if this fails the next commit tries again
+    reopen();
+    return true;
+}
+
+bool ChatJournal::reopen()
+{
+    file_ = CreateFileW(path_.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, nullptr, OPEN_ALWAYS,
+                        FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file_ == INVALID_HANDLE_VALUE)
+        return false;
+    LARGE_INTEGER at{};
+    at.QuadPart = static_cast<LONGLONG>(committed_end_);
+    return SetFilePointerEx(file_, at, nullptr, FILE_BEGIN) != 0;
+}
+
+bool ChatJournal::write_all(HANDLE file, const std::string &bytes)
+{
+    std::size_t done = 0;
+    while (done < bytes.size())
+    {
+        DWORD n = 0;
+        DWORD want = static_cast<DWORD>(std::min<std::size_t>(bytes.size() - done, 1u << 30));
+        if (!WriteFile(file, bytes.data() + done, want, &n, nullptr) || n == 0)
+            return false;
+        done += n;
+    }
+    return true;
+}
+
+void ChatJournal::close()
+{
+    if (writer_.joinable())
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopping_ = true;
+        }
+        wake_.notify_one();
+        writer_.join();
+        committed_.notify_all();
+    }
+    open_ = false;
+    snapshot_.reset();
+    compacting_ = false;
+    if (file_ != INVALID_HANDLE_VALUE)
+    {
+        CloseHandle(file_);
+        file_ = INVALID_HANDLE_VALUE;
+    }
+}
+
+JournalStats ChatJournal::stats() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return stats_;
+}
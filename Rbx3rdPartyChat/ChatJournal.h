@@ -0,0 +1,131 @@
+#pragma once
+#include "ChatMessage.h"
+#include <windows.h>
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+
+struct JournalStats
+{
+    std::uint64_t records_appended = 0;
+    std::uint64_t bytes_written = 0;
+    // one write + FlushFileBuffers each, many records per commit under load
+    std::uint64_t commits = 0;
+    std::uint64_t max_batch_records = 0;
+    std::uint64_t write_errors = 0;
+    // the last commit failed, its records wait in memory for the writer to try again
+    bool failing = false;
+
+    std::uint64_t recovered_records = 0;
+    // torn or corrupt tail cut off at open
+    std::uint64_t truncated_bytes = 0;
+    std::uint64_t recovery_us = 0;
+
+    // rewrites that dropped records nobody replays anymore, and how long the last one kept
+    // the writer busy
+    std::uint64_t compactions = 0;
+    std::uint64_t compacted_records = 0;
+    std::uint64_t compaction_us = 0;
+};
+
+// append-only history on disk. the file is a small header and then one record per message:
+//   u32 le length, u32 le crc32c of the body, body = u8 flags + a wire record (see WireProtocol.h)
+// appends only encode and queue, a writer thread commits whatever piled up with one write and
+// one flush (group commit), so a slow disk never stalls the ui. a message counts as durable
+// once the commit after its append finished. a commit that fails keeps its records queued,
+// cuts off whatever part of them reached the file and is tried again a little later
+class ChatJournal
+{
+public:
+    ChatJournal() = default;
+    ~ChatJournal();
+    ChatJournal(const ChatJournal &) = delete;
+    ChatJournal &operator=(const ChatJournal &) = delete;
+
+    // opens or creates the file and replays every intact record into fn, oldest first.
+    // anything after the first bad record is a write the crash interrupted and gets cut off.
+    // the file is read a chunk at a time, and a read error fails the open instead of cutting
+    bool open(const std::wstring &path, const std::function<void(const ChatMessage &)> &fn);
+    void close();
+    bool is_open() const { return open_; }
+
+    void append(const ChatMessage &m);
+    // blocks until everything appended so far is committed and a queued compaction is done,
+    // false if a commit failed first
+    bool flush();
+
+    // replaces the file with only the messages fill passes to emit, so replay stops growing
+    // with every message ever received. same thread as append. fill runs right away, the
+    // writer rewrites the file with that snapshot before its next commit; until then, or if
+    // the rewrite fails, appends keep going to the old file
+    bool compact(const std::function<void(const std::function<void(const ChatMessage &)> &emit)> &fill);
+    // records in the file including appends not committed yet, what the next open replays
+    std::uint64_t file_records() const;
+
+    JournalStats stats() const;
+
+    // %LOCALAPPDATA%\Rbx3rdPartyChat, created if missing, empty if there is no such folder
+    static std::wstring data_dir();
+    // history.journal in data_dir()
+    static std::wstring default_path();
+    static std::uint32_t crc32c(const void *data, std::size_t size);
+
+private:
+    static constexpr std::uint32_t FILE_MAGIC = 0x4A584252; // "RBXJ"
+    static constexpr std::uint32_t FILE_VERSION = 1;
+    static constexpr std::size_t FILE_HEADER_SIZE = 8;
+    static constexpr std::size_t RECORD_HEADER_SIZE = 8;
+    static constexpr std::uint8_t FLAG_MINE = 0x01;
+    // recovery reads this much per ReadFile instead of the whole file at once
+    static constexpr std::size_t READ_CHUNK = 1 << 20;
+    static constexpr std::chrono::milliseconds RETRY_DELAY{1000};
+
+    bool recover(const std::function<void(const ChatMessage &)> &fn);
+    void writer_loop();
+    bool commit(const std::string &batch);
+    bool rewrite(const std::string &data, const std::string &batch, std::size_t split);
+    bool reopen();
+    static void encode_record(std::string &out, const ChatMessage &m);
+    static bool write_all(HANDLE file, const std::string &bytes);
+
+    // a compaction waiting for the writer: the new file, and how many bytes at the front of
+    // pending_ are appends it already holds
+    struct Snapshot
+    {
+        std::string data;
+        std::uint64_t records = 0;
+        std::uint64_t dropped = 0;
+        std::size_t split = 0;
+    };
+
+    std::wstring path_;
+    bool open_ = false;
+    std::thread writer_;
+    // writer thread once open returned: the handle, where the last good commit ended, and
+    // whether a failed one may have left part of its batch past that
+    HANDLE file_ = INVALID_HANDLE_VALUE;
+    std::uint64_t committed_end_ = 0;
+    bool torn_ = false;
+
+    mutable std::mutex mutex_;
+    std::condition_variable wake_;
+    std::condition_variable committed_;
+    std::string pending_;
+    std::uint64_t pending_records_ = 0;
+    // appends handed out / appends on disk, flush waits for the second to catch up
+    std::uint64_t appended_ = 0;
+    std::uint64_t durable_ = 0;
+    std::uint64_t file_records_ = 0;
+    std::optional<Snapshot> snapshot_;
+    // from compact until the writer is done with the snapshot, either way
+    bool compacting_ = false;
+    bool stopping_ = false;
+
+    JournalStats stats_;
+};
@@ -1,8 +1,16 @@
 #pragma once
-#include <string>
+#include <cstdint>
+#include <string_view>
 
+// a message as it is passed around. name and text are utf-8 views into whoever owns the bytes
+// (the history arena, a received frame, the journal's read buffer), copy them out to keep them
 struct ChatMessage {
-    std::wstring name;
-    std::wstring text;
-    bool isMine;
-};
\ No newline at end of file
+    std::string_view name;
+    std::string_view text;
+    bool isMine = false;
+    // (senderId, seq) is unique across the group, 0/0 means unknown and is never deduped
+    std::uint64_t senderId = 0;
+    std::uint64_t seq = 0;
+    // hybrid logical clock stamp, see HybridClock.h
+    std::uint64_t hlc = 0;
+};
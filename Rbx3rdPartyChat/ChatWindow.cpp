@@ -1,6 +1,7 @@
 ﻿#include "pch.h"
 #include "ChatWindow.h"
 #include "GlobalNetwork.h"
+#include "WireProtocol.h"
 
 HHOOK g_hKeyboardHook = nullptr;
 
@@ -96,7 +97,7 @@ LRESULT CALLBACK LowLevelKeyboardProc(int nCode, WPARAM wParam, LPARAM lParam)
     }
     return CallNextHookEx(NULL, nCode, wParam, lParam);
 }
-ChatWindow::ChatWindow(HINSTANCE hInstance)
+ChatWindow::ChatWindow(HINSTANCE hInstance, std::size_t historyCapacity)
     : m_hInstance(hInstance),
 
     m_hWnd(nullptr),
@@ -131,6 +132,9 @@ ChatWindow::ChatWindow(HINSTANCE hInstance)
 {
     s_instance = this;
     m_hbrEditBg = CreateSolidBrush(RGB(30, 30, 30));
+    m_messages.set_capacity(historyCapacity);
+    if (global_sync_marks_only)
+        m_syncMode = SyncMode::HighWater;
 }
 
 ChatWindow::~ChatWindow()
@@ -188,23 +192,57 @@ bool ChatWindow::Create(int x, int y, int w, int h, int nCmdShow)
 
     CreateInputControl();
 
-    if (global_net_engine)
+    // older than the hot window goes to segment files, scrolling up pages it back in
+    m_cold.open(ColdHistory::default_dir());
+    m_journalSealed = m_cold.sealed_size();
+    m_messages.set_spill([this](const ChatMessage& m)
+        {
+            // an attached scrollback follows while it has room, a full one lets go and pages
+            // forward once the view reaches its end
+            bool follow = !m_scrollback.empty() && ScrollbackAttached() && m_scrollback.size() < m_scrollback.capacity();
+            m_cold.spill(m);
+            if (follow && !ScrollbackAttached())
+                m_scrollback.insert(m); });
+
+    // history from earlier runs, before the first sync so peers only send what we lack
+    std::wstring journalPath = ChatJournal::default_path();
+    if (!journalPath.empty() && m_journal.open(journalPath, [this](const ChatMessage& m)
+        {
+            ChatMessage restored = m;
+            restored.hlc = m_clock.receive(m.hlc);
+            m_messages.insert(restored); }))
     {
+        // a journal from before compaction existed can be arbitrarily long, cut it down now.
+        // same if the replay filled a segment
+        m_journalCompactAt = JOURNAL_COMPACT_WINDOWS * m_messages.capacity();
+        if (m_journal.file_records() >= m_journalCompactAt || m_cold.sealed_size() != m_journalSealed)
+            CompactJournal();
+    }
 
-        global_net_engine->setUiCallback([this](std::string msg)
-            {
-
-                if (!s_instance || !IsWindow(m_hWnd)) return;
+    if (global_net_engine)
+    {
 
-                std::wstring wmsg = StringToWString(msg);
-                std::wstring* pPayload = new std::wstring(wmsg);
-                PostMessageW(m_hWnd, WM_USER + 1, 0, (LPARAM)pPayload); });
+        // one post per batch, the messages themselves wait in the engine's ring
+        HWND hWnd = m_hWnd;
+        global_net_engine->setInboundWake([hWnd]
+            { PostMessageW(hWnd, WM_USER + 1, 0, 0); });
 
         global_net_engine->setPingCallback([this](std::string ip, long long ms)
             {
                 if (!s_instance || !IsWindow(m_hWnd)) return;
                 PostMessageW(m_hWnd, WM_USER + 4, (WPARAM)ms, 0); });
 
+        // setup did not wait for the cert, if it failed nothing will ever connect
+        global_net_engine->whenCertificateReady([hWnd](bool ok)
+            {
+                if (!ok)
+                    PostMessageW(hWnd, WM_USER + 5, 0, 0); });
+
+        // catch up with every peer we (re)connect to, and with the ones setup already connected
+        global_net_engine->setSessionCallback([hWnd](std::uint64_t sessionId, std::uint64_t)
+            { PostMessageW(hWnd, WM_USER + 2, (WPARAM)sessionId, 0); });
+        SendSyncRequest();
+
         SetTimer(m_hWnd, 2, 3000, nullptr);
     }
 
@@ -671,17 +709,22 @@ void ChatWindow::PerformSend()
     size_t last = text.find_last_not_of(L" \t\r\n");
     text = text.substr(first, (last - first + 1));
 
+    std::string nick8 = WStringToString(m_localNick);
+    std::string text8 = WStringToString(text);
+
     ChatMessage msg;
-    msg.name = m_localNick;
-    msg.text = text;
+    msg.name = nick8;
+    msg.text = text8;
     msg.isMine = true;
-    m_messages.push_back(msg);
-
-    std::wstring packet = m_localNick + L":" + text;
+    msg.senderId = global_net_engine ? global_net_engine->localPeerId() : 0;
+    msg.seq = ++m_lastSentMsgId;
+    msg.hlc = m_clock.now();
+    m_messages.insert(msg);
+    AppendToJournal(msg);
 
     if (global_net_engine)
     {
-        global_net_engine->broadcast(WStringToString(packet));
+        global_net_engine->broadcast(wire::encode_chat(msg.seq, msg.senderId, msg.hlc, nick8, text8));
     }
 
     SetWindowTextW(m_hEdit, L"");
@@ -694,69 +737,219 @@ void ChatWindow::PerformSend()
     InvalidateRect(m_hWnd, nullptr, FALSE);
 }
 
-void ChatWindow::SendSyncRequest()
+void ChatWindow::SendSyncRequest(std::uint64_t sessionId)
 {
     if (!global_net_engine)
         return;
-    std::wstring p = L"SYNC_REQUEST\n";
-    global_net_engine->broadcast(WStringToString(p));
-}
+    // what we hold per sender, the peer answers with everything past it
+    std::vector<wire::HighWater> marks;
+    marks.reserve(m_messages.high_water().size());
+    bool holes = false;
+    for (const auto& [sender, mark] : m_messages.high_water())
+    {
+        marks.push_back({ sender, mark.seq });
+        holes = holes || mark.has_gaps();
+    }
 
-void ChatWindow::SendSyncResponse()
-{
-    if (!global_net_engine)
-        return;
-    std::wstringstream ss;
-    ss << L"SYNC_RESPONSE\n";
-    for (const auto& m : m_messages)
+    // marks only cover what came after them, a line lost below one needs the filter
+    BloomFilter filter;
+    std::uint64_t since = 0;
+    if ((m_syncMode == SyncMode::Filter || holes) && !m_messages.empty())
     {
-        std::wstring txt = m.text;
-        for (auto& c : txt)
-            if (c == L'\n' || c == L'\r')
-                c = L' ';
-        ss << m.name << L'\t' << txt << L'\n';
+        filter = BloomFilter(m_messages.size(), SYNC_FILTER_FP_RATE);
+        for (const auto& m : m_messages)
+        {
+            if (m.senderId || m.seq)
+                filter.add(m.senderId, m.seq);
+        }
+        // anything older than our oldest would be evicted again right away
+        if (m_messages.size() >= m_messages.capacity())
+            since = m_messages[0].hlc;
     }
-    global_net_engine->broadcast(WStringToString(ss.str()));
+
+    m_syncStats.requestsSent++;
+    std::string frame = wire::encode_sync_request(marks, filter.empty() ? nullptr : &filter, since);
+    if (sessionId)
+        global_net_engine->sendTo(sessionId, std::move(frame), MessageClass::Sync);
+    else
+        global_net_engine->broadcast(std::move(frame), MessageClass::Sync);
 }
 
-void ChatWindow::HandleSyncResponse(const std::wstring& payload)
+void ChatWindow::SendSyncResponse(std::uint64_t sessionId, const wire::FrameView& request, std::size_t requestBytes)
 {
-    std::wistringstream iss(payload);
-    std::wstring line;
-    bool added = false;
-    while (std::getline(iss, line))
-    {
-        if (line.empty())
+    if (!global_net_engine)
+        return;
+    std::vector<wire::HighWater> marks;
+    if (!wire::decode_sync_request(request, marks))
+        return;
+    std::unordered_map<std::uint64_t, std::uint64_t> have;
+    have.reserve(marks.size());
+    for (const auto& m : marks)
+        have[m.sender_id] = std::max(have[m.sender_id], m.seq);
+    BloomFilter filter;
+    std::uint64_t since = 0;
+    bool hasFilter = wire::decode_sync_filter(request, filter, since);
+
+    // records come from the snapshot already encoded, nothing here converts text
+    m_snapshot.refresh(m_messages);
+    std::uint64_t fullBytes = wire::HEADER_SIZE + m_snapshot.body().size();
+
+    // the suffix past each sender's mark, plus with a filter whatever below it the peer lacks
+    std::vector<std::size_t> picked;
+    for (std::size_t i = 0; i < m_messages.size(); ++i)
+    {
+        ChatMessage m = m_messages[i];
+        if (m.senderId == 0 && m.seq == 0)
             continue;
-        size_t tab = line.find(L'\t');
-        std::wstring name = (tab == std::wstring::npos) ? L"Peer" : line.substr(0, tab);
-        std::wstring text = (tab == std::wstring::npos) ? line : line.substr(tab + 1);
-
-        bool found = false;
-        for (const auto& m : m_messages)
+        auto it = have.find(m.senderId);
+        bool pastMark = it == have.end() || m.seq > it->second;
+        if (hasFilter)
         {
-            if (m.name == name && m.text == text)
-            {
-                found = true;
-                break;
-            }
+            if (m.hlc < since || (!pastMark && filter.maybe_contains(m.senderId, m.seq)))
+                continue;
         }
-        if (!found)
+        else if (!pastMark)
         {
-            m_messages.push_back({ name, text, false });
-            added = true;
+            continue;
         }
+        picked.push_back(i);
     }
-    if (added)
+
+    // a peer whose window reaches further back than ours gets the older part from cold storage,
+    // those records are stored encoded and go out as they are
+    std::string coldBody;
+    std::uint32_t coldCount = 0;
+    if (hasFilter && since && !m_messages.empty() && since < m_messages[0].hlc && m_cold.size())
     {
-        if (m_messages.size() > (size_t)MAX_MESSAGES)
-        {
-            while (m_messages.size() > (size_t)MAX_MESSAGES)
-                m_messages.erase(m_messages.begin());
-        }
-        m_isAutoScroll = true;
-        InvalidateRect(m_hWnd, nullptr, FALSE);
+        std::uint64_t end = m_cold.size();
+        std::uint64_t from = std::max(m_cold.lower_bound(since), end - std::min(end, SYNC_COLD_MAX_RECORDS));
+        m_cold.read(from, (std::size_t)(end - from), [&](const ChatMessage& m, std::string_view record)
+            {
+                if (m.senderId == 0 && m.seq == 0)
+                    return;
+                auto it = have.find(m.senderId);
+                bool pastMark = it == have.end() || m.seq > it->second;
+                if (!pastMark && filter.maybe_contains(m.senderId, m.seq))
+                    return;
+                coldBody.append(record);
+                ++coldCount; });
+    }
+
+    std::uint32_t count = (std::uint32_t)picked.size() + coldCount;
+    std::uint64_t sent = 0;
+    if (!coldCount && count && count == m_snapshot.record_count())
+    {
+        // a fresh peer wants everything, every such peer gets the same buffer
+        SharedPayload frame = m_snapshot.full_frame();
+        sent = frame->size();
+        global_net_engine->sendTo(sessionId, std::move(frame), MessageClass::Bulk);
+    }
+    else if (count)
+    {
+        std::size_t bytes = coldBody.size();
+        for (std::size_t i : picked)
+            bytes += m_snapshot.record(i).size();
+        wire::FrameWriter w(wire::FrameType::SyncResponse, bytes);
+        w.append_body(coldBody, coldCount);
+        for (std::size_t i : picked)
+            w.append_body(m_snapshot.record(i), 1);
+        std::string frame = w.finish();
+        sent = frame.size();
+        global_net_engine->sendTo(sessionId, std::move(frame), MessageClass::Bulk);
+    }
+
+    m_syncStats.requestsAnswered++;
+    m_syncStats.recordsSent += count;
+    m_syncStats.bytesExchanged += requestBytes + sent;
+    m_syncStats.fullHistoryBytes += fullBytes;
+}
+
+std::size_t ChatWindow::HandleSyncResponse(const wire::FrameView& frame)
+{
+    std::size_t added = 0;
+    wire::RecordReader reader(frame);
+    wire::RecordView rec;
+    while (reader.next(rec))
+    {
+        m_syncStats.recordsReceived++;
+        if (AddRemoteMessage(rec))
+            ++added;
     }
+    m_syncStats.recordsNew += added;
+    return added;
+}
+
+void ChatWindow::LoadScrollback()
+{
+    std::uint64_t end = m_scrollback.empty() ? m_cold.size() : m_scrollbackFirst;
+    if (end == 0)
+        return;
+    std::uint64_t first = end - std::min<std::uint64_t>(end, SCROLLBACK_PAGE);
+    // the view is at the top, the newest pages are the furthest from it
+    std::size_t room = m_scrollback.capacity() - m_scrollback.size();
+    if (end - first > room)
+        m_scrollback.drop_back((std::size_t)(end - first) - room);
+    // only the segments this page touches get mapped
+    m_scrollbackAdded += m_cold.read(first, (std::size_t)(end - first), [this](const ChatMessage& m, std::string_view)
+        { m_scrollback.insert(m); });
+    m_scrollbackFirst = first;
+    InvalidateRect(m_hWnd, nullptr, FALSE);
+}
+
+void ChatWindow::LoadNewerScrollback()
+{
+    std::uint64_t first = m_scrollbackFirst + m_scrollback.size();
+    std::uint64_t end = std::min<std::uint64_t>(m_cold.size(), first + SCROLLBACK_PAGE);
+    if (first >= end)
+        return;
+    // a full scrollback evicts its oldest, the view is at the bottom so those are the furthest
+    std::uint64_t evicted = m_scrollback.evicted();
+    m_cold.read(first, (std::size_t)(end - first), [this](const ChatMessage& m, std::string_view)
+        { m_scrollback.insert(m); });
+    m_scrollbackFirst += m_scrollback.evicted() - evicted;
+    InvalidateRect(m_hWnd, nullptr, FALSE);
+}
+
+bool ChatWindow::AddRemoteMessage(const wire::RecordView& rec)
+{
+    // cheap id check first so a relayed or resent copy costs no copy into the arena
+    if ((rec.sender_id || rec.msg_id) && m_messages.contains(rec.sender_id, rec.msg_id))
+        return false;
+    ChatMessage m;
+    m.name = rec.nick;
+    m.text = rec.text;
+    m.isMine = false;
+    m.senderId = rec.sender_id;
+    m.seq = rec.msg_id;
+    m.hlc = m_clock.receive(rec.timestamp);
+    if (!m_messages.insert(m))
+        return false;
+    AppendToJournal(m);
+    return true;
+}
+
+void ChatWindow::AppendToJournal(const ChatMessage& m)
+{
+    m_journal.append(m);
+    // once a segment is sealed (and flushed) the journal only has to cover the tail after it
+    if (m_journal.is_open() &&
+        (m_journal.file_records() >= m_journalCompactAt || m_cold.sealed_size() != m_journalSealed))
+        CompactJournal();
+}
+
+void ChatWindow::CompactJournal()
+{
+    // all a restart needs: the cold tail that is not in a segment yet, then the hot window.
+    // only the snapshot is taken here, the journal's writer thread rewrites the file
+    m_journal.compact([this](const std::function<void(const ChatMessage&)>& emit)
+        {
+            std::uint64_t sealed = m_cold.sealed_size();
+            m_cold.read(sealed, (std::size_t)(m_cold.size() - sealed), [&](const ChatMessage& m, std::string_view)
+                { emit(m); });
+            for (const auto& m : m_messages)
+                emit(m); });
+    m_journalCompactAt = m_journal.file_records() + JOURNAL_COMPACT_WINDOWS * m_messages.capacity();
+    m_journalSealed = m_cold.sealed_size();
 }
 
 LRESULT CALLBACK ChatWindow::StaticWndProc(HWND hWnd, UINT msg, WPARAM wParam, LPARAM lParam)
@@ -846,39 +1039,43 @@ LRESULT ChatWindow::WndProc(HWND hWnd, UINT msg, WPARAM wParam, LPARAM lParam)
 
     case WM_USER + 1:
     {
-        std::wstring* raw = (std::wstring*)lParam;
-        if (raw)
-        {
-            std::wstring s = *raw;
-            delete raw;
-
-            if (s.find(L"SYS") == 0 || s.find(L"SYNC") == 0)
-                return 0;
-
-            size_t delimPos = s.find(L':');
-
-            std::wstring senderName = L"Peer";
-            std::wstring msgContent = s;
-
-            if (delimPos != std::wstring::npos)
-            {
-                senderName = s.substr(0, delimPos);
-                msgContent = s.substr(delimPos + 1);
-            }
-
-            ChatMessage msg;
-            msg.name = senderName;
-            msg.text = msgContent;
-            msg.isMine = false;
-
-            m_messages.push_back(msg);
+        if (!global_net_engine)
+            return 0;
 
-            if (m_messages.size() > 1000)
+        // classify on the raw bytes, only chat text gets converted and no view outlives the drain
+        std::size_t added = 0;
+        global_net_engine->drainInbound([&](const RxMessage &msg)
             {
-                m_messages.erase(m_messages.begin());
-            }
-
-            m_isAutoScroll = true;
+                wire::FrameView frame;
+                if (!wire::decode_frame(msg.bytes(), frame))
+                    return;
+                switch (frame.type)
+                {
+                case wire::FrameType::Chat:
+                {
+                    wire::RecordReader reader(frame);
+                    wire::RecordView rec;
+                    if (reader.next(rec) && AddRemoteMessage(rec))
+                        ++added;
+                    break;
+                }
+                case wire::FrameType::SyncRequest:
+                    SendSyncResponse(msg.session_id(), frame, msg.size());
+                    break;
+                case wire::FrameType::SyncResponse:
+                    added += HandleSyncResponse(frame);
+                    break;
+                } }, INBOUND_DRAIN_BATCH);
+
+        if (added)
+        {
+            // new lines only pull the view down if it was already at the bottom
+            float dpi = GetDpiForWindow(hWnd) / 96.0f;
+            RECT rc;
+            GetClientRect(hWnd, &rc);
+            float visibleH = (float)(rc.bottom - rc.top) - (m_inputBarHeight * dpi);
+            if (m_targetScroll >= m_totalContentH - visibleH - 1.0f)
+                m_isAutoScroll = true;
             InvalidateRect(hWnd, nullptr, FALSE);
         }
         return 0;
@@ -886,7 +1083,7 @@ LRESULT ChatWindow::WndProc(HWND hWnd, UINT msg, WPARAM wParam, LPARAM lParam)
 
     case WM_USER + 2:
     {
-        SendSyncRequest();
+        SendSyncRequest((std::uint64_t)wParam);
         return 0;
     }
     case WM_USER + 3:
@@ -901,6 +1098,13 @@ LRESULT ChatWindow::WndProc(HWND hWnd, UINT msg, WPARAM wParam, LPARAM lParam)
         InvalidateRect(m_hWnd, nullptr, FALSE);
         return 0;
     }
+    case WM_USER + 5:
+    {
+        m_certFailed = true;
+        InvalidateRect(m_hWnd, nullptr, FALSE);
+        MessageBoxW(m_hWnd, L"Could not create a TLS certificate, the network cannot start.", L"Error", MB_OK | MB_ICONERROR);
+        return 0;
+    }
 
     case WM_CHAR:
     {
@@ -983,6 +1187,8 @@ LRESULT ChatWindow::WndProc(HWND hWnd, UINT msg, WPARAM wParam, LPARAM lParam)
         float delta = (float)GET_WHEEL_DELTA_WPARAM(wParam);
         m_targetScroll -= delta;
         m_isAutoScroll = false;
+        if (delta > 0 && m_targetScroll <= 0.0f)
+            LoadScrollback();
         SetTimer(hWnd, TIMER_ID_ANIM, 16, nullptr);
         return 0;
     }
@@ -1356,6 +1562,8 @@ LRESULT ChatWindow::WndProc(HWND hWnd, UINT msg, WPARAM wParam, LPARAM lParam)
     case WM_DESTROY:
 
         UnregisterHotKey(m_hWnd, 1);
+        m_journal.close();
+        m_cold.close();
         PostQuitMessage(0);
         return 0;
     }
@@ -1500,6 +1708,85 @@ LRESULT ChatWindow::EditSubclassProcImpl(HWND hWnd, UINT msg, WPARAM wParam, LPA
     return CallWindowProcW(m_oldEditProc, hWnd, msg, wParam, lParam);
 }
 
+void ChatWindow::RefreshBubbles(BubbleCache& cache, const ChatHistory& history, float maxBubbleW, float dpi)
+{
+    auto& bubbles = cache.bubbles;
+    if (cache.maxWidth != maxBubbleW || cache.dpi != dpi || history.evicted() < cache.evicted)
+    {
+        bubbles.clear();
+        cache.maxWidth = maxBubbleW;
+        cache.dpi = dpi;
+        cache.evicted = history.evicted();
+    }
+
+    // a full history only takes messages newer than its front, evictions come off our front
+    std::uint64_t gone = std::min<std::uint64_t>(history.evicted() - cache.evicted, bubbles.size());
+    bubbles.erase(bubbles.begin(), bubbles.begin() + (std::ptrdiff_t)gone);
+    cache.evicted = history.evicted();
+
+    if (history.reorders() != cache.reorders)
+    {
+        auto same = [&](std::size_t bubble, std::size_t i)
+        {
+            ChatMessage m = history[i];
+            return bubbles[bubble].key == MessageKey{ m.senderId, m.seq } && bubbles[bubble].hlc == m.hlc;
+        };
+
+        // late messages land near the end, keep the bubbles before the first one
+        std::size_t kept = 0;
+        std::size_t n = std::min(bubbles.size(), history.size());
+        while (kept < n && same(kept, kept))
+            ++kept;
+
+        // a scrollback page lands in front of everything, and may have pushed pages off the
+        // back: find where our first bubble went and keep the ones that still follow it
+        std::size_t added = 0;
+        if (kept == 0 && !bubbles.empty())
+        {
+            while (added < history.size() && !same(0, added))
+                ++added;
+            if (added == history.size())
+                added = 0;
+            while (added && kept < bubbles.size() && added + kept < history.size() && same(kept, added + kept))
+                ++kept;
+        }
+
+        bubbles.erase(bubbles.begin() + (std::ptrdiff_t)kept, bubbles.end());
+        for (std::size_t i = added; i-- > 0;)
+            bubbles.push_front(LayOutBubble(history[i], maxBubbleW, dpi));
+        cache.reorders = history.reorders();
+    }
+
+    for (std::size_t i = bubbles.size(); i < history.size(); ++i)
+        bubbles.push_back(LayOutBubble(history[i], maxBubbleW, dpi));
+}
+
+BubbleLayout ChatWindow::LayOutBubble(const ChatMessage& m, float maxBubbleW, float dpi)
+{
+    const float inputPadding = 10.0f * dpi;
+    BubbleLayout b;
+    b.key = { m.senderId, m.seq };
+    b.hlc = m.hlc;
+
+    // history keeps utf-8, directwrite wants utf-16
+    std::wstring name = StringToWString(m.name);
+    std::wstring text = StringToWString(m.text);
+    m_dwFactory->CreateTextLayout(name.c_str(), (UINT32)name.size(), m_textFormatName.Get(), maxBubbleW, 500.0f, &b.name);
+    m_dwFactory->CreateTextLayout(text.c_str(), (UINT32)text.size(), m_textFormatMsg.Get(), maxBubbleW, 5000.0f, &b.text);
+
+    DWRITE_TEXT_METRICS mn{}, mm{};
+    b.name->GetMetrics(&mn);
+    b.text->GetMetrics(&mm);
+
+    float contentW = std::max(mn.width, mm.width);
+    float bW = contentW + (inputPadding * 2);
+    float bH = mn.height + mm.height + (inputPadding * 2) + 2.0f * dpi;
+    if (bW < 60.0f * dpi)
+        bW = 60.0f * dpi;
+    b.size = D2D1::SizeF(bW, bH);
+    return b;
+}
+
 void ChatWindow::OnPaint()
 {
     EnsureDeviceResources();
@@ -1621,7 +1908,9 @@ void ChatWindow::OnPaint()
     }
 
     std::wstring titleText = L"Rbx Chat DX11";
-    if (m_pingMs >= 0)
+    if (m_certFailed)
+        titleText += L" • no network";
+    else if (m_pingMs >= 0)
         titleText += L" • " + std::to_wstring(m_pingMs) + L" ms";
     m_d2dContext->DrawTextW(titleText.c_str(), (UINT32)titleText.size(), m_textFormatTitle.Get(),
         D2D1::RectF(12.0f * dpi, 0, width - 80.0f * dpi, titleH), m_brushTextWhite.Get());
@@ -1648,62 +1937,89 @@ void ChatWindow::OnPaint()
 
     float visibleChatH = zoneTopY;
     float totalH = 20.0f * dpi;
-    std::vector<ComPtr<IDWriteTextLayout>> layoutsName, layoutsMsg;
-    std::vector<D2D1_SIZE_F> bubbleSizes;
     float maxBubbleW = width * 0.70f;
 
-    for (const auto& msg : m_messages)
+    // back at the bottom the paged in scrollback goes away again
+    if (m_isAutoScroll && !m_scrollback.empty())
     {
-        ComPtr<IDWriteTextLayout> tlName, tlMsg;
-        m_dwFactory->CreateTextLayout(msg.name.c_str(), (UINT32)msg.name.size(), m_textFormatName.Get(), maxBubbleW, 500.0f, &tlName);
-        m_dwFactory->CreateTextLayout(msg.text.c_str(), (UINT32)msg.text.size(), m_textFormatMsg.Get(), maxBubbleW, 5000.0f, &tlMsg);
-
-        DWRITE_TEXT_METRICS mn{}, mm{};
-        tlName->GetMetrics(&mn);
-        tlMsg->GetMetrics(&mm);
+        m_scrollback.clear();
+        m_scrollbackAdded = 0;
+    }
+    // pages evicted off the top of the scrollback, the view stays on what it was showing
+    float droppedH = 0.0f;
+    if (m_scrollbackBubbles.maxWidth == maxBubbleW && m_scrollbackBubbles.dpi == dpi)
+    {
+        std::uint64_t dropped = std::min<std::uint64_t>(m_scrollback.evicted() - m_scrollbackBubbles.evicted,
+            m_scrollbackBubbles.bubbles.size());
+        for (std::size_t i = 0; i < dropped; ++i)
+            droppedH += m_scrollbackBubbles.bubbles[i].size.height + 10.0f * dpi;
+    }
+    m_currentScroll -= droppedH;
+    m_targetScroll -= droppedH;
 
-        float contentW = std::max(mn.width, mm.width);
-        float bW = contentW + (inputPadding * 2);
-        float bH = mn.height + mm.height + (inputPadding * 2) + 2.0f * dpi;
-        if (bW < 60.0f * dpi)
-            bW = 60.0f * dpi;
+    RefreshBubbles(m_scrollbackBubbles, m_scrollback, maxBubbleW, dpi);
+    RefreshBubbles(m_bubbles, m_messages, maxBubbleW, dpi);
+    float scrollbackH = 0.0f;
+    for (const auto& b : m_scrollbackBubbles.bubbles)
+        scrollbackH += b.size.height + 10.0f * dpi;
+    totalH += scrollbackH;
+    for (const auto& b : m_bubbles.bubbles)
+        totalH += b.size.height + 10.0f * dpi;
+    m_totalContentH = totalH + 20.0f * dpi;
 
-        layoutsName.push_back(tlName);
-        layoutsMsg.push_back(tlMsg);
-        bubbleSizes.push_back(D2D1::SizeF(bW, bH));
-        totalH += bH + 10.0f * dpi;
+    // a page that landed above keeps the view on the message it was showing
+    if (m_scrollbackAdded)
+    {
+        float addedH = 0.0f;
+        for (std::size_t i = 0; i < m_scrollbackAdded && i < m_scrollbackBubbles.bubbles.size(); ++i)
+            addedH += m_scrollbackBubbles.bubbles[i].size.height + 10.0f * dpi;
+        m_currentScroll += addedH;
+        m_targetScroll += addedH;
+        m_scrollbackAdded = 0;
     }
-    m_totalContentH = totalH + 20.0f * dpi;
 
     float maxScroll = std::max(0.0f, m_totalContentH - visibleChatH);
     if (m_isAutoScroll)
         m_targetScroll = maxScroll;
     m_targetScroll = std::clamp(m_targetScroll, 0.0f, maxScroll);
 
+    // a scrollback cut off from the hot window pages forward once its end comes into view
+    if (!m_scrollback.empty() && !ScrollbackAttached() &&
+        titleH + 20.0f * dpi + scrollbackH - m_currentScroll < visibleChatH)
+        LoadNewerScrollback();
+
     m_d2dContext->PushAxisAlignedClip(D2D1::RectF(0, titleH, width, visibleChatH), D2D1_ANTIALIAS_MODE_PER_PRIMITIVE);
     float curY = titleH + 20.0f * dpi - m_currentScroll;
-    for (size_t i = 0; i < m_messages.size(); ++i)
+    // scrollback above the hot window, both drawn straight from their history
+    auto drawBubbles = [&](const BubbleCache& cache, const ChatHistory& history)
     {
-        float bW = bubbleSizes[i].width;
-        float bH = bubbleSizes[i].height;
-        if (curY + bH > titleH && curY < visibleChatH)
+        for (size_t i = 0; i < history.size(); ++i)
         {
-            float left = m_messages[i].isMine ? (width - bW - 20.0f * dpi) : 20.0f * dpi;
-            D2D1_RECT_F bRect = D2D1::RectF(left, curY, left + bW, curY + bH);
-            ID2D1Brush* bBrush = m_messages[i].isMine ? m_brushBubbleMe.Get() : m_brushBubbleSys.Get();
+            const BubbleLayout& b = cache.bubbles[i];
+            float bW = b.size.width;
+            float bH = b.size.height;
+            if (curY + bH > titleH && curY < visibleChatH)
+            {
+                bool isMine = history[i].isMine;
+                float left = isMine ? (width - bW - 20.0f * dpi) : 20.0f * dpi;
+                D2D1_RECT_F bRect = D2D1::RectF(left, curY, left + bW, curY + bH);
+                ID2D1Brush* bBrush = isMine ? m_brushBubbleMe.Get() : m_brushBubbleSys.Get();
 
-            m_d2dContext->FillRoundedRectangle(D2D1::RoundedRect(bRect, 12.0f, 12.0f), bBrush);
+                m_d2dContext->FillRoundedRectangle(D2D1::RoundedRect(bRect, 12.0f, 12.0f), bBrush);
 
-            m_d2dContext->DrawTextLayout(D2D1::Point2F(bRect.left + inputPadding, bRect.top + inputPadding),
-                layoutsName[i].Get(), m_brushTextName.Get());
+                m_d2dContext->DrawTextLayout(D2D1::Point2F(bRect.left + inputPadding, bRect.top + inputPadding),
+                    b.name.Get(), m_brushTextName.Get());
 
-            DWRITE_TEXT_METRICS mn;
-            layoutsName[i]->GetMetrics(&mn);
-            m_d2dContext->DrawTextLayout(D2D1::Point2F(bRect.left + inputPadding, bRect.top + inputPadding + mn.height),
-                layoutsMsg[i].Get(), m_brushTextWhite.Get());
+                DWRITE_TEXT_METRICS mn;
+                b.name->GetMetrics(&mn);
+                m_d2dContext->DrawTextLayout(D2D1::Point2F(bRect.left + inputPadding, bRect.top + inputPadding + mn.height),
+                    b.text.Get(), m_brushTextWhite.Get());
+            }
+            curY += bH + 10.0f * dpi;
         }
-        curY += bH + 10.0f * dpi;
-    }
+    };
+    drawBubbles(m_scrollbackBubbles, m_scrollback);
+    drawBubbles(m_bubbles, m_messages);
     m_d2dContext->PopAxisAlignedClip();
 
     m_d2dContext->FillRectangle(D2D1::RectF(0, zoneTopY, width, height), m_brushBg.Get());
@@ -7,8 +7,15 @@
 #include <d2d1_1.h>
 #include <dwrite.h>
 #include <wrl/client.h>
+#include <deque>
 #include <vector>
 #include "ChatMessage.h"
+#include "ChatHistory.h"
+#include "HybridClock.h"
+#include "HistorySnapshot.h"
+#include "ChatJournal.h"
+#include "ColdHistory.h"
+#include "WireProtocol.h"
 #include <d3d11.h>
 #include <dxgi1_2.h>
 #include <d2d1.h>
@@ -23,18 +30,57 @@
 
 using Microsoft::WRL::ComPtr;
 
-struct ChatMsg
+enum class SyncMode
 {
-    std::wstring sender;
-    std::wstring content;
-    bool isMe;
-    DWORD timestamp;
+    // per sender high water marks, fills in what was said while we were away. while a sender
+    // has a hole below its mark the request carries the filter anyway
+    HighWater,
+    // marks plus a bloom filter of the ids we hold, also repairs holes left by merged histories
+    Filter,
+};
+
+struct SyncStats
+{
+    std::uint64_t requestsSent = 0;
+    std::uint64_t requestsAnswered = 0;
+    std::uint64_t recordsSent = 0;
+    std::uint64_t recordsReceived = 0;
+    std::uint64_t recordsNew = 0;
+    // request + response bytes for the requests we answered, against resending the whole history
+    std::uint64_t bytesExchanged = 0;
+    std::uint64_t fullHistoryBytes = 0;
+
+    std::uint64_t bytesSaved() const { return fullHistoryBytes > bytesExchanged ? fullHistoryBytes - bytesExchanged : 0; }
+};
+
+// a drawn message: its DirectWrite layouts and the bubble around them
+struct BubbleLayout
+{
+    MessageKey key;
+    std::uint64_t hlc = 0;
+    ComPtr<IDWriteTextLayout> name;
+    ComPtr<IDWriteTextLayout> text;
+    D2D1_SIZE_F size{};
+};
+
+// bubbles for one history, kept in step with it like HistorySnapshot keeps its records:
+// appends lay out just the new tail, evictions drop from the front, a late message lays out
+// again from where it landed, a page of scrollback in front only lays out that page and a
+// new bubble width or dpi lays out everything
+struct BubbleCache
+{
+    std::deque<BubbleLayout> bubbles;
+    std::uint64_t evicted = 0;
+    std::uint64_t reorders = 0;
+    float maxWidth = 0.0f;
+    float dpi = 0.0f;
 };
 
 class ChatWindow
 {
 public:
-    ChatWindow(HINSTANCE hInstance);
+    // history keeps the newest historyCapacity messages, the store itself goes well past the default
+    ChatWindow(HINSTANCE hInstance, std::size_t historyCapacity = MAX_MESSAGES);
     ~ChatWindow();
 
     bool Create(int x, int y, int w, int h, int nCmdShow);
@@ -49,7 +95,6 @@ private:
     HWND m_hWnd;
     HWND m_hEdit;
     WNDPROC m_oldEditProc;
-    std::vector<ChatMsg> m_messagesInternal;
 
     ComPtr<ID3D11Device> m_d3dDevice;
     ComPtr<ID3D11DeviceContext> m_d3dContext;
@@ -75,7 +120,25 @@ private:
 
     HBRUSH m_hbrEditBg;
 
-    std::vector<ChatMessage> m_messages;
+    ChatHistory m_messages{ MAX_MESSAGES };
+    // only messages that are new since the last frame get converted to utf-16 and laid out
+    BubbleCache m_bubbles;
+    HybridClock m_clock;
+    HistorySnapshot m_snapshot;
+    ChatJournal m_journal;
+    // file_records() at which the journal gets rewritten next
+    std::uint64_t m_journalCompactAt = 0;
+    // m_cold.sealed_size() as of the last rewrite, a new segment makes its part of the journal dead weight
+    std::uint64_t m_journalSealed = 0;
+    // everything the hot window evicted, and the few pages of it around the view that scrolling
+    // paged back in. m_scrollbackFirst is the cold position of m_scrollback[0]
+    ColdHistory m_cold;
+    ChatHistory m_scrollback{ SCROLLBACK_PAGES * SCROLLBACK_PAGE };
+    BubbleCache m_scrollbackBubbles;
+    std::uint64_t m_scrollbackFirst = 0;
+    std::size_t m_scrollbackAdded = 0;
+    SyncStats m_syncStats;
+    SyncMode m_syncMode = SyncMode::Filter;
 
     int m_titleHeight;
     RECT m_closeRect;
@@ -114,7 +177,19 @@ private:
     int m_dragInputStartTopLine = 0;
 
     float m_inputBarHeight;
-    const int MAX_MESSAGES = 1000;
+    static constexpr int MAX_MESSAGES = 1000;
+    // messages taken from the network per WM_USER + 1, the rest come with the next post
+    const std::size_t INBOUND_DRAIN_BATCH = 512;
+    // the journal is compacted after this many windows' worth of appends
+    const std::uint64_t JOURNAL_COMPACT_WINDOWS = 8;
+    // messages paged in from cold storage per scroll past the top, and the pages kept around the
+    // view. paging further drops the pages furthest from it
+    static constexpr std::size_t SCROLLBACK_PAGE = 100;
+    static constexpr std::size_t SCROLLBACK_PAGES = 5;
+    // at most a peer's window of older records when it asks for more than our hot window holds
+    const std::uint64_t SYNC_COLD_MAX_RECORDS = MAX_MESSAGES;
+    // ~9.6 bits per held id, a missing message hides behind a false positive 1% of the time
+    const double SYNC_FILTER_FP_RATE = 0.01;
     const DWORD CARET_BLINK_MS = 500;
     const float SCROLL_SPEED_FACTOR = 0.15f;
     const float HOVER_ANIM_SPEED = 0.18f;
@@ -132,18 +207,30 @@ private:
     DWORD m_nextSendAllowedTick = 0;
 
     int m_pingMs;
+    bool m_certFailed = false;
     DWORD m_lastSendTick;
+    std::uint64_t m_lastSentMsgId = 0;
 
     HRESULT CreateDeviceIndependentResources();
     HRESULT CreateDeviceResources();
     void EnsureDeviceResources();
     void DiscardDeviceResources();
     void OnPaint();
+    void RefreshBubbles(BubbleCache &cache, const ChatHistory &history, float maxBubbleW, float dpi);
+    BubbleLayout LayOutBubble(const ChatMessage &m, float maxBubbleW, float dpi);
     void CreateInputControl();
-
-    void SendSyncRequest();
-    void SendSyncResponse();
-    void HandleSyncResponse(const std::wstring &payload);
+    void AppendToJournal(const ChatMessage &m);
+    void CompactJournal();
+
+    // session 0 asks every peer
+    void SendSyncRequest(std::uint64_t sessionId = 0);
+    void SendSyncResponse(std::uint64_t sessionId, const wire::FrameView &request, std::size_t requestBytes);
+    std::size_t HandleSyncResponse(const wire::FrameView &frame);
+    bool AddRemoteMessage(const wire::RecordView &rec);
+    void LoadScrollback();
+    void LoadNewerScrollback();
+    // the scrollback runs on into the hot window, nothing evicted since is missing from it
+    bool ScrollbackAttached() const { return m_scrollbackFirst + m_scrollback.size() == m_cold.size(); }
     static LRESULT CALLBACK SubEditProc(HWND hWnd, UINT msg, WPARAM wParam, LPARAM lParam, UINT_PTR uIdSubclass, DWORD_PTR dwRefData);
 
     static LRESULT CALLBACK StaticWndProc(HWND hWnd, UINT msg, WPARAM wParam, LPARAM lParam);
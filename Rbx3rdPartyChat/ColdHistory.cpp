@@ -0,0 +1,529 @@
+#include "pch.h"
+#include "ColdHistory.h"
+#include "ChatJournal.h"
+#include "WireProtocol.h"
+
+ColdHistory::~ColdHistory()
+{
+    close();
+}
+
+std::wstring ColdHistory::default_dir()
+{
+    std::wstring dir = ChatJournal::data_dir();
+    if (dir.empty())
+        return dir;
+    dir += L"\\cold";
+    CreateDirectoryW(dir.c_str(), nullptr);
+    return dir;
+}
+
+std::wstring ColdHistory::segment_path(std::uint32_t number) const
+{
+    wchar_t name[32];
+    std::swprintf(name, 32, L"\\seg-%08u.seg", number);
+    return dir_ + name;
+}
+
+bool ColdHistory::open(const std::wstring &dir)
+{
+    close();
+    if (dir.empty())
+        return false;
+    dir_ = dir;
+    CreateDirectoryW(dir_.c_str(), nullptr);
+
+    WIN32_FIND_DATAW fd;
+    // a seal the crash interrupted before its rename
+    HANDLE find = FindFirstFileW((dir_ + L"\\*.tmp").c_str(), &fd);
+    if (find != INVALID_HANDLE_VALUE)
+    {
+        do
+            DeleteFileW((dir_ + L"\\" + fd.cFileName).c_str());
+        while (FindNextFileW(find, &fd));
+        FindClose(find);
+    }
+
+    std::vector<std::uint32_t> numbers;
+    find = FindFirstFileW((dir_ + L"\\seg-*.seg").c_str(), &fd);
+    if (find != INVALID_HANDLE_VALUE)
+    {
+        do
+            numbers.push_back(static_cast<std::uint32_t>(std::wcstoul(fd.cFileName + 4, nullptr, 10)));
+        while (FindNextFileW(find, &fd));
+        FindClose(find);
+    }
+    std::sort(numbers.begin(), numbers.end());
+
+    for (std::uint32_t number : numbers)
+    {
+        Segment seg;
+        seg.path = segment_path(number);
+        next_number_ = number + 1;
+
+        HANDLE file = CreateFileW(seg.path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                                  FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file == INVALID_HANDLE_VALUE)
+            continue;
+        char header[HEADER_SIZE];
+        DWORD got = 0;
+        LARGE_INTEGER size{};
+        bool ok = GetFileSizeEx(file, &size) && ReadFile(file, header, HEADER_SIZE, &got, nullptr) &&
+                  got == HEADER_SIZE && load_header(seg, static_cast<std::uint64_t>(size.QuadPart), header);
+        CloseHandle(file);
+        if (!ok)
+        {
+            // renamed before its bytes reached the disk, the journal replay spills it again
+            DeleteFileW(seg.path.c_str());
+            continue;
+        }
+
+        seg.start = sealed_;
+        sealed_ += seg.count;
+        last_hlc_ = seg.last_hlc;
+        last_sender_ = wire::get_u64(header + 40);
+        last_seq_ = wire::get_u64(header + 48);
+        segments_.push_back(std::move(seg));
+    }
+    return true;
+}
+
+bool ColdHistory::load_header(Segment &seg, std::uint64_t file_size, const char *header)
+{
+    if (wire::get_u32(header) != FILE_MAGIC || wire::get_u32(header + 4) != FILE_VERSION)
+        return false;
+    seg.count = wire::get_u32(header + 8);
+    if (seg.count == 0 || wire::get_u32(header + 12) != INDEX_STRIDE)
+        return false;
+    seg.index_offset = wire::get_u64(header + 16);
+    seg.first_hlc = wire::get_u64(header + 24);
+    seg.last_hlc = wire::get_u64(header + 32);
+    seg.id_count = wire::get_u32(header + 56);
+    seg.sender_count = wire::get_u32(header + 60);
+    std::uint64_t entries = (seg.count + INDEX_STRIDE - 1) / INDEX_STRIDE;
+    seg.ids_offset = seg.index_offset + entries * INDEX_ENTRY_SIZE;
+    return seg.index_offset >= HEADER_SIZE && seg.id_count <= seg.count && seg.sender_count <= seg.id_count &&
+           seg.ids_offset + seg.id_count * ID_ENTRY_SIZE + seg.sender_count * SENDER_ENTRY_SIZE == file_size;
+}
+
+bool ColdHistory::map(Segment &seg)
+{
+    seg.last_used = ++use_clock_;
+    if (seg.view)
+        return true;
+
+    seg.file = CreateFileW(seg.path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                           FILE_FLAG_RANDOM_ACCESS, nullptr);
+    if (seg.file == INVALID_HANDLE_VALUE)
+        return false;
+    seg.mapping = CreateFileMappingW(seg.file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (seg.mapping)
+        seg.view = static_cast<const char *>(MapViewOfFile(seg.mapping, FILE_MAP_READ, 0, 0, 0));
+    if (!seg.view)
+    {
+        unmap(seg);
+        return false;
+    }
+    stats_.page_ins++;
+
+    // only a few stay mapped, scrolling far back doesn't keep every segment resident
+    std::size_t mapped = 0;
+    Segment *oldest = nullptr;
+    for (auto &s : segments_)
+    {
+        if (!s.view)
+            continue;
+        ++mapped;
+        if (&s != &seg && (!oldest || s.last_used < oldest->last_used))
+            oldest = &s;
+    }
+    if (mapped > MAX_MAPPED && oldest)
+        unmap(*oldest);
+    return true;
+}
+
+void ColdHistory::unmap(Segment &seg)
+{
+    if (seg.view)
+        UnmapViewOfFile(seg.view);
+    if (seg.mapping)
+        CloseHandle(seg.mapping);
+    if (seg.file != INVALID_HANDLE_VALUE)
+        CloseHandle(seg.file);
+    seg.view = nullptr;
+    seg.mapping = nullptr;
+    seg.file = INVALID_HANDLE_VALUE;
+}
+
+bool ColdHistory::bytes_of(std::size_t segment, Bytes &out)
+{
+    if (segment < segments_.size())
+    {
+        Segment &seg = segments_[segment];
+        if (!map(seg))
+            return false;
+        out.base = seg.view;
+        out.index = seg.view + seg.index_offset;
+        out.end = seg.index_offset;
+        out.count = seg.count;
+        return true;
+    }
+    if (!pending_count_)
+        return false;
+    out.base = pending_.data();
+    out.index = pending_index_.data();
+    out.end = pending_.size();
+    out.count = pending_count_;
+    return true;
+}
+
+std::size_t ColdHistory::read(std::uint64_t first, std::size_t count,
+                              const std::function<void(const ChatMessage &, std::string_view)> &fn)
+{
+    std::size_t visited = 0;
+    if (first >= size())
+        return 0;
+
+    std::size_t s = segments_.size();
+    if (first < sealed_)
+    {
+        auto it = std::upper_bound(segments_.begin(), segments_.end(), first,
+                                   [](std::uint64_t pos, const Segment &seg)
+                                   { return pos < seg.start; });
+        s = static_cast<std::size_t>(it - segments_.begin()) - 1;
+    }
+
+    std::uint64_t pos = first;
+    for (; visited < count && pos < size(); ++s)
+    {
+        Bytes b;
+        if (!bytes_of(s, b))
+            break;
+        std::uint64_t start = s < segments_.size() ? segments_[s].start : sealed_;
+        std::uint32_t local = static_cast<std::uint32_t>(pos - start);
+
+        // jump to the indexed record at or before the one we want, walk the rest
+        std::uint64_t off = wire::get_u64(b.index + (local / INDEX_STRIDE) * INDEX_ENTRY_SIZE + 8);
+        for (std::uint32_t i = local - local % INDEX_STRIDE; i < local && off + 4 <= b.end; ++i)
+            off += 4 + wire::get_u32(b.base + off);
+
+        for (std::uint32_t i = local; i < b.count && visited < count; ++i)
+        {
+            if (off + 5 > b.end)
+                return visited;
+            std::uint32_t len = wire::get_u32(b.base + off);
+            if (len < 1 || len > b.end - off - 4)
+                return visited;
+
+            wire::FrameView frame;
+            frame.count = 1;
+            frame.body = std::string_view(b.base + off + 5, len - 1);
+            wire::RecordReader reader(frame);
+            wire::RecordView rec;
+            if (!reader.next(rec))
+                return visited;
+
+            ChatMessage m;
+            m.name = rec.nick;
+            m.text = rec.text;
+            m.isMine = (static_cast<std::uint8_t>(b.base[off + 4]) & FLAG_MINE) != 0;
+            m.senderId = rec.sender_id;
+            m.seq = rec.msg_id;
+            m.hlc = rec.timestamp;
+            fn(m, frame.body);
+
+            off += 4 + len;
+            ++visited;
+            ++pos;
+        }
+    }
+    return visited;
+}
+
+std::uint64_t ColdHistory::lower_bound(std::uint64_t hlc)
+{
+    // segments hold disjoint, ascending hlc ranges, the first one reaching hlc has the answer
+    auto it = std::lower_bound(segments_.begin(), segments_.end(), hlc,
+                               [](const Segment &seg, std::uint64_t h)
+                               { return seg.last_hlc < h; });
+    std::size_t s = static_cast<std::size_t>(it - segments_.begin());
+    if (s == segments_.size() && (!pending_count_ || last_hlc_ < hlc))
+        return size();
+
+    Bytes b;
+    if (!bytes_of(s, b))
+        return size();
+    std::uint64_t start = s < segments_.size() ? segments_[s].start : sealed_;
+
+    // last index entry still before hlc, then at most a stride of records
+    std::uint32_t entries = (b.count + INDEX_STRIDE - 1) / INDEX_STRIDE;
+    std::uint32_t lo = 0, hi = entries;
+    while (hi - lo > 1)
+    {
+        std::uint32_t mid = (lo + hi) / 2;
+        if (wire::get_u64(b.index + mid * INDEX_ENTRY_SIZE) < hlc)
+            lo = mid;
+        else
+            hi = mid;
+    }
+
+    std::uint64_t off = wire::get_u64(b.index + lo * INDEX_ENTRY_SIZE + 8);
+    for (std::uint32_t i = lo * INDEX_STRIDE; i < b.count && off + 5 + 24 <= b.end; ++i)
+    {
+        // the wire record starts with msg_id, sender_id, timestamp
+        if (wire::get_u64(b.base + off + 5 + 16) >= hlc)
+            return start + i;
+        off += 4 + wire::get_u32(b.base + off);
+    }
+    return start + b.count;
+}
+
+std::uint64_t ColdHistory::find(std::uint64_t sender_id, std::uint64_t seq)
+{
+    // the tail is the newest and at most a segment's worth of ids
+    for (std::size_t i = pending_ids_.size(); i-- > 0;)
+    {
+        if (pending_ids_[i].sender == sender_id && pending_ids_[i].seq == seq)
+            return sealed_ + pending_ids_[i].record;
+    }
+
+    for (std::size_t s = segments_.size(); s-- > 0;)
+    {
+        Segment &seg = segments_[s];
+        // the sender's run of the id section, all of it if the sender table can't be read
+        std::uint32_t lo = 0, hi = seg.id_count;
+        if (load_senders(seg))
+        {
+            auto run = std::lower_bound(seg.senders.begin(), seg.senders.end(), sender_id,
+                                        [](const SenderRun &r, std::uint64_t id)
+                                        { return r.sender < id; });
+            if (run == seg.senders.end() || run->sender != sender_id || seq < run->min_seq || seq > run->max_seq)
+            {
+                stats_.id_skips++;
+                continue;
+            }
+            lo = run->first;
+            hi = run->first + run->count;
+        }
+        if (!map(seg))
+            continue;
+        stats_.id_searches++;
+
+        const char *ids = seg.view + seg.ids_offset;
+        while (lo < hi)
+        {
+            std::uint32_t mid = lo + (hi - lo) / 2;
+            const char *e = ids + mid * ID_ENTRY_SIZE;
+            std::uint64_t at_sender = wire::get_u64(e), at_seq = wire::get_u64(e + 8);
+            if (std::tie(at_sender, at_seq) < std::tie(sender_id, seq))
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        const char *e = ids + lo * ID_ENTRY_SIZE;
+        if (lo < seg.id_count && wire::get_u64(e) == sender_id && wire::get_u64(e + 8) == seq)
+            return seg.start + wire::get_u32(e + 16);
+    }
+    return size();
+}
+
+bool ColdHistory::load_senders(Segment &seg)
+{
+    if (seg.senders_loaded)
+        return true;
+    std::string bytes(seg.sender_count * SENDER_ENTRY_SIZE, '\0');
+    HANDLE file = CreateFileW(seg.path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                              FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+        return false;
+    LARGE_INTEGER at{};
+    at.QuadPart = static_cast<LONGLONG>(seg.ids_offset + seg.id_count * ID_ENTRY_SIZE);
+    DWORD got = 0;
+    bool ok = SetFilePointerEx(file, at, nullptr, FILE_BEGIN) &&
+              ReadFile(file, bytes.data(), static_cast<DWORD>(bytes.size()), &got, nullptr) && got == bytes.size();
+    CloseHandle(file);
+    if (!ok)
+        return false;
+
+    seg.senders.resize(seg.sender_count);
+    for (std::uint32_t i = 0; i < seg.sender_count; ++i)
+    {
+        const char *e = bytes.data() + i * SENDER_ENTRY_SIZE;
+        SenderRun &run = seg.senders[i];
+        run.sender = wire::get_u64(e);
+        run.min_seq = wire::get_u64(e + 8);
+        run.max_seq = wire::get_u64(e + 16);
+        run.first = wire::get_u32(e + 24);
+        run.count = wire::get_u32(e + 28);
+    }
+    seg.senders_loaded = true;
+    return true;
+}
+
+void ColdHistory::spill(const ChatMessage &m)
+{
+    if (!is_open())
+        return;
+    if (size() && std::tie(m.hlc, m.senderId, m.seq) <= std::tie(last_hlc_, last_sender_, last_seq_))
+    {
+        stats_.skipped++;
+        return;
+    }
+
+    if (!pending_count_)
+    {
+        pending_.assign(HEADER_SIZE, '\0');
+        pending_first_hlc_ = m.hlc;
+    }
+    if (pending_count_ % INDEX_STRIDE == 0)
+    {
+        wire::put_u64(pending_index_, m.hlc);
+        wire::put_u64(pending_index_, pending_.size());
+    }
+
+    std::size_t at = pending_.size();
+    pending_.append(4, '\0');
+    pending_.push_back(static_cast<char>(m.isMine ? FLAG_MINE : 0));
+    wire::append_record(pending_, m.seq, m.senderId, m.hlc, m.name, m.text);
+    std::uint32_t len = static_cast<std::uint32_t>(pending_.size() - at - 4);
+    for (int i = 0; i < 4; ++i)
+        pending_[at + i] = static_cast<char>(len >> (8 * i));
+
+    // messages without an id can't be looked up by one
+    if (m.senderId || m.seq)
+        pending_ids_.push_back({m.senderId, m.seq, pending_count_});
+    ++pending_count_;
+    stats_.spilled++;
+    last_hlc_ = m.hlc;
+    last_sender_ = m.senderId;
+    last_seq_ = m.seq;
+
+    // a failed write keeps the tail in memory and tries again a stride later, the id section
+    // is built when the segment is sealed so the tail can grow past SEGMENT_RECORDS meanwhile
+    if (pending_count_ >= seal_at_ && !seal())
+        seal_at_ = pending_count_ + INDEX_STRIDE;
+}
+
+bool ColdHistory::seal()
+{
+    if (!pending_count_)
+        return true;
+
+    // ids sorted by (sender, seq), each sender's ids one run of them
+    std::sort(pending_ids_.begin(), pending_ids_.end(), [](const IdEntry &a, const IdEntry &b)
+              { return std::tie(a.sender, a.seq, a.record) < std::tie(b.sender, b.seq, b.record); });
+    std::string ids;
+    std::vector<SenderRun> senders;
+    for (std::uint32_t i = 0; i < pending_ids_.size(); ++i)
+    {
+        const IdEntry &id = pending_ids_[i];
+        wire::put_u64(ids, id.sender);
+        wire::put_u64(ids, id.seq);
+        wire::put_u32(ids, id.record);
+        if (senders.empty() || senders.back().sender != id.sender)
+            senders.push_back({id.sender, id.seq, id.seq, i, 0});
+        senders.back().max_seq = id.seq;
+        senders.back().count++;
+    }
+    for (const auto &run : senders)
+    {
+        wire::put_u64(ids, run.sender);
+        wire::put_u64(ids, run.min_seq);
+        wire::put_u64(ids, run.max_seq);
+        wire::put_u32(ids, run.first);
+        wire::put_u32(ids, run.count);
+    }
+
+    std::string header;
+    wire::put_u32(header, FILE_MAGIC);
+    wire::put_u32(header, FILE_VERSION);
+    wire::put_u32(header, pending_count_);
+    wire::put_u32(header, INDEX_STRIDE);
+    wire::put_u64(header, pending_.size());
+    wire::put_u64(header, pending_first_hlc_);
+    wire::put_u64(header, last_hlc_);
+    wire::put_u64(header, last_sender_);
+    wire::put_u64(header, last_seq_);
+    wire::put_u32(header, static_cast<std::uint32_t>(pending_ids_.size()));
+    wire::put_u32(header, static_cast<std::uint32_t>(senders.size()));
+    std::memcpy(pending_.data(), header.data(), HEADER_SIZE);
+
+    // written under a temp name and renamed, a segment is either whole or absent
+    Segment seg;
+    seg.path = segment_path(next_number_);
+    std::wstring tmp = seg.path + L".tmp";
+    HANDLE file = CreateFileW(tmp.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+    {
+        stats_.write_errors++;
+        return false;
+    }
+    DWORD n1 = 0, n2 = 0, n3 = 0;
+    bool ok = WriteFile(file, pending_.data(), static_cast<DWORD>(pending_.size()), &n1, nullptr) &&
+              n1 == pending_.size() &&
+              WriteFile(file, pending_index_.data(), static_cast<DWORD>(pending_index_.size()), &n2, nullptr) &&
+              n2 == pending_index_.size() &&
+              WriteFile(file, ids.data(), static_cast<DWORD>(ids.size()), &n3, nullptr) && n3 == ids.size() &&
+              FlushFileBuffers(file);
+    CloseHandle(file);
+    // on disk before it gets its name, from then on the journal no longer has to hold these
+    if (!ok || !MoveFileExW(tmp.c_str(), seg.path.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH))
+    {
+        DeleteFileW(tmp.c_str());
+        stats_.write_errors++;
+        return false;
+    }
+
+    seg.start = sealed_;
+    seg.count = pending_count_;
+    seg.index_offset = pending_.size();
+    seg.first_hlc = pending_first_hlc_;
+    seg.last_hlc = last_hlc_;
+    seg.ids_offset = pending_.size() + pending_index_.size();
+    seg.id_count = static_cast<std::uint32_t>(pending_ids_.size());
+    seg.sender_count = static_cast<std::uint32_t>(senders.size());
+    seg.senders = std::move(senders);
+    seg.senders_loaded = true;
+    segments_.push_back(std::move(seg));
+    sealed_ += pending_count_;
+    ++next_number_;
+
+    pending_.clear();
+    pending_index_.clear();
+    pending_ids_.clear();
+    pending_count_ = 0;
+    seal_at_ = SEGMENT_RECORDS;
+    return true;
+}
+
+void ColdHistory::close()
+{
+    if (!is_open())
+        return;
+    // an unsealed tail is dropped, the journal still holds it
+    for (auto &seg : segments_)
+        unmap(seg);
+    segments_.clear();
+    pending_.clear();
+    pending_index_.clear();
+    pending_ids_.clear();
+    pending_count_ = 0;
+    seal_at_ = SEGMENT_RECORDS;
+    sealed_ = 0;
+    next_number_ = 0;
+    last_hlc_ = last_sender_ = last_seq_ = 0;
+    dir_.clear();
+}
+
+ColdStats ColdHistory::stats() const
+{
+    ColdStats s = stats_;
+    s.segments = segments_.size();
+    s.mapped_segments = 0;
+    for (const auto &seg : segments_)
+    {
+        if (seg.view)
+            s.mapped_segments++;
+    }
+    return s;
+}
@@ -0,0 +1,163 @@
+#pragma once
+#include "ChatMessage.h"
+#include <windows.h>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+struct ColdStats
+{
+    std::uint64_t segments = 0;
+    std::uint64_t mapped_segments = 0;
+    std::uint64_t spilled = 0;
+    // spills already on disk from an earlier run, the journal replays them on every start
+    std::uint64_t skipped = 0;
+    // segments mapped on demand, each one is a page-in
+    std::uint64_t page_ins = 0;
+    // segments a lookup by id ruled out by their sender table, and the ones it searched
+    std::uint64_t id_skips = 0;
+    std::uint64_t id_searches = 0;
+    std::uint64_t write_errors = 0;
+};
+
+// messages the hot window evicted, oldest first, in immutable segment files under one folder:
+//   header: u32 magic, u32 version, u32 count, u32 index stride, u64 index offset,
+//           u64 first hlc, u64 last hlc, u64 last sender, u64 last seq,
+//           u32 id entries, u32 senders
+//   records: u32 length, u8 flags, a wire record (see WireProtocol.h)
+//   index: every INDEX_STRIDE-th record as u64 hlc, u64 offset
+//   ids: u64 sender, u64 seq, u32 record for every message with an id, sorted by (sender, seq)
+//   senders: u64 sender, u64 lowest seq, u64 highest seq, u32 first id, u32 ids per sender
+// a message's position (0 = oldest ever spilled) never changes, the index finds a position or
+// a time with one lookup and at most a stride of records scanned. a lookup by id skips the
+// segments whose sender table rules it out and binary searches the ids of the rest.
+// segments are only mapped when a read reaches them and a few stay mapped, so what is
+// resident follows what was read. the tail that doesn't fill a segment yet stays in memory,
+// it is only sealed at SEGMENT_RECORDS. a segment is flushed before it is renamed into
+// place, so what it holds can be dropped from the journal; the unsealed tail lives in the
+// journal until then, close leaves it there and the next start spills it again
+class ColdHistory
+{
+public:
+    static constexpr std::uint32_t SEGMENT_RECORDS = 16384;
+    static constexpr std::uint32_t INDEX_STRIDE = 64;
+    static constexpr std::size_t MAX_MAPPED = 4;
+
+    ColdHistory() = default;
+    ~ColdHistory();
+    ColdHistory(const ColdHistory &) = delete;
+    ColdHistory &operator=(const ColdHistory &) = delete;
+
+    // reads segment headers only, a torn segment from a crash is deleted
+    bool open(const std::wstring &dir);
+    void close();
+    bool is_open() const { return !dir_.empty(); }
+
+    // takes evicted messages in history order, anything not newer than the last one is skipped
+    void spill(const ChatMessage &m);
+
+    std::uint64_t size() const { return sealed_ + pending_count_; }
+    // messages in segment files, from here to size() is the in-memory tail
+    std::uint64_t sealed_size() const { return sealed_; }
+    // messages at first .. first + count - 1, oldest first, with their encoded wire record.
+    // both only live inside fn. returns how many were visited
+    std::size_t read(std::uint64_t first, std::size_t count,
+                     const std::function<void(const ChatMessage &, std::string_view)> &fn);
+    // position of the first message with hlc >= the given one, size() if none
+    std::uint64_t lower_bound(std::uint64_t hlc);
+    // position of the message with this id, size() if none. newest segments first
+    std::uint64_t find(std::uint64_t sender_id, std::uint64_t seq);
+
+    ColdStats stats() const;
+    // the folder cold segments live in, next to the journal
+    static std::wstring default_dir();
+
+private:
+    static constexpr std::uint32_t FILE_MAGIC = 0x53584252; // "RBXS"
+    static constexpr std::uint32_t FILE_VERSION = 1;
+    static constexpr std::size_t HEADER_SIZE = 64;
+    static constexpr std::size_t INDEX_ENTRY_SIZE = 16;
+    static constexpr std::size_t ID_ENTRY_SIZE = 20;
+    static constexpr std::size_t SENDER_ENTRY_SIZE = 32;
+    static constexpr std::uint8_t FLAG_MINE = 0x01;
+
+    struct IdEntry
+    {
+        std::uint64_t sender = 0;
+        std::uint64_t seq = 0;
+        std::uint32_t record = 0;
+    };
+
+    // one sender's run of the id section
+    struct SenderRun
+    {
+        std::uint64_t sender = 0;
+        std::uint64_t min_seq = 0;
+        std::uint64_t max_seq = 0;
+        std::uint32_t first = 0;
+        std::uint32_t count = 0;
+    };
+
+    struct Segment
+    {
+        std::wstring path;
+        std::uint64_t start = 0;
+        std::uint32_t count = 0;
+        std::uint64_t index_offset = 0;
+        std::uint64_t first_hlc = 0;
+        std::uint64_t last_hlc = 0;
+        std::uint64_t ids_offset = 0;
+        std::uint32_t id_count = 0;
+        std::uint32_t sender_count = 0;
+        // read on the first lookup by id that reaches the segment
+        std::vector<SenderRun> senders;
+        bool senders_loaded = false;
+
+        HANDLE file = INVALID_HANDLE_VALUE;
+        HANDLE mapping = nullptr;
+        const char *view = nullptr;
+        std::uint64_t last_used = 0;
+    };
+
+    // a segment's bytes wherever they are, the mapped file or the in-memory tail
+    struct Bytes
+    {
+        const char *base = nullptr;
+        const char *index = nullptr;
+        // where the records stop
+        std::uint64_t end = 0;
+        std::uint32_t count = 0;
+    };
+
+    bool load_header(Segment &seg, std::uint64_t file_size, const char *header);
+    bool map(Segment &seg);
+    bool load_senders(Segment &seg);
+    void unmap(Segment &seg);
+    bool bytes_of(std::size_t segment, Bytes &out);
+    bool seal();
+    std::wstring segment_path(std::uint32_t number) const;
+
+    std::wstring dir_;
+    std::vector<Segment> segments_;
+    std::uint64_t sealed_ = 0;
+    std::uint32_t next_number_ = 0;
+    std::uint64_t use_clock_ = 0;
+
+    // the segment being filled, laid out like a file minus the index so reads treat it the same
+    std::string pending_;
+    std::string pending_index_;
+    std::uint32_t pending_count_ = 0;
+    std::uint32_t seal_at_ = SEGMENT_RECORDS;
+    std::uint64_t pending_first_hlc_ = 0;
+    // in spill order, sorted into the id section when the segment is sealed
+    std::vector<IdEntry> pending_ids_;
+
+    // (hlc, sender, seq) of the newest message held, spills must come after it
+    std::uint64_t last_hlc_ = 0;
+    std::uint64_t last_sender_ = 0;
+    std::uint64_t last_seq_ = 0;
+
+    ColdStats stats_;
+};
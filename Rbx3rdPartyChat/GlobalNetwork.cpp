@@ -1,3 +1,5 @@
 #include "pch.h"
 #include "NetworkEngine.h"
-std::shared_ptr<NetworkEngine> global_net_engine = nullptr;
\ No newline at end of file
+std::shared_ptr<NetworkEngine> global_net_engine = nullptr;
+bool global_relay_mode = false;
+bool global_sync_marks_only = false;
\ No newline at end of file
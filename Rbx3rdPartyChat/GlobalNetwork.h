@@ -2,6 +2,7 @@
 #include "NetworkEngine.h"
 #include <memory>
 #include <string>
+#include <string_view>
 #include <windows.h>
 // idk  why this  isn't a hpp file,  but  ok
 inline std::string WStringToString(const std::wstring &wstr)
@@ -14,23 +15,34 @@ inline std::string WStringToString(const std::wstring &wstr)
     return strTo;
 }
 
-inline std::wstring StringToWString(const std::string &s)
+inline std::wstring StringToWString(std::string_view s)
 {
     if (s.empty())
         return std::wstring();
-    int size_needed = MultiByteToWideChar(CP_UTF8, 0, s.c_str(), (int)s.size(), NULL, 0);
+    int size_needed = MultiByteToWideChar(CP_UTF8, 0, s.data(), (int)s.size(), NULL, 0);
     std::wstring w(size_needed, 0);
-    MultiByteToWideChar(CP_UTF8, 0, s.c_str(), (int)s.size(), &w[0], size_needed);
+    MultiByteToWideChar(CP_UTF8, 0, s.data(), (int)s.size(), &w[0], size_needed);
     return w;
 }
 
 extern std::shared_ptr<NetworkEngine> global_net_engine;
+// the --relay switch, for when the typed ips only form a connected graph and lines have to hop
+extern bool global_relay_mode;
+// the --sync-marks switch: sync requests carry only the per sender marks, the bloom filter is
+// added just for senders with a hole. cheaper when peers only fall behind, not apart
+extern bool global_sync_marks_only;
 
+// returns while the cert is still being made, listening and dialing wait for it inside the
+// engine. whether it worked comes later through whenCertificateReady
 inline void InitNetwork()
 {
     if (!global_net_engine)
     {
-        global_net_engine = std::make_shared<NetworkEngine>();
+        // relay stays off unless asked for, setup dials every typed ip so the mesh is usually
+        // full and relaying would send each line n*(n-2) extra times just to be dropped as seen
+        NetworkOptions options;
+        options.relay = global_relay_mode;
+        global_net_engine = std::make_shared<NetworkEngine>(options);
         global_net_engine->start();
     }
 }
\ No newline at end of file
@@ -0,0 +1,113 @@
+#include "pch.h"
+#include "HistorySnapshot.h"
+#include "WireProtocol.h"
+
+void HistorySnapshot::refresh(const ChatHistory &history)
+{
+    if (!synced_ || history.evicted() < evicted_)
+        return rebuild(history);
+
+    // a full history only takes messages newer than its front, so evictions always come off
+    // the front of what we have even if something landed in the middle meanwhile
+    std::uint64_t gone = history.evicted() - evicted_;
+    if (gone > spans_.size())
+        return rebuild(history);
+    for (; gone; --gone)
+        drop_front();
+    evicted_ = history.evicted();
+
+    if (history.reorders() != reorders_)
+    {
+        // late messages land near the end, keep everything before the first one
+        std::size_t same = 0;
+        std::size_t n = std::min(spans_.size(), history.size());
+        while (same < n && spans_[same].key == MessageKey{ history[same].senderId, history[same].seq })
+            ++same;
+        truncate(same);
+        reorders_ = history.reorders();
+    }
+
+    for (std::size_t i = spans_.size(); i < history.size(); ++i)
+        append(history[i]);
+}
+
+void HistorySnapshot::rebuild(const ChatHistory &history)
+{
+    ++rebuilds_;
+    body_.clear();
+    dead_ = 0;
+    spans_.clear();
+    live_records_ = 0;
+    full_.reset();
+    for (const auto &m : history)
+        append(m);
+    evicted_ = history.evicted();
+    reorders_ = history.reorders();
+    synced_ = true;
+}
+
+void HistorySnapshot::append(const ChatMessage &m)
+{
+    std::size_t at = body_.size();
+    // messages without an id can't be deduped by the peer, they are never sent
+    if (m.senderId || m.seq)
+    {
+        wire::append_record(body_, m.seq, m.senderId, m.hlc, m.name, m.text);
+        ++live_records_;
+        ++records_encoded_;
+    }
+    spans_.push_back({ at, static_cast<std::uint32_t>(body_.size() - at), { m.senderId, m.seq } });
+    full_.reset();
+}
+
+void HistorySnapshot::truncate(std::size_t count)
+{
+    if (count >= spans_.size())
+        return;
+    body_.resize(spans_[count].offset);
+    for (std::size_t i = count; i < spans_.size(); ++i)
+    {
+        if (spans_[i].length)
+            --live_records_;
+    }
+    spans_.erase(spans_.begin() + count, spans_.end());
+    full_.reset();
+}
+
+void HistorySnapshot::drop_front()
+{
+    const Span &s = spans_.front();
+    dead_ = s.offset + s.length;
+    if (s.length)
+        --live_records_;
+    spans_.pop_front();
+    full_.reset();
+
+    // slide the live part down once most of the string is dead
+    if (dead_ > body_.size() / 2 && dead_ > 64 * 1024)
+    {
+        body_.erase(0, dead_);
+        for (auto &span : spans_)
+            span.offset -= dead_;
+        dead_ = 0;
+    }
+}
+
+std::string_view HistorySnapshot::record(std::size_t i) const
+{
+    if (i >= spans_.size())
+        return {};
+    return std::string_view(body_).substr(spans_[i].offset, spans_[i].length);
+}
+
+SharedPayload HistorySnapshot::full_frame()
+{
+    if (!full_)
+    {
+        std::string_view live = body();
+        wire::FrameWriter w(wire::FrameType::SyncResponse, live.size());
+        w.append_body(live, live_records_);
+        full_ = std::make_shared<const std::string>(w.finish());
+    }
+    return full_;
+}
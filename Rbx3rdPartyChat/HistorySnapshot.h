@@ -0,0 +1,56 @@
+#pragma once
+#include "ChatHistory.h"
+#include "NetworkEngine.h"
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <string_view>
+
+// the history encoded as wire records, kept in step with ChatHistory so a sync answer is
+// memcpy of records already in utf-8. appends encode just the new tail, evictions only move
+// the front, a late message re-encodes from where it landed. ui thread only
+class HistorySnapshot
+{
+public:
+    void refresh(const ChatHistory &history);
+
+    // record of history message i, empty for messages without an id
+    std::string_view record(std::size_t i) const;
+    // all live records back to back, in history order
+    std::string_view body() const { return std::string_view(body_).substr(dead_); }
+    std::uint32_t record_count() const { return live_records_; }
+
+    // a SyncResponse with every record. one immutable buffer handed to everyone who asks
+    // until the history changes, so a reconnect stampede encodes once
+    SharedPayload full_frame();
+
+    std::uint64_t records_encoded() const { return records_encoded_; }
+    std::uint64_t rebuilds() const { return rebuilds_; }
+
+private:
+    struct Span
+    {
+        std::size_t offset;
+        std::uint32_t length;
+        MessageKey key;
+    };
+
+    void rebuild(const ChatHistory &history);
+    void append(const ChatMessage &m);
+    void drop_front();
+    void truncate(std::size_t count);
+
+    std::string body_;
+    // bytes at the front of body_ that belong to evicted messages
+    std::size_t dead_ = 0;
+    std::deque<Span> spans_;
+    std::uint32_t live_records_ = 0;
+
+    std::uint64_t evicted_ = 0;
+    std::uint64_t reorders_ = 0;
+    bool synced_ = false;
+
+    SharedPayload full_;
+    std::uint64_t records_encoded_ = 0;
+    std::uint64_t rebuilds_ = 0;
+};
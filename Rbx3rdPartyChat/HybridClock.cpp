@@ -0,0 +1,65 @@
+#include "pch.h"
+#include "HybridClock.h"
+
+std::uint64_t HybridClock::physical_ms()
+{
+    return static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count());
+}
+
+void HybridClock::bump()
+{
+    // counter ran out within one ms, borrow the next ms instead of wrapping
+    if (++logical_ > LOGICAL_MASK)
+    {
+        ++wall_;
+        logical_ = 0;
+    }
+}
+
+std::uint64_t HybridClock::now()
+{
+    std::uint64_t pt = physical_ms();
+    if (pt > wall_)
+    {
+        wall_ = pt;
+        logical_ = 0;
+    }
+    else
+    {
+        bump();
+    }
+    return last();
+}
+
+bool HybridClock::observe(std::uint64_t remote)
+{
+    std::uint64_t pt = physical_ms();
+    std::uint64_t rw = wall_ms(remote);
+    std::uint64_t rl = logical(remote);
+    if (rw > pt + MAX_DRIFT_MS)
+        return false;
+
+    std::uint64_t w = std::max({ wall_, rw, pt });
+    if (w == wall_ && w == rw)
+    {
+        logical_ = std::max(logical_, rl);
+        bump();
+    }
+    else if (w == wall_)
+    {
+        bump();
+    }
+    else if (w == rw)
+    {
+        wall_ = rw;
+        logical_ = rl;
+        bump();
+    }
+    else
+    {
+        wall_ = pt;
+        logical_ = 0;
+    }
+    return true;
+}
@@ -0,0 +1,36 @@
+#pragma once
+#include <cstdint>
+
+// hybrid logical clock packed in a u64: wall ms in the top 48 bits, a counter in the low 16.
+// stamps only grow, and a stamp taken after seeing a peer's message sorts after it even if
+// our wall clock is behind. not thread safe, the ui owns it
+class HybridClock
+{
+public:
+    static constexpr int LOGICAL_BITS = 16;
+    static constexpr std::uint64_t LOGICAL_MASK = (std::uint64_t(1) << LOGICAL_BITS) - 1;
+    // stamps further ahead of our wall clock than this don't drag the clock forward
+    static constexpr std::uint64_t MAX_DRIFT_MS = 60 * 1000;
+
+    // stamp for a local event
+    std::uint64_t now();
+    // merge a stamp from a peer, false if it was too far ahead to trust
+    bool observe(std::uint64_t remote);
+    // observe, and the stamp to order the event by: the peer's, or a local one in place of a
+    // stamp too far ahead, which would otherwise sort after everything said for a long time
+    std::uint64_t receive(std::uint64_t remote) { return observe(remote) ? remote : now(); }
+
+    std::uint64_t last() const { return pack(wall_, logical_); }
+
+    static std::uint64_t pack(std::uint64_t wall_ms, std::uint64_t logical) { return (wall_ms << LOGICAL_BITS) | (logical & LOGICAL_MASK); }
+    static std::uint64_t wall_ms(std::uint64_t stamp) { return stamp >> LOGICAL_BITS; }
+    static std::uint64_t logical(std::uint64_t stamp) { return stamp & LOGICAL_MASK; }
+
+    static std::uint64_t physical_ms();
+
+private:
+    void bump();
+
+    std::uint64_t wall_ = 0;
+    std::uint64_t logical_ = 0;
+};
@@ -0,0 +1,89 @@
+#include "pch.h"
+#include "LatencyHistogram.h"
+
+int LatencyHistogram::bucket_index(std::uint64_t v)
+{
+    if (v < SUB_COUNT)
+        return static_cast<int>(v);
+
+    int k = 63;
+    while (!(v >> k))
+        --k;
+    if (k >= MAX_EXP)
+        return BUCKET_COUNT - 1;
+
+    int sub = static_cast<int>((v >> (k - SUB_BITS)) & (SUB_COUNT - 1));
+    return SUB_COUNT + (k - SUB_BITS) * SUB_COUNT + sub;
+}
+
+std::uint64_t LatencyHistogram::bucket_upper(int index)
+{
+    if (index < SUB_COUNT)
+        return static_cast<std::uint64_t>(index);
+
+    int r = index - SUB_COUNT;
+    int k = r / SUB_COUNT + SUB_BITS;
+    std::uint64_t sub = static_cast<std::uint64_t>(r % SUB_COUNT);
+    std::uint64_t lower = (std::uint64_t(1) << k) | (sub << (k - SUB_BITS));
+    return lower + (std::uint64_t(1) << (k - SUB_BITS)) - 1;
+}
+
+void LatencyHistogram::record(std::uint64_t us)
+{
+    counts_[bucket_index(us)].fetch_add(1, std::memory_order_relaxed);
+    total_.fetch_add(1, std::memory_order_relaxed);
+    last_.store(us, std::memory_order_relaxed);
+
+    std::uint64_t cur = max_.load(std::memory_order_relaxed);
+    while (cur < us && !max_.compare_exchange_weak(cur, us, std::memory_order_relaxed))
+    {
+    }
+}
+
+std::uint64_t LatencyHistogram::percentile(const std::array<std::uint32_t, BUCKET_COUNT> &counts, std::uint64_t total, double p) const
+{
+    std::uint64_t target = static_cast<std::uint64_t>(p * static_cast<double>(total) + 0.5);
+    if (target == 0)
+        target = 1;
+
+    std::uint64_t seen = 0;
+    for (int i = 0; i < BUCKET_COUNT; ++i)
+    {
+        seen += counts[i];
+        if (seen >= target)
+            return bucket_upper(i);
+    }
+    return bucket_upper(BUCKET_COUNT - 1);
+}
+
+LatencySnapshot LatencyHistogram::snapshot() const
+{
+    // copy first so both percentiles come from the same counts
+    std::array<std::uint32_t, BUCKET_COUNT> counts;
+    std::uint64_t total = 0;
+    for (int i = 0; i < BUCKET_COUNT; ++i)
+    {
+        counts[i] = counts_[i].load(std::memory_order_relaxed);
+        total += counts[i];
+    }
+
+    LatencySnapshot snap;
+    snap.samples = total;
+    snap.max_us = max_.load(std::memory_order_relaxed);
+    snap.last_us = last_.load(std::memory_order_relaxed);
+    if (total == 0)
+        return snap;
+
+    snap.p50_us = std::min(percentile(counts, total, 0.50), snap.max_us);
+    snap.p99_us = std::min(percentile(counts, total, 0.99), snap.max_us);
+    return snap;
+}
+
+void LatencyHistogram::reset()
+{
+    for (auto &c : counts_)
+        c.store(0, std::memory_order_relaxed);
+    total_.store(0, std::memory_order_relaxed);
+    max_.store(0, std::memory_order_relaxed);
+    last_.store(0, std::memory_order_relaxed);
+}
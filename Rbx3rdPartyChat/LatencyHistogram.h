@@ -0,0 +1,39 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+struct LatencySnapshot
+{
+    std::uint64_t samples = 0;
+    std::uint64_t p50_us = 0;
+    std::uint64_t p99_us = 0;
+    std::uint64_t max_us = 0;
+    std::uint64_t last_us = 0;
+};
+
+// log-linear buckets in the spirit of HdrHistogram: 16 sub-buckets per power of two,
+// so any value is off by at most ~6%. fixed size, lock free to record from any thread
+class LatencyHistogram
+{
+public:
+    static constexpr int SUB_BITS = 4;
+    static constexpr int SUB_COUNT = 1 << SUB_BITS;
+    static constexpr int MAX_EXP = 32;
+    static constexpr int BUCKET_COUNT = SUB_COUNT + (MAX_EXP - SUB_BITS) * SUB_COUNT;
+
+    void record(std::uint64_t us);
+    LatencySnapshot snapshot() const;
+    void reset();
+
+    static int bucket_index(std::uint64_t v);
+    static std::uint64_t bucket_upper(int index);
+
+private:
+    std::uint64_t percentile(const std::array<std::uint32_t, BUCKET_COUNT> &counts, std::uint64_t total, double p) const;
+
+    std::array<std::atomic<std::uint32_t>, BUCKET_COUNT> counts_{};
+    std::atomic<std::uint64_t> total_{0};
+    std::atomic<std::uint64_t> max_{0};
+    std::atomic<std::uint64_t> last_{0};
+};
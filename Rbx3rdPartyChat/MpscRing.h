@@ -0,0 +1,96 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+// bounded queue after Dmitry Vyukov's array queue. every slot carries a sequence number,
+// producers claim slots with one CAS on the tail and never wait on each other or on the consumer.
+// any number of producers, exactly one consumer
+template <typename T>
+class MpscRing
+{
+public:
+    explicit MpscRing(std::size_t capacity)
+    {
+        std::size_t n = 2;
+        while (n < capacity)
+            n <<= 1;
+        mask_ = n - 1;
+        slots_ = std::make_unique<Slot[]>(n);
+        for (std::size_t i = 0; i < n; ++i)
+            slots_[i].seq.store(i, std::memory_order_relaxed);
+    }
+
+    MpscRing(const MpscRing &) = delete;
+    MpscRing &operator=(const MpscRing &) = delete;
+
+    // false when full, value is left untouched then
+    bool try_push(T &value)
+    {
+        std::size_t pos = tail_.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            Slot &slot = slots_[pos & mask_];
+            std::size_t seq = slot.seq.load(std::memory_order_acquire);
+            std::intptr_t dif = static_cast<std::intptr_t>(seq) - static_cast<std::intptr_t>(pos);
+            if (dif == 0)
+            {
+                if (tail_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                {
+                    slot.value = std::move(value);
+                    slot.seq.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if (dif < 0)
+            {
+                return false;
+            }
+            else
+            {
+                pos = tail_.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // consumer thread only
+    bool try_pop(T &out)
+    {
+        std::size_t pos = head_.load(std::memory_order_relaxed);
+        Slot &slot = slots_[pos & mask_];
+        std::size_t seq = slot.seq.load(std::memory_order_acquire);
+        if (static_cast<std::intptr_t>(seq) - static_cast<std::intptr_t>(pos + 1) < 0)
+            return false;
+
+        out = std::move(slot.value);
+        // drop whatever the moved-from value still holds, views pin receive buffers
+        slot.value = T();
+        slot.seq.store(pos + mask_ + 1, std::memory_order_release);
+        head_.store(pos + 1, std::memory_order_relaxed);
+        return true;
+    }
+
+    std::size_t capacity() const { return mask_ + 1; }
+
+    // racy by nature, fine for stats
+    std::size_t size_approx() const
+    {
+        std::size_t tail = tail_.load(std::memory_order_relaxed);
+        std::size_t head = head_.load(std::memory_order_relaxed);
+        return tail >= head ? tail - head : 0;
+    }
+
+private:
+    struct Slot
+    {
+        std::atomic<std::size_t> seq{0};
+        T value{};
+    };
+
+    std::unique_ptr<Slot[]> slots_;
+    std::size_t mask_ = 0;
+    // producers and the consumer hammer different lines
+    alignas(64) std::atomic<std::size_t> tail_{0};
+    alignas(64) std::atomic<std::size_t> head_{0};
+};
@@ -1,6 +1,9 @@
 #include "pch.h"
 #include "NetworkEngine.h"
 #include "CertHelper.h"
+#include "MpscRing.h"
+#include "SessionRegistry.h"
+#include <condition_variable>
 
 namespace beast = boost::beast;
 namespace http = beast::http;
@@ -9,51 +12,341 @@ namespace net = boost::asio;
 namespace ssl = boost::asio::ssl;
 using tcp = boost::asio::ip::tcp;
 
+// permessage_deflate::msg_size_threshold keeps small chat lines uncompressed. older beast
+// compresses every message and has no per-write switch, so deflate_min_bytes would be ignored
+static_assert(BOOST_VERSION >= 108100, "deflate_min_bytes needs Boost 1.81 or newer");
+
+// first byte of a coalesced binary message, never valid as the start of utf-8 text
+static constexpr unsigned char BATCH_MAGIC = 0xFF;
+
+// one piece of a bulk payload: CHUNK_MAGIC, u8 flags, u32 le total payload size, bytes.
+// a session sends one bulk payload at a time so pieces need no id, other messages may sit between them
+static constexpr unsigned char CHUNK_MAGIC = 0xFC;
+static constexpr unsigned char CHUNK_LAST = 0x01;
+static constexpr std::size_t CHUNK_HEADER_SIZE = 1 + 1 + 4;
+
+// relayed chat: RELAY_MAGIC, u8 ttl, u64 le origin peer id, u64 le origin seq, payload
+static constexpr unsigned char RELAY_MAGIC = 0xFD;
+static constexpr std::size_t RELAY_HEADER_SIZE = 1 + 1 + 8 + 8;
+
+// both handshake directions carry the sender's peer id as hex
+static constexpr char PEER_ID_HEADER[] = "X-Rbx-Peer-Id";
+// close reason sent on the redundant half of a duplicate pair
+static constexpr char SUPERSEDED_REASON[] = "superseded";
+
+static std::string peer_id_to_hex(std::uint64_t id)
+{
+    char buf[16];
+    auto res = std::to_chars(buf, buf + sizeof(buf), id, 16);
+    return std::string(buf, res.ptr);
+}
+
+// client sessions per dialed host:port, so a redial can offer the previous session or ticket
+class TlsSessionCache
+{
+public:
+    struct Slot
+    {
+        TlsSessionCache *cache = nullptr;
+        std::string key;
+    };
+
+    ~TlsSessionCache()
+    {
+        for (auto &kv : sessions_)
+            SSL_SESSION_free(kv.second);
+    }
+
+    // caller owns the returned reference
+    SSL_SESSION *get(const std::string &key)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = sessions_.find(key);
+        if (it == sessions_.end())
+            return nullptr;
+        SSL_SESSION_up_ref(it->second);
+        return it->second;
+    }
+
+    // takes ownership of sess
+    void put(const std::string &key, SSL_SESSION *sess)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto &slot = sessions_[key];
+        if (slot)
+            SSL_SESSION_free(slot);
+        slot = sess;
+    }
+
+    static int slot_index()
+    {
+        static const int index = SSL_get_ex_new_index(0, nullptr, nullptr, nullptr, nullptr);
+        return index;
+    }
+
+    // SSL_CTX new session callback, openssl keeps the session if we return 0
+    static int on_new_session(SSL *ssl, SSL_SESSION *sess)
+    {
+        auto *slot = static_cast<Slot *>(SSL_get_ex_data(ssl, slot_index()));
+        if (!slot || !slot->cache || SSL_is_server(ssl))
+            return 0;
+        slot->cache->put(slot->key, sess);
+        return 1;
+    }
+
+private:
+    std::mutex mutex_;
+    std::unordered_map<std::string, SSL_SESSION *> sessions_;
+};
+
+// relay ids seen lately. a fifo of keys bounds memory, the set answers lookups
+class SeenCache
+{
+public:
+    explicit SeenCache(std::size_t capacity) : capacity_(std::max<std::size_t>(capacity, 1))
+    {
+        seen_.reserve(capacity_);
+    }
+
+    // true the first time an id is offered
+    bool insert(std::uint64_t origin, std::uint64_t seq)
+    {
+        std::uint64_t key = mix(origin, seq);
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!seen_.insert(key).second)
+            return false;
+        order_.push_back(key);
+        if (order_.size() > capacity_)
+        {
+            seen_.erase(order_.front());
+            order_.pop_front();
+        }
+        return true;
+    }
+
+private:
+    // a 64-bit collision would drop one message, at these volumes it does not happen
+    static std::uint64_t mix(std::uint64_t origin, std::uint64_t seq)
+    {
+        std::uint64_t x = origin ^ (seq + 0x9E3779B97F4A7C15ull + (origin << 6) + (origin >> 2));
+        x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+        x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+        return x ^ (x >> 31);
+    }
+
+    std::size_t capacity_;
+    std::mutex mutex_;
+    std::unordered_set<std::uint64_t> seen_;
+    std::deque<std::uint64_t> order_;
+};
+
+static void put_u64_le(unsigned char *p, std::uint64_t v)
+{
+    for (int i = 0; i < 8; ++i)
+        p[i] = static_cast<unsigned char>(v >> (8 * i));
+}
+
+static std::uint64_t get_u64_le(const unsigned char *p)
+{
+    std::uint64_t v = 0;
+    for (int i = 0; i < 8; ++i)
+        v |= std::uint64_t(p[i]) << (8 * i);
+    return v;
+}
+
+static std::uint64_t peer_id_from_hex(beast::string_view s)
+{
+    std::uint64_t id = 0;
+    auto res = std::from_chars(s.data(), s.data() + s.size(), id, 16);
+    if (res.ec != std::errc() || res.ptr != s.data() + s.size())
+        return 0;
+    return id;
+}
+
+struct EngineCounters
+{
+    std::atomic<std::uint64_t> broadcasts{0};
+    std::atomic<std::uint64_t> broadcast_bytes_copied{0};
+    std::atomic<std::uint64_t> last_broadcast_bytes_copied{0};
+
+    std::atomic<std::uint64_t> write_flushes{0};
+    std::atomic<std::uint64_t> write_frames{0};
+    std::atomic<std::uint64_t> max_frames_per_flush{0};
+
+    std::atomic<std::uint64_t> queued_bytes{0};
+    std::atomic<std::uint64_t> queue_high_watermark_bytes{0};
+    std::atomic<std::uint64_t> dropped_frames{0};
+    std::atomic<std::uint64_t> dropped_bytes{0};
+    std::atomic<std::uint64_t> slow_consumer_disconnects{0};
+    LatencyHistogram chat_queue_delay;
+    std::atomic<std::uint64_t> bulk_chunks{0};
+
+    std::atomic<std::uint64_t> dial_attempts{0};
+    std::atomic<std::uint64_t> duplicate_sessions{0};
+    std::atomic<std::uint64_t> superseded_sessions{0};
+
+    std::atomic<std::uint64_t> tls_full_handshakes{0};
+    std::atomic<std::uint64_t> tls_resumed_handshakes{0};
+    LatencyHistogram tls_full_handshake;
+    LatencyHistogram tls_resumed_handshake;
+
+    std::atomic<std::uint64_t> rx_messages{0};
+    std::atomic<std::uint64_t> rx_allocations{0};
+
+    std::atomic<std::uint64_t> inbound_wakeups{0};
+    std::atomic<std::uint64_t> inbound_dropped{0};
+
+    std::atomic<std::uint64_t> relay_originated{0};
+    std::atomic<std::uint64_t> relay_forwarded{0};
+    std::atomic<std::uint64_t> relay_duplicates{0};
+    std::atomic<std::uint64_t> relay_ttl_expired{0};
+};
+
+struct QueuedFrame
+{
+    SharedPayload data;
+    MessageClass cls;
+    std::chrono::steady_clock::time_point queued_at;
+    // the part of data this frame writes, a bulk chunk is a slice behind the session's chunk header
+    std::size_t offset = 0;
+    std::size_t length = 0;
+    bool chunk = false;
+
+    std::size_t wire_size() const { return (chunk ? CHUNK_HEADER_SIZE : 0) + length; }
+};
+
+static void atomic_max(std::atomic<std::uint64_t> &a, std::uint64_t v)
+{
+    std::uint64_t cur = a.load(std::memory_order_relaxed);
+    while (cur < v && !a.compare_exchange_weak(cur, v, std::memory_order_relaxed))
+    {
+    }
+}
+
 class WssSession : public std::enable_shared_from_this<WssSession>
 {
     websocket::stream<beast::ssl_stream<beast::tcp_stream>> ws_;
-    beast::flat_buffer buffer_;
+    // shared with the RxMessage views handed out, reused once none of them is left
+    std::shared_ptr<beast::flat_buffer> rx_buf_ = std::make_shared<beast::flat_buffer>();
+    std::size_t rx_capacity_ = 0;
     std::string remote_endpoint_str_;
+    std::uint64_t id_;
+    std::uint64_t local_peer_id_;
+    std::atomic<std::uint64_t> remote_peer_id_{0};
+    bool is_server_ = false;
+    bool superseded_ = false;
     INetworkObserver *observer_;
-    std::deque<std::string> write_queue_;
+    const NetworkOptions &opts_;
+    EngineCounters &counters_;
+    std::deque<QueuedFrame> write_queue_;
+    // bulk payloads waiting to be cut into chunks, the front one is bulk_offset_ bytes in
+    std::deque<QueuedFrame> bulk_queue_;
+    std::size_t bulk_offset_ = 0;
+    // at most one chunk sits in write_queue_, this is its header
+    std::array<unsigned char, CHUNK_HEADER_SIZE> chunk_header_{};
+    // bulk payload being put back together from incoming chunks
+    std::shared_ptr<std::string> bulk_rx_;
+    // total announced by its first chunk, every later chunk must repeat it
+    std::size_t bulk_rx_total_ = 0;
+    std::size_t queued_bytes_ = 0;
+    std::atomic<std::uint64_t> queue_depth_{0};
+    std::atomic<std::uint64_t> queued_bytes_seen_{0};
+    std::atomic<std::uint64_t> queue_high_watermark_{0};
     bool is_closed_ = false;
+    bool disconnect_notified_ = false;
+
+    // state of the write currently in flight
+    bool writing_ = false;
+    // frames queued during the handshake wait for it, beast has no write lock yet
+    bool open_ = false;
+    std::size_t frames_in_flight_ = 0;
+    std::vector<std::uint8_t> batch_header_;
+    std::vector<net::const_buffer> batch_buffers_;
+    net::steady_timer flush_timer_;
+    bool flush_armed_ = false;
+
+    TlsSessionCache::Slot tls_slot_;
+    std::chrono::steady_clock::time_point tls_started_;
+
+    http::request<http::string_body> upgrade_req_;
+    websocket::response_type upgrade_res_;
+    bool deflate_ = false;
+
+    // read from other threads by getPeerStats()
+    std::atomic<std::uint64_t> messages_out_{0};
+    std::atomic<std::uint64_t> payload_bytes_out_{0};
+    std::atomic<std::uint64_t> payload_bytes_in_{0};
+    std::atomic<std::uint64_t> wire_bytes_out_{0};
+    std::atomic<std::uint64_t> wire_bytes_in_{0};
+    std::atomic<std::uint64_t> write_cpu_us_{0};
+    std::atomic<bool> deflate_active_{false};
+    std::atomic<const char *> tls_version_{nullptr};
+    std::atomic<const char *> tls_cipher_{nullptr};
+    std::uint64_t wire_out_base_ = 0;
+    std::uint64_t wire_in_base_ = 0;
+
+    net::steady_timer ping_timer_;
+    std::uint64_t ping_seq_ = 0;
+    bool ping_outstanding_ = false;
+    bool ping_writing_ = false;
+    bool close_after_ping_ = false;
+    std::chrono::steady_clock::time_point ping_sent_;
+    LatencyHistogram rtt_;
 
 public:
-    explicit WssSession(tcp::socket &&socket, ssl::context &ctx, INetworkObserver *obs)
-        : ws_(std::move(socket), ctx), observer_(obs)
+    explicit WssSession(tcp::socket &&socket, ssl::context &ctx, INetworkObserver *obs,
+                        const NetworkOptions &opts, EngineCounters &counters, std::uint64_t local_peer_id)
+        : ws_(std::move(socket), ctx), id_(next_id()), local_peer_id_(local_peer_id), is_server_(true),
+          observer_(obs), opts_(opts), counters_(counters),
+          flush_timer_(ws_.get_executor()), ping_timer_(ws_.get_executor())
     {
+        beast::error_code ec;
+        auto ep = beast::get_lowest_layer(ws_).socket().remote_endpoint(ec);
+        remote_endpoint_str_ = ec ? "Unknown" : ep.address().to_string();
+
         ws_.set_option(websocket::stream_base::timeout::suggested(beast::role_type::server));
+        configure_deflate();
     }
 
-    explicit WssSession(net::io_context &ioc, ssl::context &ctx, INetworkObserver *obs)
-        : ws_(net::make_strand(ioc), ctx), observer_(obs)
+    explicit WssSession(net::io_context &ioc, ssl::context &ctx, INetworkObserver *obs,
+                        const NetworkOptions &opts, EngineCounters &counters, std::uint64_t local_peer_id)
+        : ws_(net::make_strand(ioc), ctx), id_(next_id()), local_peer_id_(local_peer_id),
+          observer_(obs), opts_(opts), counters_(counters),
+          flush_timer_(ws_.get_executor()), ping_timer_(ws_.get_executor())
     {
         ws_.set_option(websocket::stream_base::timeout::suggested(beast::role_type::client));
+        configure_deflate();
     }
 
     ~WssSession()
     {
+        counters_.queued_bytes -= queued_bytes_;
+        // links usually die without a close_notify, which would make openssl drop the session
+        // from both caches. pretend the shutdown happened so the next dial can still resume
+        SSL_set_shutdown(ws_.next_layer().native_handle(), SSL_SENT_SHUTDOWN | SSL_RECEIVED_SHUTDOWN);
     }
 
     void run_accept()
     {
-        try
-        {
-            remote_endpoint_str_ = ws_.next_layer().next_layer().socket().remote_endpoint().address().to_string();
-        }
-        catch (...)
-        {
-            remote_endpoint_str_ = "Unknown";
-        }
-
+        set_no_delay();
         beast::get_lowest_layer(ws_).expires_after(std::chrono::seconds(30));
+        tls_started_ = std::chrono::steady_clock::now();
         ws_.next_layer().async_handshake(ssl::stream_base::server,
                                          beast::bind_front_handler(&WssSession::on_ssl_handshake, shared_from_this(), true));
     }
 
+    // the host is known before dialing so the session can be registered under it
+    void set_remote_host(const std::string &host) { remote_endpoint_str_ = host; }
+
+    // offer the last session for this key and store whatever the server hands out next
+    void set_session_cache(TlsSessionCache *cache, std::string key)
+    {
+        tls_slot_.cache = cache;
+        tls_slot_.key = std::move(key);
+    }
+
     void run_client(const std::string &host, const std::string &port)
     {
-        remote_endpoint_str_ = host;
         auto resolver = std::make_shared<tcp::resolver>(ws_.get_executor());
         resolver->async_resolve(host, port,
                                 [self = shared_from_this(), resolver](beast::error_code ec, tcp::resolver::results_type results)
@@ -66,206 +359,999 @@ public:
                                 });
     }
 
-    void send(const std::string &msg)
+    void send(SharedPayload msg, MessageClass cls)
     {
-        net::post(ws_.get_executor(), beast::bind_front_handler(&WssSession::on_send, shared_from_this(), msg));
+        net::post(ws_.get_executor(), beast::bind_front_handler(&WssSession::on_send, shared_from_this(), std::move(msg), cls));
     }
 
     std::string getRemoteEndpoint() const { return remote_endpoint_str_; }
+    std::uint64_t id() const { return id_; }
+    std::uint64_t remote_peer_id() const { return remote_peer_id_.load(); }
+
+    // the peer id of whoever dialed this connection, both ends agree on it
+    std::uint64_t initiator_id() const { return is_server_ ? remote_peer_id_.load() : local_peer_id_; }
+
+    // the other session to this peer won the tie-break, finish pending writes and close
+    void supersede()
+    {
+        net::post(ws_.get_executor(), [self = shared_from_this()]
+                  {
+            if (self->superseded_ || self->is_closed_)
+                return;
+            self->superseded_ = true;
+            if (!self->writing_ && !self->has_pending())
+                self->do_close(); });
+    }
+
+    PeerStats stats() const
+    {
+        PeerStats st;
+        st.endpoint = remote_endpoint_str_;
+        st.peer_id = remote_peer_id_.load();
+        st.deflate = deflate_active_.load();
+        st.tls_version = tls_version_.load();
+        st.tls_cipher = tls_cipher_.load();
+        st.messages_out = messages_out_.load();
+        st.payload_bytes_out = payload_bytes_out_.load();
+        st.wire_bytes_out = wire_bytes_out_.load();
+        st.payload_bytes_in = payload_bytes_in_.load();
+        st.wire_bytes_in = wire_bytes_in_.load();
+        st.write_cpu_us = write_cpu_us_.load();
+        st.queue_depth = queue_depth_.load();
+        st.queued_bytes = queued_bytes_seen_.load();
+        st.queue_high_watermark_bytes = queue_high_watermark_.load();
+        st.rtt = rtt_.snapshot();
+        return st;
+    }
     void close()
     {
         is_closed_ = true;
     }
 
 private:
+    static std::uint64_t next_id()
+    {
+        static std::atomic<std::uint64_t> counter{0};
+        return ++counter;
+    }
+
+    void configure_deflate()
+    {
+        if (!opts_.enable_deflate)
+            return;
+        websocket::permessage_deflate pmd;
+        pmd.server_enable = true;
+        pmd.client_enable = true;
+        pmd.msg_size_threshold = opts_.deflate_min_bytes;
+        ws_.set_option(pmd);
+        // big enough that a typical sync payload deflates in one pass
+        ws_.write_buffer_bytes(64 * 1024);
+    }
+
+    static bool offers_deflate(beast::string_view extensions)
+    {
+        return extensions.find("permessage-deflate") != beast::string_view::npos;
+    }
+
+    // tls record bytes seen by the ssl engine since the websocket handshake
+    void sample_wire_bytes()
+    {
+        SSL *ssl = ws_.next_layer().native_handle();
+        wire_bytes_out_ = BIO_number_written(SSL_get_wbio(ssl)) - wire_out_base_;
+        wire_bytes_in_ = BIO_number_read(SSL_get_rbio(ssl)) - wire_in_base_;
+    }
+
     void on_connect(beast::error_code ec, tcp::resolver::results_type::endpoint_type ep)
     {
         if (ec)
             return fail(ec, "connect");
 
         beast::get_lowest_layer(ws_).expires_never();
+        set_no_delay();
 
         if (!SSL_set_tlsext_host_name(ws_.next_layer().native_handle(), remote_endpoint_str_.c_str()))
         {
             ec = beast::error_code(static_cast<int>(::ERR_get_error()), net::error::get_ssl_category());
             return fail(ec, "ssl_sni");
         }
+
+        SSL *ssl = ws_.next_layer().native_handle();
+        if (tls_slot_.cache)
+        {
+            SSL_set_ex_data(ssl, TlsSessionCache::slot_index(), &tls_slot_);
+            if (SSL_SESSION *prev = tls_slot_.cache->get(tls_slot_.key))
+            {
+                SSL_set_session(ssl, prev);
+                SSL_SESSION_free(prev);
+            }
+        }
+        tls_started_ = std::chrono::steady_clock::now();
         ws_.next_layer().async_handshake(ssl::stream_base::client,
                                          beast::bind_front_handler(&WssSession::on_ssl_handshake, shared_from_this(), false));
     }
 
+    // writes are already batched by coalescing and bulk chunking. with nagle on, a chat line
+    // written right after a chunk waits for that chunk's ack, and delayed ack holds it ~40 ms
+    void set_no_delay()
+    {
+        beast::error_code ec;
+        beast::get_lowest_layer(ws_).socket().set_option(tcp::no_delay(true), ec);
+    }
+
     void on_ssl_handshake(bool is_server, beast::error_code ec)
     {
         if (ec)
             return fail(ec, "ssl_handshake");
         beast::get_lowest_layer(ws_).expires_never();
 
-        ws_.set_option(websocket::stream_base::decorator([](websocket::request_type &req)
-                                                         { req.set(http::field::user_agent, std::string(BOOST_BEAST_VERSION_STRING) + " P2P-Chat"); }));
+        std::uint64_t tls_us = elapsed_us(tls_started_);
+        SSL *ssl = ws_.next_layer().native_handle();
+        tls_version_ = SSL_get_version(ssl);
+        tls_cipher_ = SSL_get_cipher_name(ssl);
+        if (SSL_session_reused(ssl))
+        {
+            counters_.tls_resumed_handshakes++;
+            counters_.tls_resumed_handshake.record(tls_us);
+        }
+        else
+        {
+            counters_.tls_full_handshakes++;
+            counters_.tls_full_handshake.record(tls_us);
+        }
 
+        std::string own_id = peer_id_to_hex(local_peer_id_);
         if (is_server)
         {
-            ws_.async_accept(beast::bind_front_handler(&WssSession::on_handshake_complete, shared_from_this(), true));
+            ws_.set_option(websocket::stream_base::decorator([own_id](websocket::response_type &res)
+                                                             { res.set(PEER_ID_HEADER, own_id); }));
         }
         else
         {
-            ws_.async_handshake(remote_endpoint_str_, "/",
+            ws_.set_option(websocket::stream_base::decorator([own_id](websocket::request_type &req)
+                                                             {
+                req.set(http::field::user_agent, std::string(BOOST_BEAST_VERSION_STRING) + " P2P-Chat");
+                req.set(PEER_ID_HEADER, own_id); }));
+        }
+
+        if (is_server)
+        {
+            // read the upgrade ourselves so we can see what the client offered
+            beast::get_lowest_layer(ws_).expires_after(std::chrono::seconds(30));
+            http::async_read(ws_.next_layer(), *rx_buf_, upgrade_req_,
+                             beast::bind_front_handler(&WssSession::on_upgrade_request, shared_from_this()));
+        }
+        else
+        {
+            ws_.async_handshake(upgrade_res_, remote_endpoint_str_, "/",
                                 beast::bind_front_handler(&WssSession::on_handshake_complete, shared_from_this(), false));
         }
     }
 
+    void on_upgrade_request(beast::error_code ec, std::size_t bytes_transferred)
+    {
+        if (ec)
+            return fail(ec, "http_read");
+        beast::get_lowest_layer(ws_).expires_never();
+        if (!websocket::is_upgrade(upgrade_req_))
+            return fail(websocket::error::no_connection_upgrade, "upgrade");
+
+        deflate_ = opts_.enable_deflate && offers_deflate(upgrade_req_[http::field::sec_websocket_extensions]);
+        remote_peer_id_ = peer_id_from_hex(upgrade_req_[PEER_ID_HEADER]);
+        ws_.async_accept(upgrade_req_,
+                         beast::bind_front_handler(&WssSession::on_handshake_complete, shared_from_this(), true));
+    }
+
     void on_handshake_complete(bool is_server, beast::error_code ec)
     {
         if (ec)
             return fail(ec, "ws_handshake");
-        if (observer_)
-            observer_->onConnectionEstablished(remote_endpoint_str_, is_server);
+        if (!is_server)
+        {
+            deflate_ = opts_.enable_deflate && offers_deflate(upgrade_res_[http::field::sec_websocket_extensions]);
+            remote_peer_id_ = peer_id_from_hex(upgrade_res_[PEER_ID_HEADER]);
+        }
+        deflate_active_ = deflate_;
+        upgrade_req_ = {};
+        upgrade_res_ = {};
+
+        SSL *ssl = ws_.next_layer().native_handle();
+        wire_out_base_ = BIO_number_written(SSL_get_wbio(ssl));
+        wire_in_base_ = BIO_number_read(SSL_get_rbio(ssl));
+        ws_.control_callback(beast::bind_front_handler(&WssSession::on_control, this));
+        schedule_ping();
         do_read();
+        open_ = true;
+        if (has_pending())
+            do_write();
+
+        // may supersede this very session, which only posts, so the read above is already queued
+        if (observer_)
+            observer_->onConnectionEstablished(remote_endpoint_str_, is_server, id_, remote_peer_id_);
+    }
+
+    void do_close()
+    {
+        is_closed_ = true;
+        stop_timers();
+        // only one control frame may be in flight, the ping handler closes once it lands
+        if (ping_writing_)
+        {
+            close_after_ping_ = true;
+            return;
+        }
+        ws_.async_close(websocket::close_reason(websocket::close_code::normal, SUPERSEDED_REASON),
+                        [self = shared_from_this()](beast::error_code) {});
+    }
+
+    void schedule_ping()
+    {
+        if (opts_.ping_interval.count() <= 0 || is_closed_)
+            return;
+        ping_timer_.expires_after(opts_.ping_interval);
+        ping_timer_.async_wait(beast::bind_front_handler(&WssSession::on_ping_timer, shared_from_this()));
+    }
+
+    void on_ping_timer(beast::error_code ec)
+    {
+        if (ec || is_closed_)
+            return;
+
+        // a lost pong just means this round has no sample
+        ++ping_seq_;
+        ping_outstanding_ = true;
+        ping_sent_ = std::chrono::steady_clock::now();
+        ping_writing_ = true;
+        ws_.async_ping(websocket::ping_data(std::to_string(ping_seq_)),
+                       [self = shared_from_this()](beast::error_code ec)
+                       {
+                           self->ping_writing_ = false;
+                           if (self->close_after_ping_)
+                           {
+                               self->close_after_ping_ = false;
+                               if (!ec)
+                                   self->do_close();
+                               return;
+                           }
+                           if (!ec)
+                               self->schedule_ping();
+                       });
+    }
+
+    // runs inside async_read on the session strand
+    void on_control(websocket::frame_type kind, beast::string_view payload)
+    {
+        if (kind != websocket::frame_type::pong || !ping_outstanding_)
+            return;
+        // beast's own keep-alive pings carry an empty payload
+        if (payload != std::to_string(ping_seq_))
+            return;
+
+        ping_outstanding_ = false;
+        auto rtt = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - ping_sent_);
+        rtt_.record(static_cast<std::uint64_t>(rtt.count()));
+        if (observer_ && !is_closed_)
+            observer_->onPingResult(remote_endpoint_str_, static_cast<long long>(rtt.count() / 1000));
+    }
+
+    void stop_timers()
+    {
+        flush_timer_.cancel();
+        ping_timer_.cancel();
     }
 
     void do_read()
     {
-        ws_.async_read(buffer_, beast::bind_front_handler(&WssSession::on_read, shared_from_this()));
+        ws_.async_read(*rx_buf_, beast::bind_front_handler(&WssSession::on_read, shared_from_this()));
     }
 
     void on_read(beast::error_code ec, std::size_t bytes_transferred)
     {
         if (ec == websocket::error::closed)
         {
-            if (observer_)
-                observer_->onDisconnect(remote_endpoint_str_);
+            stop_timers();
+            notify_disconnect();
             return;
         }
         if (ec)
             return fail(ec, "read");
 
-        std::string msg = beast::buffers_to_string(buffer_.data());
-        buffer_.consume(buffer_.size());
-        if (observer_ && !is_closed_)
-            observer_->onMessageReceived(msg);
+        payload_bytes_in_ += rx_buf_->size();
+        sample_wire_bytes();
+        if (rx_buf_->capacity() > rx_capacity_)
+        {
+            rx_capacity_ = rx_buf_->capacity();
+            counters_.rx_allocations++;
+        }
+
+        {
+            auto data = rx_buf_->data();
+            RxMessage msg(rx_buf_, std::string_view(static_cast<const char *>(data.data()), data.size()), id_);
+            if (ws_.got_binary() && !msg.empty() && static_cast<unsigned char>(msg.data()[0]) == BATCH_MAGIC)
+                deliver_batch(msg);
+            else
+                deliver_frame(msg);
+        }
+        recycle_rx_buffer();
         do_read();
     }
 
-    void on_send(std::string msg)
+    void recycle_rx_buffer()
+    {
+        if (rx_buf_.use_count() == 1)
+        {
+            rx_buf_->consume(rx_buf_->size());
+            return;
+        }
+        // somebody kept a view, leave the old buffer to them
+        rx_buf_ = std::make_shared<beast::flat_buffer>();
+        rx_capacity_ = 0;
+        counters_.rx_allocations++;
+    }
+
+    // batch layout: BATCH_MAGIC, then [u32 le length][payload] per frame, each frame is a slice of the batch
+    void deliver_batch(const RxMessage &batch)
+    {
+        const auto *p = reinterpret_cast<const unsigned char *>(batch.data());
+        std::size_t size = batch.size();
+        std::size_t pos = 1;
+        while (pos + 4 <= size)
+        {
+            std::uint32_t len = std::uint32_t(p[pos]) | (std::uint32_t(p[pos + 1]) << 8) |
+                                (std::uint32_t(p[pos + 2]) << 16) | (std::uint32_t(p[pos + 3]) << 24);
+            pos += 4;
+            if (len > size - pos)
+                break;
+            RxMessage msg = batch.slice(pos, len);
+            pos += len;
+            deliver_frame(msg);
+        }
+    }
+
+    void deliver_frame(const RxMessage &msg)
+    {
+        if (!msg.empty() && static_cast<unsigned char>(msg.data()[0]) == CHUNK_MAGIC)
+            return on_chunk(msg);
+        counters_.rx_messages++;
+        if (observer_ && !is_closed_)
+            observer_->onMessageReceived(msg, id_);
+    }
+
+    void on_chunk(const RxMessage &msg)
+    {
+        if (msg.size() < CHUNK_HEADER_SIZE)
+            return;
+        const auto *p = reinterpret_cast<const unsigned char *>(msg.data());
+        bool last = p[1] & CHUNK_LAST;
+        std::size_t total = std::size_t(p[2]) | (std::size_t(p[3]) << 8) | (std::size_t(p[4]) << 16) | (std::size_t(p[5]) << 24);
+        // the sender could not have queued more than this either
+        if (total > opts_.max_queue_bytes)
+        {
+            bulk_rx_.reset();
+            return;
+        }
+
+        if (!bulk_rx_)
+        {
+            bulk_rx_ = std::make_shared<std::string>();
+            bulk_rx_->reserve(total);
+            bulk_rx_total_ = total;
+        }
+        else if (total != bulk_rx_total_)
+        {
+            bulk_rx_.reset();
+            return;
+        }
+        bulk_rx_->append(msg.data() + CHUNK_HEADER_SIZE, msg.size() - CHUNK_HEADER_SIZE);
+        if (bulk_rx_->size() > total || (last && bulk_rx_->size() != total))
+        {
+            bulk_rx_.reset();
+            return;
+        }
+        if (!last)
+            return;
+
+        auto whole = std::move(bulk_rx_);
+        counters_.rx_messages++;
+        if (observer_ && !is_closed_)
+            observer_->onMessageReceived(RxMessage(whole, std::string_view(*whole), id_), id_);
+    }
+
+    void on_send(SharedPayload msg, MessageClass cls)
+    {
+        if (is_closed_)
+            return;
+
+        std::size_t size = msg->size();
+        queued_bytes_ += size;
+        counters_.queued_bytes += size;
+        QueuedFrame f{std::move(msg), cls, std::chrono::steady_clock::now(), 0, size};
+        bool bulk = cls == MessageClass::Bulk && opts_.bulk_chunk_bytes > 0;
+        if (bulk)
+            bulk_queue_.push_back(std::move(f));
+        else
+            write_queue_.push_back(std::move(f));
+        if (!enforce_queue_limits())
+            return;
+        publish_queue_depth();
+        if (writing_ || !open_)
+            return;
+
+        if (!bulk && opts_.coalesce_writes && opts_.coalesce_max_delay.count() > 0 &&
+            queued_bytes_ < opts_.coalesce_max_bytes)
+        {
+            if (!flush_armed_)
+            {
+                flush_armed_ = true;
+                flush_timer_.expires_after(opts_.coalesce_max_delay);
+                flush_timer_.async_wait(beast::bind_front_handler(&WssSession::on_flush_timer, shared_from_this()));
+            }
+            return;
+        }
+        do_write();
+    }
+
+    bool over_limits() const
+    {
+        return queued_bytes_ > opts_.max_queue_bytes || write_queue_.size() > opts_.max_queue_messages;
+    }
+
+    bool has_pending() const
+    {
+        return !write_queue_.empty() || !bulk_queue_.empty();
+    }
+
+    // cuts the next chunk once nothing else is waiting, so an interactive frame queued behind
+    // a bulk transfer waits for one chunk at most
+    void pump_bulk()
     {
-        write_queue_.push_back(msg);
-        if (write_queue_.size() == 1)
+        if (bulk_queue_.empty() || !write_queue_.empty())
+            return;
+
+        QueuedFrame &big = bulk_queue_.front();
+        std::size_t total = big.length;
+        if (bulk_offset_ == 0 && total <= opts_.bulk_chunk_bytes)
+        {
+            write_queue_.push_back(std::move(big));
+            bulk_queue_.pop_front();
+            return;
+        }
+
+        QueuedFrame f{big.data, MessageClass::Bulk, big.queued_at, bulk_offset_,
+                      std::min(opts_.bulk_chunk_bytes, total - bulk_offset_), true};
+        bulk_offset_ += f.length;
+        bool last = bulk_offset_ == total;
+        chunk_header_[0] = CHUNK_MAGIC;
+        chunk_header_[1] = last ? CHUNK_LAST : 0;
+        for (int i = 0; i < 4; ++i)
+            chunk_header_[2 + i] = static_cast<unsigned char>(total >> (8 * i));
+        write_queue_.push_back(std::move(f));
+        counters_.bulk_chunks++;
+        if (last)
+        {
+            bulk_queue_.pop_front();
+            bulk_offset_ = 0;
+        }
+    }
+
+    void add_buffers(const QueuedFrame &f)
+    {
+        if (f.chunk)
+            batch_buffers_.push_back(net::buffer(chunk_header_.data(), CHUNK_HEADER_SIZE));
+        batch_buffers_.push_back(net::buffer(f.data->data() + f.offset, f.length));
+    }
+
+    // false if the session was closed because of the overflow
+    bool enforce_queue_limits()
+    {
+        if (!over_limits())
+            return true;
+
+        if (opts_.queue_policy == QueueOverflowPolicy::DropOldestChat)
+        {
+            // frames already handed to async_write have to stay put
+            std::size_t i = writing_ ? frames_in_flight_ : 0;
+            while (over_limits() && i < write_queue_.size())
+            {
+                if (write_queue_[i].cls != MessageClass::Chat)
+                {
+                    ++i;
+                    continue;
+                }
+                std::size_t n = write_queue_[i].length;
+                queued_bytes_ -= n;
+                counters_.queued_bytes -= n;
+                counters_.dropped_frames++;
+                counters_.dropped_bytes += n;
+                write_queue_.erase(write_queue_.begin() + i);
+            }
+            if (!over_limits())
+                return true;
+        }
+
+        // what is left can't be dropped, a peer that doesn't read would grow it without end
+        counters_.slow_consumer_disconnects++;
+        is_closed_ = true;
+        stop_timers();
+        beast::error_code ec;
+        beast::get_lowest_layer(ws_).socket().close(ec);
+        notify_disconnect();
+        return false;
+    }
+
+    void publish_queue_depth()
+    {
+        queue_depth_ = write_queue_.size() + bulk_queue_.size();
+        queued_bytes_seen_ = queued_bytes_;
+        atomic_max(queue_high_watermark_, queued_bytes_);
+        atomic_max(counters_.queue_high_watermark_bytes, queued_bytes_);
+    }
+
+    void on_flush_timer(beast::error_code ec)
+    {
+        flush_armed_ = false;
+        if (open_ && !writing_ && has_pending() && !is_closed_)
             do_write();
     }
 
     void do_write()
     {
-        ws_.async_write(net::buffer(write_queue_.front()),
+        pump_bulk();
+        if (write_queue_.empty())
+            return;
+        writing_ = true;
+
+        std::size_t n = 1;
+        if (opts_.coalesce_writes)
+        {
+            std::size_t bytes = 1 + 4 + write_queue_.front().wire_size();
+            while (n < write_queue_.size() && bytes + 4 + write_queue_[n].wire_size() <= opts_.coalesce_max_bytes)
+            {
+                bytes += 4 + write_queue_[n].wire_size();
+                ++n;
+            }
+        }
+
+        frames_in_flight_ = n;
+        counters_.write_flushes++;
+        counters_.write_frames += n;
+        atomic_max(counters_.max_frames_per_flush, n);
+
+        messages_out_ += n;
+        auto t0 = std::chrono::steady_clock::now();
+
+        if (n == 1)
+        {
+            batch_buffers_.clear();
+            add_buffers(write_queue_.front());
+            payload_bytes_out_ += write_queue_.front().wire_size();
+            ws_.binary(true);
+            ws_.async_write(batch_buffers_,
+                            beast::bind_front_handler(&WssSession::on_write, shared_from_this()));
+            write_cpu_us_ += elapsed_us(t0);
+            return;
+        }
+
+        // gathered write: the payloads stay in their shared buffers, only the headers are built here
+        batch_header_.assign(1 + 4 * n, 0);
+        batch_header_[0] = BATCH_MAGIC;
+        batch_buffers_.clear();
+        batch_buffers_.push_back(net::buffer(batch_header_.data(), 1));
+        for (std::size_t i = 0; i < n; ++i)
+        {
+            std::uint8_t *h = batch_header_.data() + 1 + 4 * i;
+            std::uint32_t len = static_cast<std::uint32_t>(write_queue_[i].wire_size());
+            h[0] = std::uint8_t(len);
+            h[1] = std::uint8_t(len >> 8);
+            h[2] = std::uint8_t(len >> 16);
+            h[3] = std::uint8_t(len >> 24);
+            batch_buffers_.push_back(net::buffer(h, 4));
+            add_buffers(write_queue_[i]);
+        }
+        payload_bytes_out_ += net::buffer_size(batch_buffers_);
+        ws_.binary(true);
+        ws_.async_write(batch_buffers_,
                         beast::bind_front_handler(&WssSession::on_write, shared_from_this()));
+        write_cpu_us_ += elapsed_us(t0);
+    }
+
+    static std::uint64_t elapsed_us(std::chrono::steady_clock::time_point t0)
+    {
+        return static_cast<std::uint64_t>(
+            std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - t0).count());
     }
 
     void on_write(beast::error_code ec, std::size_t bytes_transferred)
     {
+        writing_ = false;
         if (ec)
             return fail(ec, "write");
-        write_queue_.pop_front();
-        if (!write_queue_.empty())
+        sample_wire_bytes();
+        auto now = std::chrono::steady_clock::now();
+        for (std::size_t i = 0; i < frames_in_flight_; ++i)
+        {
+            const QueuedFrame &f = write_queue_.front();
+            if (f.cls == MessageClass::Chat)
+                counters_.chat_queue_delay.record(static_cast<std::uint64_t>(
+                    std::chrono::duration_cast<std::chrono::microseconds>(now - f.queued_at).count()));
+            queued_bytes_ -= f.length;
+            counters_.queued_bytes -= f.length;
+            write_queue_.pop_front();
+        }
+        frames_in_flight_ = 0;
+        publish_queue_depth();
+        if (has_pending())
             do_write();
+        else if (superseded_ && !is_closed_)
+            do_close();
+    }
+
+    // a read and a write can both fail on the same dead socket, the connector only hears it once
+    void notify_disconnect()
+    {
+        if (disconnect_notified_)
+            return;
+        disconnect_notified_ = true;
+        if (observer_)
+            observer_->onDisconnect(remote_endpoint_str_, id_);
     }
 
     void fail(beast::error_code ec, char const *what)
     {
-        if (observer_ && !is_closed_)
-            observer_->onDisconnect(remote_endpoint_str_);
+        stop_timers();
+        notify_disconnect();
     }
 };
 
+// owns redialing one configured peer, everything runs on its own io_context thread
 class PeerConnector : public std::enable_shared_from_this<PeerConnector>
 {
     net::io_context &ioc_;
-    ssl::context &ctx_;
     NetworkEngine *engine_;
+    const NetworkOptions &opts_;
     std::string ip_;
     int port_;
-    std::shared_ptr<net::steady_timer> timer_;
-    bool active_ = true;
+    net::steady_timer timer_;
+    std::atomic<bool> active_{true};
+    bool retry_pending_ = false;
+    unsigned failures_ = 0;
+    // from the handshake of our own dial. the address may be a hostname or one of several the
+    // peer has, the id is what the registry knows the surviving session by
+    std::atomic<std::uint64_t> peer_id_{0};
+    std::mt19937 rng_;
 
 public:
-    PeerConnector(net::io_context &ioc, ssl::context &ctx, NetworkEngine *eng, std::string ip, int port)
-        : ioc_(ioc), ctx_(ctx), engine_(eng), ip_(ip), port_(port)
+    PeerConnector(net::io_context &ioc, NetworkEngine *eng, const NetworkOptions &opts, std::string ip, int port)
+        : ioc_(ioc), engine_(eng), opts_(opts), ip_(std::move(ip)), port_(port), timer_(ioc), rng_(std::random_device{}())
     {
-        timer_ = std::make_shared<net::steady_timer>(ioc);
     }
 
+    const std::string &ip() const { return ip_; }
+    std::uint64_t peer_id() const { return peer_id_.load(); }
+
     void start()
     {
-        attempt_connect();
+        net::post(ioc_, [self = shared_from_this()]
+                  { self->attempt_connect(); });
     }
 
     void stop()
     {
         active_ = false;
-        timer_->cancel();
+        net::post(ioc_, [self = shared_from_this()]
+                  { self->timer_.cancel(); });
+    }
+
+    // our own dial got through, whether or not its session wins the tie-break
+    void learn_peer_id(std::uint64_t peer_id) { peer_id_ = peer_id; }
+
+    // some session to the peer is up, whichever side dialed it, so backoff starts over
+    void on_session_established()
+    {
+        net::post(ioc_, [self = shared_from_this()]
+                  { self->failures_ = 0; });
     }
 
     void on_session_disconnected()
     {
-        if (!active_)
+        net::post(ioc_, [self = shared_from_this()]
+                  {
+            // the session that went may be a tie-break loser, the peer is still there
+            if (self->engine_->hasSessionTo(self->ip_, self->peer_id_))
+                return;
+            self->schedule_retry(); });
+    }
+
+private:
+    void schedule_retry()
+    {
+        if (!active_ || retry_pending_)
             return;
 
-        timer_->expires_after(std::chrono::seconds(3));
-        timer_->async_wait([self = shared_from_this()](beast::error_code ec)
-                           {
+        retry_pending_ = true;
+        timer_.expires_after(next_delay());
+        timer_.async_wait([self = shared_from_this()](beast::error_code ec)
+                          {
+            self->retry_pending_ = false;
             if (!ec) self->attempt_connect(); });
     }
 
-private:
+    // exponential backoff with equal jitter: half the step is fixed, the other half random
+    std::chrono::milliseconds next_delay()
+    {
+        auto cap = std::max(opts_.reconnect_max_delay, opts_.reconnect_min_delay);
+        auto step = opts_.reconnect_min_delay;
+        for (unsigned i = 0; i < failures_ && step < cap; ++i)
+            step *= 2;
+        step = std::min(step, cap);
+        ++failures_;
+
+        std::uniform_int_distribution<long long> jitter(0, step.count() / 2);
+        return std::chrono::milliseconds(step.count() - step.count() / 2 + jitter(rng_));
+    }
+
     void attempt_connect()
     {
         if (!active_)
             return;
 
+        // a live or still handshaking session to the address, or once we know who answers there,
+        // a session to that peer (ours or its incoming one) is enough
+        if (engine_->hasSessionTo(ip_, peer_id_))
+            return;
+
         engine_->connectToPeer(ip_, port_);
     }
 };
 
+// what the inbound ring holds. frames that fit are copied into the slot so the session can
+// read the next one into the same buffer, only bigger ones keep a view and pin their buffer
+struct InboundItem
+{
+    // with the ring's sequence number a slot is 256 bytes on x64, enough for a chat line with a long nick
+    static constexpr std::size_t INLINE_BYTES = 192;
+
+    RxMessage view;
+    std::uint64_t session_id = 0;
+    std::uint32_t size = 0;
+    bool is_inline = false;
+    char bytes[INLINE_BYTES];
+};
+
 struct NetworkEngine::Impl
 {
-    net::io_context ioc_;
+    NetworkOptions options_;
+    EngineCounters counters_;
+
+    // one io_context per thread, sessions and connectors are spread round-robin
+    std::vector<std::unique_ptr<net::io_context>> iocs_;
+    std::vector<net::executor_work_guard<net::io_context::executor_type>> work_guards_;
+    std::vector<std::thread> io_threads_;
+    std::atomic<std::size_t> next_ioc_{0};
+
     ssl::context ctx_;
+    TlsSessionCache tls_sessions_;
     std::shared_ptr<tcp::acceptor> acceptor_;
-    net::executor_work_guard<net::io_context::executor_type> work_guard_;
-    std::thread io_thread_;
 
-    std::vector<std::shared_ptr<WssSession>> sessions_;
-    std::mutex session_mutex_;
+    SessionRegistry<WssSession> sessions_;
 
     std::vector<std::shared_ptr<PeerConnector>> connectors_;
     std::mutex connector_mutex_;
 
     std::mutex cb_mutex_;
-    std::function<void(std::string)> ui_msg_callback_;
+    std::function<void(const RxMessage &)> ui_msg_callback_;
     std::function<void(std::string, long long)> ui_ping_callback_;
+    std::function<void(std::uint64_t, std::uint64_t)> ui_session_callback_;
+
+    // io threads push, the consumer drains; pending is set by whoever sends the wake and
+    // cleared by the consumer before it drains. both sides fence between their store and
+    // their load (see wake_consumer), that is what keeps a push from going unnoticed
+    MpscRing<InboundItem> inbound_;
+    std::atomic<bool> inbound_wake_pending_{false};
+    std::atomic<std::shared_ptr<const std::function<void()>>> inbound_wake_;
+
+    SeenCache relay_seen_;
+    std::atomic<std::uint64_t> relay_seq_{0};
 
     INetworkObserver *owner_;
+    std::uint64_t local_peer_id_ = 0;
 
-    Impl(INetworkObserver *owner)
-        : ctx_(ssl::context::tlsv12),
-          work_guard_(net::make_work_guard(ioc_)),
+    // the cert is made off the caller's thread, sessions must not be created from ctx_ before it lands
+    std::thread cert_thread_;
+    std::mutex cert_mutex_;
+    std::condition_variable cert_settled_;
+    bool cert_ready_ = false;
+    std::vector<std::function<void(bool)>> cert_waiters_;
+
+    std::chrono::steady_clock::time_point created_at_ = std::chrono::steady_clock::now();
+    std::atomic<CertKeyType> cert_key_type_;
+    std::atomic<bool> cert_failed_{false};
+    std::atomic<std::uint64_t> cert_generate_us_{0};
+    std::atomic<std::uint64_t> cert_ready_us_{0};
+    std::atomic<std::uint64_t> listening_us_{0};
+    std::atomic<std::uint64_t> first_accept_us_{0};
+    std::atomic<std::uint64_t> first_dial_us_{0};
+    std::atomic<std::uint64_t> first_session_us_{0};
+
+    Impl(INetworkObserver *owner, const NetworkOptions &options)
+        : options_(options),
+          ctx_(ssl::context::tls),
+          inbound_(options.inbound_capacity),
+          relay_seen_(options.relay_seen_capacity),
           owner_(owner)
     {
-        CertHelper::load_self_signed_cert(ctx_);
+        std::size_t n = options_.io_threads;
+        if (n == 0)
+            n = std::clamp<std::size_t>(std::thread::hardware_concurrency(), 1, 4);
+
+        for (std::size_t i = 0; i < n; ++i)
+        {
+            iocs_.push_back(std::make_unique<net::io_context>(1));
+            work_guards_.push_back(net::make_work_guard(*iocs_.back()));
+        }
+
+        std::random_device rd;
+        std::mt19937_64 rng((std::uint64_t(rd()) << 32) ^ rd());
+        while (local_peer_id_ == 0)
+            local_peer_id_ = rng();
+
         ctx_.set_verify_mode(ssl::verify_none);
+        TlsHelper::apply(ctx_, options_.tls_profile, options_.tls_max_send_fragment);
+        enable_session_resumption();
+
+        cert_key_type_ = options_.cert_key_type;
+        cert_thread_ = std::thread([this]
+                                   { make_cert(); });
+    }
+
+    void make_cert()
+    {
+        auto t0 = std::chrono::steady_clock::now();
+        SelfSignedCert cert;
+        try
+        {
+            cert = CertHelper::generate(cert_key_type_);
+        }
+        catch (const std::exception &)
+        {
+            // openssl builds without the curve still have rsa
+            try
+            {
+                cert_key_type_ = CertKeyType::Rsa2048;
+                cert = CertHelper::generate(CertKeyType::Rsa2048);
+            }
+            catch (const std::exception &)
+            {
+                // no cert, no tls: whoever waits is told so instead of waiting forever
+                std::vector<std::function<void(bool)>> waiters;
+                {
+                    std::lock_guard<std::mutex> lock(cert_mutex_);
+                    cert_failed_ = true;
+                    waiters.swap(cert_waiters_);
+                }
+                cert_settled_.notify_all();
+                for (auto &fn : waiters)
+                    fn(false);
+                return;
+            }
+        }
+        cert_generate_us_ = static_cast<std::uint64_t>(
+            std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - t0).count());
+
+        std::vector<std::function<void(bool)>> waiters;
+        {
+            std::lock_guard<std::mutex> lock(cert_mutex_);
+            CertHelper::use(ctx_, cert);
+            cert_ready_ = true;
+            waiters.swap(cert_waiters_);
+        }
+        cert_settled_.notify_all();
+        mark(cert_ready_us_);
+        for (auto &fn : waiters)
+            fn(true);
+    }
+
+    // runs fn now if the cert attempt is over, otherwise on the cert thread once it is.
+    // ok is false if there is no cert and there never will be
+    void when_cert_ready(std::function<void(bool ok)> fn)
+    {
+        bool ok;
+        {
+            std::lock_guard<std::mutex> lock(cert_mutex_);
+            if (!cert_ready_ && !cert_failed_)
+            {
+                cert_waiters_.push_back(std::move(fn));
+                return;
+            }
+            ok = cert_ready_;
+        }
+        fn(ok);
+    }
+
+    bool wait_cert()
+    {
+        std::unique_lock<std::mutex> lock(cert_mutex_);
+        cert_settled_.wait(lock, [this]
+                           { return cert_ready_ || cert_failed_; });
+        return cert_ready_;
+    }
+
+    // first time only
+    void mark(std::atomic<std::uint64_t> &phase)
+    {
+        auto us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - created_at_).count();
+        std::uint64_t expected = 0;
+        phase.compare_exchange_strong(expected, std::max<std::uint64_t>(1, static_cast<std::uint64_t>(us)));
+    }
+
+    // one context serves both roles: the server keeps a session id cache and issues tickets,
+    // the client side hands new sessions to tls_sessions_ through the callback
+    void enable_session_resumption()
+    {
+        SSL_CTX *native = ctx_.native_handle();
+        static const unsigned char sid_ctx[] = "rbxchat";
+        SSL_CTX_set_session_id_context(native, sid_ctx, sizeof(sid_ctx) - 1);
+        SSL_CTX_set_session_cache_mode(native, SSL_SESS_CACHE_BOTH);
+        SSL_CTX_set_timeout(native, static_cast<long>(options_.tls_session_lifetime.count()));
+        SSL_CTX_clear_options(native, SSL_OP_NO_TICKET);
+        SSL_CTX_sess_set_new_cb(native, &TlsSessionCache::on_new_session);
+    }
+
+    void add_session(const std::shared_ptr<WssSession> &session)
+    {
+        if (!sessions_.insert(session))
+            counters_.duplicate_sessions++;
+    }
+
+    // connectors are matched by address, or by peer id once their dial learned it, so sessions
+    // the peer dialed from elsewhere count too
+    std::vector<std::shared_ptr<PeerConnector>> connectors_for(const std::string &peer_key, std::uint64_t peer_id = 0)
+    {
+        std::vector<std::shared_ptr<PeerConnector>> out;
+        std::lock_guard<std::mutex> lock(connector_mutex_);
+        for (auto &c : connectors_)
+        {
+            if (c->ip() == peer_key || (peer_id != 0 && c->peer_id() == peer_id))
+                out.push_back(c);
+        }
+        return out;
+    }
+
+    void wake_consumer()
+    {
+        // pairs with the fence in drainInbound. without it the push can still sit in the store
+        // buffer while we read a stale true, and the consumer clears the flag, finds the ring
+        // empty and sleeps on a message nobody will wake it for
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        // plain load first, under a burst the flag is already set and the line stays shared
+        if (inbound_wake_pending_.load(std::memory_order_acquire) ||
+            inbound_wake_pending_.exchange(true, std::memory_order_acq_rel))
+            return;
+        if (auto wake = inbound_wake_.load(std::memory_order_acquire))
+        {
+            counters_.inbound_wakeups++;
+            (*wake)();
+        }
+    }
+
+    // the acceptor always lives on the first context
+    net::io_context &acceptor_ioc() { return *iocs_.front(); }
+
+    net::io_context &next_ioc()
+    {
+        return *iocs_[next_ioc_.fetch_add(1, std::memory_order_relaxed) % iocs_.size()];
     }
 
     void do_accept()
     {
         //super good refaxtor :)
-        acceptor_->async_accept(net::make_strand(ioc_),
+        acceptor_->async_accept(net::make_strand(next_ioc()),
                                 [this](beast::error_code ec, tcp::socket socket)
                                 {
                                     if (!ec)
                                     {
-                                        auto session = std::make_shared<WssSession>(std::move(socket), ctx_, owner_);
-                                        {
-                                            std::lock_guard<std::mutex> lock(session_mutex_);
-                                            sessions_.push_back(session);
-                                        }
+                                        mark(first_accept_us_);
+                                        auto session = std::make_shared<WssSession>(std::move(socket), ctx_, owner_, options_, counters_, local_peer_id_);
+                                        add_session(session);
                                         session->run_accept();
                                     }
                                     do_accept();
@@ -273,20 +1359,27 @@ struct NetworkEngine::Impl
     }
 };
 
-NetworkEngine::NetworkEngine() : m_impl(std::make_unique<Impl>(this)) {}
+NetworkEngine::NetworkEngine(const NetworkOptions &options) : m_impl(std::make_unique<Impl>(this, options)) {}
 NetworkEngine::~NetworkEngine() { stop(); }
 
 void NetworkEngine::start()
 {
-    if (!m_impl->io_thread_.joinable())
+    if (m_impl->io_threads_.empty())
     {
-        m_impl->io_thread_ = std::thread([this]
-                                         { m_impl->ioc_.run(); });
+        for (auto &ioc : m_impl->iocs_)
+        {
+            net::io_context *ctx = ioc.get();
+            m_impl->io_threads_.emplace_back([ctx]
+                                             { ctx->run(); });
+        }
     }
 }
 
 void NetworkEngine::stop()
 {
+    // its waiters post into the contexts, let it finish before they go away
+    if (m_impl->cert_thread_.joinable())
+        m_impl->cert_thread_.join();
 
     {
         std::lock_guard<std::mutex> lock(m_impl->connector_mutex_);
@@ -295,39 +1388,100 @@ void NetworkEngine::stop()
         m_impl->connectors_.clear();
     }
 
-    m_impl->ioc_.stop();
-    if (m_impl->io_thread_.joinable())
-        m_impl->io_thread_.join();
+    for (auto &ioc : m_impl->iocs_)
+        ioc->stop();
+    for (auto &t : m_impl->io_threads_)
+    {
+        if (t.joinable())
+            t.join();
+    }
+    m_impl->io_threads_.clear();
 
-    std::lock_guard<std::mutex> lock(m_impl->session_mutex_);
     m_impl->sessions_.clear();
 }
 
+std::size_t NetworkEngine::ioThreadCount() const
+{
+    return m_impl->iocs_.size();
+}
+
+std::uint64_t NetworkEngine::localPeerId() const
+{
+    return m_impl->local_peer_id_;
+}
+
+bool NetworkEngine::waitForCertificate()
+{
+    return m_impl->wait_cert();
+}
+
+void NetworkEngine::whenCertificateReady(std::function<void(bool ok)> fn)
+{
+    m_impl->when_cert_ready(std::move(fn));
+}
+
 void NetworkEngine::clearCallbacks()
 {
     std::lock_guard<std::mutex> lock(m_impl->cb_mutex_);
     m_impl->ui_msg_callback_ = nullptr;
     m_impl->ui_ping_callback_ = nullptr;
+    m_impl->ui_session_callback_ = nullptr;
+    m_impl->inbound_wake_.store(nullptr);
 }
 
-void NetworkEngine::setUiCallback(std::function<void(std::string)> cb)
+void NetworkEngine::setUiCallback(std::function<void(const RxMessage &)> cb)
 {
     std::lock_guard<std::mutex> lock(m_impl->cb_mutex_);
     m_impl->ui_msg_callback_ = cb;
 }
+void NetworkEngine::setInboundWake(std::function<void()> wake)
+{
+    m_impl->inbound_wake_.store(wake ? std::make_shared<const std::function<void()>>(std::move(wake)) : nullptr);
+    m_impl->inbound_wake_pending_.store(false);
+}
+
+std::size_t NetworkEngine::drainInbound(const std::function<void(const RxMessage &)> &fn, std::size_t max)
+{
+    m_impl->inbound_wake_pending_.store(false, std::memory_order_seq_cst);
+    // the clear has to be visible before the first pop reads a slot, see wake_consumer
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+
+    std::size_t n = 0;
+    InboundItem item;
+    while (n < max && m_impl->inbound_.try_pop(item))
+    {
+        if (item.is_inline)
+            fn(RxMessage(nullptr, std::string_view(item.bytes, item.size), item.session_id));
+        else
+            fn(item.view);
+        item.view = RxMessage();
+        ++n;
+    }
+    // stopped on max with work left, ask for another turn instead of hogging the consumer
+    if (n == max && m_impl->inbound_.size_approx() > 0)
+        m_impl->wake_consumer();
+    return n;
+}
+
 void NetworkEngine::setPingCallback(std::function<void(std::string, long long)> cb)
 {
     std::lock_guard<std::mutex> lock(m_impl->cb_mutex_);
     m_impl->ui_ping_callback_ = cb;
 }
 
+void NetworkEngine::setSessionCallback(std::function<void(std::uint64_t, std::uint64_t)> cb)
+{
+    std::lock_guard<std::mutex> lock(m_impl->cb_mutex_);
+    m_impl->ui_session_callback_ = cb;
+}
+
 void NetworkEngine::startListening(int port)
 {
     auto endpoint = tcp::endpoint(tcp::v4(), port);
-    net::post(m_impl->ioc_, [this, endpoint]()
+    net::post(m_impl->acceptor_ioc(), [this, endpoint]()
               {
         beast::error_code ec;
-        m_impl->acceptor_ = std::make_shared<tcp::acceptor>(m_impl->ioc_);
+        m_impl->acceptor_ = std::make_shared<tcp::acceptor>(m_impl->acceptor_ioc());
         m_impl->acceptor_->open(endpoint.protocol(), ec);
         if (ec) return;
         m_impl->acceptor_->set_option(net::socket_base::reuse_address(true), ec);
@@ -335,89 +1489,301 @@ void NetworkEngine::startListening(int port)
         if (ec) return;
         m_impl->acceptor_->listen(net::socket_base::max_connections, ec);
         if (ec) return;
-        m_impl->do_accept(); });
+        m_impl->mark(m_impl->listening_us_);
+        // the kernel backlog holds early connections until the cert is there
+        m_impl->when_cert_ready([this](bool ok)
+                                { net::post(m_impl->acceptor_ioc(), [this, ok]
+                                            {
+                                                // refused beats a handshake that never starts
+                                                if (!ok)
+                                                {
+                                                    beast::error_code ignored;
+                                                    m_impl->acceptor_->close(ignored);
+                                                    return;
+                                                }
+                                                m_impl->do_accept(); }); }); });
 }
 
 void NetworkEngine::addPersistentPeer(const std::string &ip, int port)
 {
 
-    net::post(m_impl->ioc_, [this, ip, port]()
+    net::io_context &ioc = m_impl->next_ioc();
+    net::post(ioc, [this, &ioc, ip, port]()
               {
-        auto connector = std::make_shared<PeerConnector>(m_impl->ioc_, m_impl->ctx_, this, ip, port);
+        auto connector = std::make_shared<PeerConnector>(ioc, this, m_impl->options_, ip, port);
         {
             std::lock_guard<std::mutex> lock(m_impl->connector_mutex_);
             m_impl->connectors_.push_back(connector);
         }
-        connector->start(); });
+        m_impl->when_cert_ready([connector](bool ok)
+                                {
+                                    if (ok)
+                                        connector->start(); }); });
 }
 
 void NetworkEngine::connectToPeer(const std::string &ip, int port)
 {
-    net::post(m_impl->ioc_, [this, ip, port]()
+    m_impl->counters_.dial_attempts++;
+    m_impl->mark(m_impl->first_dial_us_);
+    net::io_context &ioc = m_impl->next_ioc();
+    net::post(ioc, [this, &ioc, ip, port]()
               {
-        auto session = std::make_shared<WssSession>(m_impl->ioc_, m_impl->ctx_, this);
-        {
-            std::lock_guard<std::mutex> lock(m_impl->session_mutex_);
-            m_impl->sessions_.push_back(session);
-        }
+        auto session = std::make_shared<WssSession>(ioc, m_impl->ctx_, this, m_impl->options_, m_impl->counters_,
+                                                    m_impl->local_peer_id_);
+        session->set_remote_host(ip);
+        session->set_session_cache(&m_impl->tls_sessions_, ip + ":" + std::to_string(port));
+        m_impl->add_session(session);
         session->run_client(ip, std::to_string(port)); });
 }
 
-void NetworkEngine::broadcast(const std::string &msg)
+bool NetworkEngine::hasSessionTo(const std::string &host, std::uint64_t peer_id) const
+{
+    return m_impl->sessions_.has_host(host) || (peer_id != 0 && m_impl->sessions_.has_peer(peer_id));
+}
+
+void NetworkEngine::broadcast(const std::string &msg, MessageClass cls)
+{
+    // the only copy: into the buffer every session queue shares
+    m_impl->counters_.broadcast_bytes_copied += msg.size();
+    m_impl->counters_.last_broadcast_bytes_copied = msg.size();
+    m_impl->counters_.broadcasts++;
+    fanOut(std::make_shared<const std::string>(msg), cls);
+}
+
+void NetworkEngine::broadcast(std::string &&msg, MessageClass cls)
 {
-    std::lock_guard<std::mutex> lock(m_impl->session_mutex_);
+    m_impl->counters_.last_broadcast_bytes_copied = 0;
+    m_impl->counters_.broadcasts++;
+    fanOut(std::make_shared<const std::string>(std::move(msg)), cls);
+}
 
-    std::set<std::string> sent_ips;
+void NetworkEngine::broadcast(SharedPayload payload, MessageClass cls)
+{
+    if (!payload)
+        return;
+    m_impl->counters_.last_broadcast_bytes_copied = 0;
+    m_impl->counters_.broadcasts++;
+    fanOut(std::move(payload), cls);
+}
 
-    for (auto &s : m_impl->sessions_)
+bool NetworkEngine::sendTo(std::uint64_t session_id, std::string &&msg, MessageClass cls)
+{
+    return sendTo(session_id, std::make_shared<const std::string>(std::move(msg)), cls);
+}
+
+bool NetworkEngine::sendTo(std::uint64_t session_id, SharedPayload payload, MessageClass cls)
+{
+    if (!payload)
+        return false;
+    auto s = m_impl->sessions_.find_peer(session_id);
+    if (!s)
+        return false;
+    s->send(std::move(payload), cls);
+    return true;
+}
+
+void NetworkEngine::fanOut(const SharedPayload &payload, MessageClass cls, std::uint64_t except_session)
+{
+    if (m_impl->options_.relay && cls == MessageClass::Chat && except_session == 0)
     {
-        std::string ip = s->getRemoteEndpoint();
+        // our own line: give it an id, remember it so the echo from a neighbour is dropped
+        std::uint64_t seq = ++m_impl->relay_seq_;
+        m_impl->relay_seen_.insert(m_impl->local_peer_id_, seq);
 
-        if (sent_ips.count(ip))
-        {
-            continue;
-        }
+        std::string env(RELAY_HEADER_SIZE + payload->size(), '\0');
+        auto *p = reinterpret_cast<unsigned char *>(env.data());
+        p[0] = RELAY_MAGIC;
+        p[1] = m_impl->options_.relay_ttl;
+        put_u64_le(p + 2, m_impl->local_peer_id_);
+        put_u64_le(p + 10, seq);
+        std::memcpy(p + RELAY_HEADER_SIZE, payload->data(), payload->size());
 
-        s->send(msg);
-        sent_ips.insert(ip);
+        m_impl->counters_.relay_originated++;
+        m_impl->counters_.broadcast_bytes_copied += env.size();
+        m_impl->counters_.last_broadcast_bytes_copied += env.size();
+
+        auto snap = m_impl->sessions_.snapshot();
+        auto shared = std::make_shared<const std::string>(std::move(env));
+        for (auto &s : snap->peers)
+            s->send(shared, cls);
+        return;
+    }
+
+    auto snap = m_impl->sessions_.snapshot();
+    for (auto &s : snap->peers)
+    {
+        if (s->id() != except_session)
+            s->send(payload, cls);
     }
 }
 
-void NetworkEngine::onMessageReceived(const std::string &msg)
+std::vector<PeerStats> NetworkEngine::getPeerStats() const
 {
-    std::lock_guard<std::mutex> lock(m_impl->cb_mutex_);
-    if (m_impl->ui_msg_callback_)
-        m_impl->ui_msg_callback_(msg);
+    auto snap = m_impl->sessions_.snapshot();
+    std::vector<PeerStats> out;
+    out.reserve(snap->all.size());
+    for (auto &s : snap->all)
+        out.push_back(s->stats());
+    return out;
 }
 
-void NetworkEngine::onConnectionEstablished(const std::string &ip, bool is_incoming)
+StartupTimings NetworkEngine::getStartupTimings() const
 {
+    StartupTimings t;
+    t.cert_key_type = m_impl->cert_key_type_.load();
+    t.cert_failed = m_impl->cert_failed_.load();
+    t.cert_generate_us = m_impl->cert_generate_us_.load();
+    t.cert_ready_us = m_impl->cert_ready_us_.load();
+    t.listening_us = m_impl->listening_us_.load();
+    t.first_accept_us = m_impl->first_accept_us_.load();
+    t.first_dial_us = m_impl->first_dial_us_.load();
+    t.first_session_us = m_impl->first_session_us_.load();
+    return t;
 }
 
-void NetworkEngine::onDisconnect(const std::string &ip)
+NetworkStats NetworkEngine::getStats() const
 {
+    const auto &c = m_impl->counters_;
+    NetworkStats st;
+    st.broadcasts = c.broadcasts.load();
+    st.broadcast_bytes_copied = c.broadcast_bytes_copied.load();
+    st.last_broadcast_bytes_copied = c.last_broadcast_bytes_copied.load();
+    st.write_flushes = c.write_flushes.load();
+    st.write_frames = c.write_frames.load();
+    st.max_frames_per_flush = c.max_frames_per_flush.load();
+    st.queued_bytes = c.queued_bytes.load();
+    st.queue_high_watermark_bytes = c.queue_high_watermark_bytes.load();
+    st.dropped_frames = c.dropped_frames.load();
+    st.dropped_bytes = c.dropped_bytes.load();
+    st.slow_consumer_disconnects = c.slow_consumer_disconnects.load();
+    st.chat_queue_delay = c.chat_queue_delay.snapshot();
+    st.bulk_chunks = c.bulk_chunks.load();
+    st.dial_attempts = c.dial_attempts.load();
+    st.duplicate_sessions = c.duplicate_sessions.load();
+    st.superseded_sessions = c.superseded_sessions.load();
+    st.tls_full_handshakes = c.tls_full_handshakes.load();
+    st.tls_resumed_handshakes = c.tls_resumed_handshakes.load();
+    st.tls_full_handshake = c.tls_full_handshake.snapshot();
+    st.tls_resumed_handshake = c.tls_resumed_handshake.snapshot();
+    st.rx_messages = c.rx_messages.load();
+    st.rx_allocations = c.rx_allocations.load();
+    st.inbound_wakeups = c.inbound_wakeups.load();
+    st.inbound_dropped = c.inbound_dropped.load();
+    st.inbound_queued = m_impl->inbound_.size_approx();
+    st.relay_originated = c.relay_originated.load();
+    st.relay_forwarded = c.relay_forwarded.load();
+    st.relay_duplicates = c.relay_duplicates.load();
+    st.relay_ttl_expired = c.relay_ttl_expired.load();
+    return st;
+}
+
+void NetworkEngine::onMessageReceived(const RxMessage &msg, std::uint64_t session_id)
+{
+    const auto *p = reinterpret_cast<const unsigned char *>(msg.data());
+    if (msg.size() == 0 || p[0] != RELAY_MAGIC)
+        return deliver(msg);
+    if (msg.size() < RELAY_HEADER_SIZE)
+        return;
 
+    std::uint8_t ttl = p[1];
+    if (!m_impl->relay_seen_.insert(get_u64_le(p + 2), get_u64_le(p + 10)))
     {
-        std::lock_guard<std::mutex> lock(m_impl->session_mutex_);
-        m_impl->sessions_.erase(
-            std::remove_if(m_impl->sessions_.begin(), m_impl->sessions_.end(),
-                           [&ip](const std::shared_ptr<WssSession> &s)
-                           {
-                               return s->getRemoteEndpoint() == ip;
-                           }),
-            m_impl->sessions_.end());
+        m_impl->counters_.relay_duplicates++;
+        return;
     }
 
+    // peers without relay still unwrap, they just do not pass it on
+    if (m_impl->options_.relay)
     {
-        std::lock_guard<std::mutex> lock(m_impl->connector_mutex_);
-        for (auto &c : m_impl->connectors_)
+        if (ttl > 1)
+        {
+            // a copy per hop, a view would pin the read buffer until every neighbour's write is done
+            std::string fwd(msg.bytes());
+            fwd[1] = static_cast<char>(ttl - 1);
+            m_impl->counters_.relay_forwarded++;
+            m_impl->counters_.broadcast_bytes_copied += fwd.size();
+            m_impl->counters_.rx_allocations++;
+            fanOut(std::make_shared<const std::string>(std::move(fwd)), MessageClass::Chat, session_id);
+        }
+        else
         {
+            m_impl->counters_.relay_ttl_expired++;
+        }
+    }
+    deliver(msg.slice(RELAY_HEADER_SIZE, msg.size() - RELAY_HEADER_SIZE));
+}
 
-            c->on_session_disconnected();
+void NetworkEngine::deliver(const RxMessage &msg)
+{
+    if (m_impl->inbound_wake_.load(std::memory_order_acquire))
+    {
+        InboundItem item;
+        if (msg.size() <= InboundItem::INLINE_BYTES)
+        {
+            std::memcpy(item.bytes, msg.data(), msg.size());
+            item.size = static_cast<std::uint32_t>(msg.size());
+            item.session_id = msg.session_id();
+            item.is_inline = true;
+        }
+        else
+        {
+            item.view = msg;
+        }
+        if (!m_impl->inbound_.try_push(item))
+        {
+            m_impl->counters_.inbound_dropped++;
+            return;
         }
+        m_impl->wake_consumer();
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(m_impl->cb_mutex_);
+    if (m_impl->ui_msg_callback_)
+        m_impl->ui_msg_callback_(msg);
+}
+
+void NetworkEngine::onConnectionEstablished(const std::string &ip, bool is_incoming,
+                                            std::uint64_t session_id, std::uint64_t peer_id)
+{
+    m_impl->mark(m_impl->first_session_us_);
+    bool kept = true;
+    if (auto loser = m_impl->sessions_.establish(session_id, m_impl->local_peer_id_))
+    {
+        kept = loser->id() != session_id;
+        m_impl->counters_.superseded_sessions++;
+        loser->supersede();
+    }
+
+    if (kept)
+    {
+        std::lock_guard<std::mutex> lock(m_impl->cb_mutex_);
+        if (m_impl->ui_session_callback_)
+            m_impl->ui_session_callback_(session_id, peer_id);
+    }
+
+    // a dialed session carries the connector's configured address, incoming ones tell it nothing
+    if (!is_incoming)
+    {
+        for (auto &c : m_impl->connectors_for(ip))
+            c->learn_peer_id(peer_id);
+    }
+    if (kept)
+    {
+        for (auto &c : m_impl->connectors_for(ip, peer_id))
+            c->on_session_established();
     }
 }
 
+void NetworkEngine::onDisconnect(const std::string &ip, std::uint64_t session_id)
+{
+    auto session = m_impl->sessions_.remove(session_id);
+    std::uint64_t peer_id = session ? session->remote_peer_id() : 0;
+
+    for (auto &c : m_impl->connectors_for(ip, peer_id))
+        c->on_session_disconnected();
+}
+
 void NetworkEngine::onPingResult(const std::string &ip, long long ms)
 {
     std::lock_guard<std::mutex> lock(m_impl->cb_mutex_);
@@ -1,49 +1,285 @@
 #pragma once
 #include <string>
+#include <string_view>
 #include <memory>
 #include <functional>
 #include <vector>
+#include <cstdint>
+#include <chrono>
+#include "LatencyHistogram.h"
+#include "CertHelper.h"
+#include "TlsHelper.h"
 
 class PeerConnector;
 
+// immutable payload shared by every session queue it is written to
+using SharedPayload = std::shared_ptr<const std::string>;
+
+// a received message as a view into the read buffer it arrived in, copies share that buffer.
+// a view kept past the callback makes the session read into a fresh buffer, so consumers
+// should pull out what they need and let go
+class RxMessage
+{
+public:
+    RxMessage() = default;
+    RxMessage(std::shared_ptr<const void> owner, std::string_view bytes, std::uint64_t session_id = 0)
+        : owner_(std::move(owner)), bytes_(bytes), session_id_(session_id) {}
+
+    std::string_view bytes() const { return bytes_; }
+    const char *data() const { return bytes_.data(); }
+    std::size_t size() const { return bytes_.size(); }
+    bool empty() const { return bytes_.empty(); }
+    // the session it came in on, for answering with sendTo
+    std::uint64_t session_id() const { return session_id_; }
+
+    RxMessage slice(std::size_t offset, std::size_t len) const { return RxMessage(owner_, bytes_.substr(offset, len), session_id_); }
+
+private:
+    std::shared_ptr<const void> owner_;
+    std::string_view bytes_;
+    std::uint64_t session_id_ = 0;
+};
+
+// decides how a payload is queued and whether it may be dropped
+enum class MessageClass : std::uint8_t
+{
+    // live lines, the only class dropped on overflow
+    Chat,
+    // small control traffic such as sync requests, goes out with chat
+    Sync,
+    // history and sync answers: never dropped, sent in chunks that chat and sync overtake
+    Bulk,
+};
+
+enum class QueueOverflowPolicy : std::uint8_t
+{
+    // drop the oldest queued chat frames, sync and bulk frames are never dropped. if the queue is
+    // still over its limits without them the session is closed as a slow consumer
+    DropOldestChat,
+    // close the session and let the connector redial it
+    DisconnectSlowConsumer,
+};
+
+struct NetworkOptions
+{
+    // number of io_context threads, 0 = one per core (capped at 4)
+    std::size_t io_threads = 0;
+
+    // drain the whole write queue into one batched websocket message
+    bool coalesce_writes = false;
+    std::size_t coalesce_max_bytes = 64 * 1024;
+    // how long an idle session may hold a frame waiting for more, 0 = never wait
+    std::chrono::milliseconds coalesce_max_delay{0};
+
+    // offer permessage-deflate in both roles, messages under the threshold go out uncompressed
+    bool enable_deflate = true;
+    std::size_t deflate_min_bytes = 512;
+
+    // per session write queue limits
+    std::size_t max_queue_bytes = 8 * 1024 * 1024;
+    std::size_t max_queue_messages = 2048;
+    QueueOverflowPolicy queue_policy = QueueOverflowPolicy::DropOldestChat;
+    // bulk payloads go out in pieces of this size with interactive frames in between, 0 = whole and in order
+    std::size_t bulk_chunk_bytes = 16 * 1024;
+
+    // websocket ping used for rtt, 0 disables
+    std::chrono::milliseconds ping_interval{2000};
+
+    // redial delay doubles per failed attempt up to the cap, each wait is jittered
+    std::chrono::milliseconds reconnect_min_delay{500};
+    std::chrono::milliseconds reconnect_max_delay{30000};
+
+    // how long a server side session id / ticket stays valid for resumption
+    std::chrono::seconds tls_session_lifetime{7200};
+
+    // cipher order follows the cpu, see TlsHelper
+    TlsProfile tls_profile = TlsProfile::Tls12Or13;
+    // largest plaintext per tls record
+    std::size_t tls_max_send_fragment = 4096;
+
+    // generated on a background thread at startup, accepting and dialing wait for it
+    CertKeyType cert_key_type = CertKeyType::EcdsaP256;
+
+    // messages parked between the io threads and the consumer once setInboundWake is used.
+    // chat-sized ones are copied into their slot (256 bytes each on x64), bigger ones hold on to
+    // the receive buffer they came in until drained
+    std::size_t inbound_capacity = 8192;
+
+    // gossip instead of a full mesh: chat broadcasts get an id and a hop budget, every peer
+    // forwards what it has not seen to its other neighbours. sync traffic stays one hop.
+    // only worth it when peers are not all dialled directly, on a full mesh every line
+    // costs n*(n-2) extra frames that get dropped as duplicates
+    bool relay = false;
+    // the first copy to reach a peer came along a path without repeats, so a ttl at least
+    // the group size never cuts a flood short; it only bounds damage from forgotten ids
+    std::uint8_t relay_ttl = 32;
+    // ids remembered for duplicate suppression, oldest forgotten first
+    std::size_t relay_seen_capacity = 32768;
+};
+
+// microseconds since the engine was constructed, 0 = not reached yet
+struct StartupTimings
+{
+    // what was actually used, rsa if the requested curve could not be generated
+    CertKeyType cert_key_type = CertKeyType::EcdsaP256;
+    bool cert_failed = false;
+    // keygen + signing alone
+    std::uint64_t cert_generate_us = 0;
+    std::uint64_t cert_ready_us = 0;
+    std::uint64_t listening_us = 0;
+    std::uint64_t first_accept_us = 0;
+    std::uint64_t first_dial_us = 0;
+    std::uint64_t first_session_us = 0;
+};
+
+struct NetworkStats
+{
+    std::uint64_t broadcasts = 0;
+    std::uint64_t broadcast_bytes_copied = 0;
+    std::uint64_t last_broadcast_bytes_copied = 0;
+
+    std::uint64_t write_flushes = 0;
+    std::uint64_t write_frames = 0;
+    std::uint64_t max_frames_per_flush = 0;
+
+    // bytes queued across all sessions right now, and the deepest any single queue got
+    std::uint64_t queued_bytes = 0;
+    std::uint64_t queue_high_watermark_bytes = 0;
+    std::uint64_t dropped_frames = 0;
+    std::uint64_t dropped_bytes = 0;
+    std::uint64_t slow_consumer_disconnects = 0;
+    // time chat frames spent queued until their write completed, what a bulk transfer would inflate
+    LatencySnapshot chat_queue_delay;
+    std::uint64_t bulk_chunks = 0;
+
+    std::uint64_t dial_attempts = 0;
+    // sessions registered while another one to the same peer was already up
+    std::uint64_t duplicate_sessions = 0;
+    // redundant sessions closed by the handshake tie-break
+    std::uint64_t superseded_sessions = 0;
+
+    // both roles, timed from the start of the tls handshake to its completion
+    std::uint64_t tls_full_handshakes = 0;
+    std::uint64_t tls_resumed_handshakes = 0;
+    LatencySnapshot tls_full_handshake;
+    LatencySnapshot tls_resumed_handshake;
+
+    // receive path: buffers allocated or grown, should stay flat while messages climb
+    std::uint64_t rx_messages = 0;
+    std::uint64_t rx_allocations = 0;
+
+    // inbound handoff: wake-ups sent to the consumer and messages dropped on a full ring
+    std::uint64_t inbound_wakeups = 0;
+    std::uint64_t inbound_dropped = 0;
+    std::uint64_t inbound_queued = 0;
+
+    std::uint64_t relay_originated = 0;
+    std::uint64_t relay_forwarded = 0;
+    std::uint64_t relay_duplicates = 0;
+    std::uint64_t relay_ttl_expired = 0;
+};
+
+struct PeerStats
+{
+    std::string endpoint;
+    // 0 until the handshake is done or if the peer did not send one
+    std::uint64_t peer_id = 0;
+    bool deflate = false;
+    // static openssl strings, null until the tls handshake is done
+    const char *tls_version = nullptr;
+    const char *tls_cipher = nullptr;
+
+    std::uint64_t messages_out = 0;
+    std::uint64_t payload_bytes_out = 0;
+    // tls bytes after compression and encryption
+    std::uint64_t wire_bytes_out = 0;
+    std::uint64_t payload_bytes_in = 0;
+    std::uint64_t wire_bytes_in = 0;
+    // time spent in the synchronous compress + encrypt part of each write
+    std::uint64_t write_cpu_us = 0;
+
+    std::uint64_t queue_depth = 0;
+    std::uint64_t queued_bytes = 0;
+    std::uint64_t queue_high_watermark_bytes = 0;
+
+    LatencySnapshot rtt;
+};
+
 class INetworkObserver
 {
 public:
-    virtual void onMessageReceived(const std::string &msg) = 0;
-    virtual void onConnectionEstablished(const std::string &remote_endpoint, bool is_incoming) = 0;
+    // msg is only guaranteed to be cheap while the call lasts, see RxMessage
+    virtual void onMessageReceived(const RxMessage &msg, std::uint64_t session_id) = 0;
+    virtual void onConnectionEstablished(const std::string &remote_endpoint, bool is_incoming,
+                                         std::uint64_t session_id, std::uint64_t peer_id) = 0;
     virtual void onPingResult(const std::string &remote_endpoint, long long ms) = 0;
-    virtual void onDisconnect(const std::string &remote_endpoint) = 0;
+    virtual void onDisconnect(const std::string &remote_endpoint, std::uint64_t session_id) = 0;
     virtual ~INetworkObserver() = default;
 };
 
 class NetworkEngine : public INetworkObserver, public std::enable_shared_from_this<NetworkEngine>
 {
 public:
-    NetworkEngine();
+    explicit NetworkEngine(const NetworkOptions &options = NetworkOptions());
     ~NetworkEngine();
 
     void start();
     void stop();
 
+    std::size_t ioThreadCount() const;
+
+    // random per process, identifies this peer in message ids and handshakes
+    std::uint64_t localPeerId() const;
+
+    // blocks until the background cert generation is over. false if both key types failed,
+    // listening and dialing are shut off then and the engine will never carry traffic
+    bool waitForCertificate();
+    // the same without blocking: fn runs once on the cert thread when generation is over,
+    // or right away on the caller's thread if it already is
+    void whenCertificateReady(std::function<void(bool ok)> fn);
+
     void startListening(int port);
 
     void addPersistentPeer(const std::string &ip, int port);
 
-    void broadcast(const std::string &msg);
+    void broadcast(const std::string &msg, MessageClass cls = MessageClass::Chat);
+    void broadcast(std::string &&msg, MessageClass cls = MessageClass::Chat);
+    void broadcast(SharedPayload payload, MessageClass cls = MessageClass::Chat);
+    // one session only, false if it is gone
+    bool sendTo(std::uint64_t session_id, std::string &&msg, MessageClass cls = MessageClass::Chat);
+    bool sendTo(std::uint64_t session_id, SharedPayload payload, MessageClass cls = MessageClass::Chat);
+
+    NetworkStats getStats() const;
+    std::vector<PeerStats> getPeerStats() const;
+    StartupTimings getStartupTimings() const;
 
-    void setUiCallback(std::function<void(std::string)> cb);
+    void setUiCallback(std::function<void(const RxMessage &)> cb);
     void setPingCallback(std::function<void(std::string, long long)> cb);
+    // a session finished its handshake and is the one kept for that peer. called on an io thread
+    void setSessionCallback(std::function<void(std::uint64_t session_id, std::uint64_t peer_id)> cb);
+
+    // switches delivery from the ui callback to a ring the consumer drains itself. wake is called
+    // on an io thread, once per batch rather than per message, and must only signal (PostMessage etc.)
+    void setInboundWake(std::function<void()> wake);
+    // consumer thread only. takes up to max messages, if more are left another wake is sent.
+    // small messages live in the ring slot, so msg is only valid while fn runs, even copies of it
+    std::size_t drainInbound(const std::function<void(const RxMessage &)> &fn, std::size_t max = SIZE_MAX);
 
     void clearCallbacks();
 
-    void onMessageReceived(const std::string &msg) override;
-    void onConnectionEstablished(const std::string &ip, bool is_incoming) override;
+    void onMessageReceived(const RxMessage &msg, std::uint64_t session_id) override;
+    void onConnectionEstablished(const std::string &ip, bool is_incoming,
+                                 std::uint64_t session_id, std::uint64_t peer_id) override;
     void onPingResult(const std::string &ip, long long ms) override;
-    void onDisconnect(const std::string &ip) override;
+    void onDisconnect(const std::string &ip, std::uint64_t session_id) override;
 
 private:
     friend class PeerConnector;
     void connectToPeer(const std::string &ip, int port);
+    // peer_id 0 checks the address only
+    bool hasSessionTo(const std::string &host, std::uint64_t peer_id) const;
+    void fanOut(const SharedPayload &payload, MessageClass cls, std::uint64_t except_session = 0);
+    void deliver(const RxMessage &msg);
     struct Impl;
     std::unique_ptr<Impl> m_impl;
 };
\ No newline at end of file
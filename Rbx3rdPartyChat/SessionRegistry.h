@@ -0,0 +1,228 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// writers take write_mutex_ and publish a new snapshot. readers never touch that mutex and never
+// wait for a writer's rebuild, but loading the snapshot is not lock free: msvc and libstdc++
+// guard the atomic shared_ptr with a spin bit and bump its refcount, so concurrent readers still
+// meet on one cache line for a few instructions. the registry bench measures what that costs.
+// Session needs id(), getRemoteEndpoint(), remote_peer_id() and initiator_id()
+template <typename Session>
+class SessionRegistry
+{
+public:
+    using SessionPtr = std::shared_ptr<Session>;
+
+    struct Snapshot
+    {
+        std::vector<SessionPtr> all;
+        // one session per peer, what broadcast walks
+        std::vector<SessionPtr> peers;
+        // the same sessions by session id, what a reply to one peer looks up
+        std::unordered_map<std::uint64_t, SessionPtr> peers_by_id;
+    };
+
+    SessionRegistry()
+    {
+        snapshot_.store(std::make_shared<const Snapshot>());
+    }
+
+    std::shared_ptr<const Snapshot> snapshot() const
+    {
+        return snapshot_.load(std::memory_order_acquire);
+    }
+
+    // nullptr once the session lost a tie-break or closed
+    SessionPtr find_peer(std::uint64_t id) const
+    {
+        auto snap = snapshot();
+        auto it = snap->peers_by_id.find(id);
+        return it == snap->peers_by_id.end() ? nullptr : it->second;
+    }
+
+    // listed by host until the handshake tells us the peer id, false if the host already had a session
+    bool insert(const SessionPtr &s)
+    {
+        std::lock_guard<std::mutex> lock(write_mutex_);
+        Entry &e = by_id_[s->id()];
+        e.session = s;
+        e.host = s->getRemoteEndpoint();
+        e.peer_id = 0;
+        e.listed = true;
+        hosts_[e.host]++;
+        auto &ids = by_host_[e.host];
+        ids.push_back(s->id());
+        publish();
+        return ids.size() == 1;
+    }
+
+    // moves an established session under its peer id and resolves duplicates.
+    // of two sessions to the same peer the one dialed by the lower peer id stays, so both
+    // ends pick the same tcp connection without talking about it. if the same side dialed
+    // both, it redialed and the old one is a half-open leftover, so the new one stays.
+    // returns the loser, if any
+    SessionPtr establish(std::uint64_t id, std::uint64_t local_peer_id)
+    {
+        std::lock_guard<std::mutex> lock(write_mutex_);
+        auto it = by_id_.find(id);
+        if (it == by_id_.end() || !it->second.listed)
+            return nullptr;
+
+        Entry &e = it->second;
+        std::uint64_t peer_id = e.session->remote_peer_id();
+        if (peer_id == 0)
+            return nullptr;
+
+        unlink(by_host_, e.host, id);
+        if (peer_id == local_peer_id)
+        {
+            // dialed ourselves
+            unlist(e);
+            publish();
+            return e.session;
+        }
+        e.peer_id = peer_id;
+
+        SessionPtr loser;
+        auto peer = by_peer_.find(peer_id);
+        if (peer == by_peer_.end())
+        {
+            by_peer_.emplace(peer_id, id);
+        }
+        else
+        {
+            Entry &other = by_id_.at(peer->second);
+            std::uint64_t preferred = std::min(local_peer_id, peer_id);
+            bool same_side = e.session->initiator_id() == other.session->initiator_id();
+            bool new_wins = same_side || e.session->initiator_id() == preferred;
+            Entry &lost = new_wins ? other : e;
+            loser = lost.session;
+            unlist(lost);
+            if (new_wins)
+                peer->second = id;
+        }
+        publish();
+        return loser;
+    }
+
+    bool has_host(const std::string &host) const
+    {
+        std::lock_guard<std::mutex> lock(write_mutex_);
+        return hosts_.count(host) != 0;
+    }
+
+    // an established session to the peer, whichever side dialed it and from what address
+    bool has_peer(std::uint64_t peer_id) const
+    {
+        std::lock_guard<std::mutex> lock(write_mutex_);
+        return by_peer_.count(peer_id) != 0;
+    }
+
+    // returns the session that was listed, if any
+    SessionPtr remove(std::uint64_t id)
+    {
+        std::lock_guard<std::mutex> lock(write_mutex_);
+        auto it = by_id_.find(id);
+        if (it == by_id_.end())
+            return nullptr;
+        Entry &e = it->second;
+        if (e.listed)
+        {
+            auto peer = by_peer_.find(e.peer_id);
+            if (peer != by_peer_.end() && peer->second == id)
+                by_peer_.erase(peer);
+            else
+                unlink(by_host_, e.host, id);
+            unlist(e);
+        }
+        SessionPtr s = std::move(e.session);
+        by_id_.erase(it);
+        publish();
+        return s;
+    }
+
+    void clear()
+    {
+        std::lock_guard<std::mutex> lock(write_mutex_);
+        by_id_.clear();
+        by_host_.clear();
+        by_peer_.clear();
+        hosts_.clear();
+        publish();
+    }
+
+private:
+    struct Entry
+    {
+        SessionPtr session;
+        std::string host;
+        // 0 until the handshake
+        std::uint64_t peer_id = 0;
+        // false once the session lost a tie-break, it stays in by_id_ for stats until it closes
+        bool listed = false;
+    };
+
+    // hosts_ counts the listed sessions per host, so has_host is a lookup
+    void unlist(Entry &e)
+    {
+        if (!e.listed)
+            return;
+        e.listed = false;
+        auto it = hosts_.find(e.host);
+        if (it != hosts_.end() && --it->second == 0)
+            hosts_.erase(it);
+    }
+
+    static void unlink(std::unordered_map<std::string, std::vector<std::uint64_t>> &index, const std::string &key,
+                       std::uint64_t id)
+    {
+        auto it = index.find(key);
+        if (it == index.end())
+            return;
+        auto &ids = it->second;
+        ids.erase(std::remove(ids.begin(), ids.end(), id), ids.end());
+        if (ids.empty())
+            index.erase(it);
+    }
+
+    // the map updates are O(1), but every write then copies all sessions into a fresh snapshot,
+    // so insert, establish and remove are O(sessions). writes come with connects and disconnects,
+    // reads with every broadcast, and tens of sessions copy faster than readers could share a lock
+    void publish()
+    {
+        auto snap = std::make_shared<Snapshot>();
+        snap->all.reserve(by_id_.size());
+        for (auto &kv : by_id_)
+            snap->all.push_back(kv.second.session);
+        snap->peers.reserve(by_host_.size() + by_peer_.size());
+        snap->peers_by_id.reserve(by_host_.size() + by_peer_.size());
+        auto add_peer = [&](std::uint64_t id)
+        {
+            const SessionPtr &s = by_id_.at(id).session;
+            snap->peers.push_back(s);
+            snap->peers_by_id.emplace(id, s);
+        };
+        // sessions still in the handshake stand in for their host
+        for (auto &kv : by_host_)
+            add_peer(kv.second.front());
+        for (auto &kv : by_peer_)
+            add_peer(kv.second);
+        snapshot_.store(std::move(snap), std::memory_order_release);
+    }
+
+    mutable std::mutex write_mutex_;
+    std::unordered_map<std::uint64_t, Entry> by_id_;
+    // sessions still in the handshake, by remote host
+    std::unordered_map<std::string, std::vector<std::uint64_t>> by_host_;
+    // the one established session per peer id. kept apart from by_host_ so a host name can
+    // never collide with a peer id
+    std::unordered_map<std::uint64_t, std::uint64_t> by_peer_;
+    std::unordered_map<std::string, std::size_t> hosts_;
+    std::atomic<std::shared_ptr<const Snapshot>> snapshot_;
+};
@@ -612,6 +612,10 @@ void SetupWindow::PerformSync()
     InitNetwork();
 
     LogStatus(L"Starting mesh network...");
+    if (global_relay_mode)
+        LogStatus(L"Relay mode: lines are passed on to peers not dialed directly.");
+    if (global_sync_marks_only)
+        LogStatus(L"Sync: high water marks only, no filter unless a sender has a hole.");
 
     global_net_engine->startListening(localPort);
 
@@ -0,0 +1,97 @@
+#include "pch.h"
+#include "TextArena.h"
+
+TextArena::Ref TextArena::add(std::string_view s)
+{
+    Ref r;
+    if (s.empty())
+        return r;
+    std::uint32_t len = static_cast<std::uint32_t>(s.size());
+
+    if (len > CHUNK_SIZE / 4)
+    {
+        // a wall of text gets a chunk of its own instead of wasting the tail of a shared one
+        r.chunk = new_chunk(len);
+    }
+    else
+    {
+        if (current_ == UINT32_MAX || chunks_[current_].size - chunks_[current_].used < len)
+        {
+            std::uint32_t old = current_;
+            current_ = new_chunk(CHUNK_SIZE);
+            if (old != UINT32_MAX && chunks_[old].live == 0)
+                free_chunk(old);
+        }
+        r.chunk = current_;
+    }
+
+    Chunk &c = chunks_[r.chunk];
+    r.offset = c.used;
+    r.length = len;
+    std::memcpy(c.data.get() + c.used, s.data(), len);
+    c.used += len;
+    c.live++;
+    live_bytes_ += len;
+    return r;
+}
+
+void TextArena::release(const Ref &r)
+{
+    if (!r.length)
+        return;
+    Chunk &c = chunks_[r.chunk];
+    live_bytes_ -= r.length;
+    // the chunk being filled stays even when empty, the next add goes there
+    if (--c.live == 0 && r.chunk != current_)
+        free_chunk(r.chunk);
+}
+
+void TextArena::clear()
+{
+    chunks_.clear();
+    free_slots_.clear();
+    spare_.reset();
+    current_ = UINT32_MAX;
+    reserved_ = 0;
+    live_bytes_ = 0;
+}
+
+std::uint32_t TextArena::new_chunk(std::uint32_t size)
+{
+    std::uint32_t index;
+    if (!free_slots_.empty())
+    {
+        index = free_slots_.back();
+        free_slots_.pop_back();
+    }
+    else
+    {
+        index = static_cast<std::uint32_t>(chunks_.size());
+        chunks_.emplace_back();
+    }
+
+    Chunk &c = chunks_[index];
+    if (size == CHUNK_SIZE && spare_)
+        c.data = std::move(spare_);
+    else
+    {
+        c.data.reset(new char[size]);
+        reserved_ += size;
+    }
+    c.size = size;
+    c.used = 0;
+    c.live = 0;
+    return index;
+}
+
+void TextArena::free_chunk(std::uint32_t index)
+{
+    Chunk &c = chunks_[index];
+    if (c.size == CHUNK_SIZE && !spare_)
+        spare_ = std::move(c.data);
+    else
+        reserved_ -= c.size;
+    c.data.reset();
+    c.size = c.used = c.live = 0;
+    free_slots_.push_back(index);
+}
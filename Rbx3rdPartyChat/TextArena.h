@@ -0,0 +1,54 @@
+#pragma once
+#include <cstdint>
+#include <memory>
+#include <string_view>
+#include <vector>
+
+// utf-8 strings packed back to back in big chunks instead of one heap block per string.
+// strings are released one by one, a chunk goes back to the pool once all of its strings
+// are gone. history evicts oldest first, so chunks empty out in the order they were filled
+class TextArena
+{
+public:
+    static constexpr std::uint32_t CHUNK_SIZE = 64 * 1024;
+
+    struct Ref
+    {
+        std::uint32_t chunk = 0;
+        std::uint32_t offset = 0;
+        std::uint32_t length = 0;
+    };
+
+    Ref add(std::string_view s);
+    std::string_view get(const Ref &r) const
+    {
+        return r.length ? std::string_view(chunks_[r.chunk].data.get() + r.offset, r.length) : std::string_view();
+    }
+    void release(const Ref &r);
+    void clear();
+
+    // chunk memory held, live or not, and bytes of strings still referenced
+    std::size_t bytes_reserved() const { return reserved_; }
+    std::size_t bytes_live() const { return live_bytes_; }
+
+private:
+    struct Chunk
+    {
+        std::unique_ptr<char[]> data;
+        std::uint32_t size = 0;
+        std::uint32_t used = 0;
+        std::uint32_t live = 0;
+    };
+
+    std::uint32_t new_chunk(std::uint32_t size);
+    void free_chunk(std::uint32_t index);
+
+    std::vector<Chunk> chunks_;
+    // chunk slots whose memory went back, reused before the vector grows
+    std::vector<std::uint32_t> free_slots_;
+    // one emptied buffer kept around so a steady stream doesn't allocate per chunk
+    std::unique_ptr<char[]> spare_;
+    std::uint32_t current_ = UINT32_MAX;
+    std::size_t reserved_ = 0;
+    std::size_t live_bytes_ = 0;
+};
@@ -0,0 +1,76 @@
+#include "pch.h"
+#include "TlsHelper.h"
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#elif defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#endif
+
+bool TlsHelper::cpu_has_aes_ni() {
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+    int regs[4] = {};
+    __cpuid(regs, 1);
+    return (regs[2] & (1 << 25)) != 0;
+#elif defined(__x86_64__) || defined(__i386__)
+    unsigned a = 0, b = 0, c = 0, d = 0;
+    if (!__get_cpuid(1, &a, &b, &c, &d)) return false;
+    return (c & (1u << 25)) != 0;
+#elif defined(_M_ARM64) || defined(__aarch64__)
+    // armv8 crypto extensions, every windows on arm device has them
+    return true;
+#else
+    return false;
+#endif
+}
+
+const char* TlsHelper::tls13_ciphersuites(bool aes_ni) {
+    if (aes_ni)
+        return "TLS_AES_128_GCM_SHA256:TLS_CHACHA20_POLY1305_SHA256:TLS_AES_256_GCM_SHA384";
+    return "TLS_CHACHA20_POLY1305_SHA256:TLS_AES_128_GCM_SHA256:TLS_AES_256_GCM_SHA384";
+}
+
+const char* TlsHelper::tls12_cipher_list(bool aes_ni) {
+    if (aes_ni)
+        return "ECDHE-ECDSA-AES128-GCM-SHA256:ECDHE-RSA-AES128-GCM-SHA256:"
+               "ECDHE-ECDSA-CHACHA20-POLY1305:ECDHE-RSA-CHACHA20-POLY1305:"
+               "ECDHE-ECDSA-AES256-GCM-SHA384:ECDHE-RSA-AES256-GCM-SHA384";
+    return "ECDHE-ECDSA-CHACHA20-POLY1305:ECDHE-RSA-CHACHA20-POLY1305:"
+           "ECDHE-ECDSA-AES128-GCM-SHA256:ECDHE-RSA-AES128-GCM-SHA256:"
+           "ECDHE-ECDSA-AES256-GCM-SHA384:ECDHE-RSA-AES256-GCM-SHA384";
+}
+
+void TlsHelper::apply(boost::asio::ssl::context& ctx, TlsProfile profile, std::size_t max_send_fragment) {
+    SSL_CTX* native = ctx.native_handle();
+
+    int min_version = profile == TlsProfile::Tls13Only ? TLS1_3_VERSION : TLS1_2_VERSION;
+    int max_version = profile == TlsProfile::Tls12 ? TLS1_2_VERSION : TLS1_3_VERSION;
+    if (SSL_CTX_set_min_proto_version(native, min_version) != 1 ||
+        SSL_CTX_set_max_proto_version(native, max_version) != 1)
+        throw std::runtime_error("SSL_CTX_set_proto_version failed");
+
+    bool aes_ni = cpu_has_aes_ni();
+    if (SSL_CTX_set_ciphersuites(native, tls13_ciphersuites(aes_ni)) != 1 ||
+        SSL_CTX_set_cipher_list(native, tls12_cipher_list(aes_ni)) != 1)
+        throw std::runtime_error("SSL_CTX_set_ciphers failed");
+
+    // as the server our order wins, except a client that put chacha first is assumed to lack aes-ni
+    SSL_CTX_set_options(native, SSL_OP_CIPHER_SERVER_PREFERENCE | SSL_OP_PRIORITIZE_CHACHA);
+
+    // one resumption ticket is all the client cache keeps, the default of two is wasted work
+    SSL_CTX_set_num_tickets(native, 1);
+
+    // openssl clamps to 512..16384, a chat line never fills a record anyway but a
+    // big sync payload in small records can be decrypted while it is still arriving
+    std::size_t fragment = std::clamp<std::size_t>(max_send_fragment, 512, SSL3_RT_MAX_PLAIN_LENGTH);
+    SSL_CTX_set_max_send_fragment(native, static_cast<long>(fragment));
+}
+
+const char* TlsHelper::profile_name(TlsProfile profile) {
+    switch (profile) {
+    case TlsProfile::Tls12: return "TLS1.2";
+    case TlsProfile::Tls12Or13: return "TLS1.2/1.3";
+    case TlsProfile::Tls13Only: return "TLS1.3";
+    }
+    return "?";
+}
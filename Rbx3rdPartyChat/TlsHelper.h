@@ -0,0 +1,29 @@
+#pragma once
+
+#include <boost/asio/ssl.hpp>
+#include <openssl/ssl.h>
+#include <cstddef>
+
+enum class TlsProfile
+{
+    // what every build so far spoke, 2-rtt full handshakes
+    Tls12,
+    // 1.3 when both sides have it, 1.2 for older peers
+    Tls12Or13,
+    // 1-rtt handshakes only, refuses peers that cannot do 1.3
+    Tls13Only,
+};
+
+class TlsHelper
+{
+public:
+    // versions, cipher order and record size on a context built with ssl::context::tls
+    static void apply(boost::asio::ssl::context &ctx, TlsProfile profile, std::size_t max_send_fragment);
+
+    // aes-gcm is only fast with aes-ni, chacha20-poly1305 wins on everything else
+    static bool cpu_has_aes_ni();
+    static const char *tls13_ciphersuites(bool aes_ni);
+    static const char *tls12_cipher_list(bool aes_ni);
+
+    static const char *profile_name(TlsProfile profile);
+};
@@ -0,0 +1,226 @@
+#include "pch.h"
+#include "WireProtocol.h"
+
+namespace wire
+{
+    void put_u16(std::string &out, std::uint16_t v)
+    {
+        out.push_back(static_cast<char>(v));
+        out.push_back(static_cast<char>(v >> 8));
+    }
+
+    void put_u32(std::string &out, std::uint32_t v)
+    {
+        for (int i = 0; i < 4; ++i)
+            out.push_back(static_cast<char>(v >> (8 * i)));
+    }
+
+    void put_u64(std::string &out, std::uint64_t v)
+    {
+        for (int i = 0; i < 8; ++i)
+            out.push_back(static_cast<char>(v >> (8 * i)));
+    }
+
+    std::uint16_t get_u16(const char *p)
+    {
+        const auto *u = reinterpret_cast<const unsigned char *>(p);
+        return static_cast<std::uint16_t>(u[0] | (u[1] << 8));
+    }
+
+    std::uint32_t get_u32(const char *p)
+    {
+        const auto *u = reinterpret_cast<const unsigned char *>(p);
+        std::uint32_t v = 0;
+        for (int i = 3; i >= 0; --i)
+            v = (v << 8) | u[i];
+        return v;
+    }
+
+    std::uint64_t get_u64(const char *p)
+    {
+        const auto *u = reinterpret_cast<const unsigned char *>(p);
+        std::uint64_t v = 0;
+        for (int i = 7; i >= 0; --i)
+            v = (v << 8) | u[i];
+        return v;
+    }
+
+    bool is_frame(std::string_view buf)
+    {
+        return buf.size() >= HEADER_SIZE && static_cast<std::uint8_t>(buf[0]) == MAGIC;
+    }
+
+    bool decode_frame(std::string_view buf, FrameView &out)
+    {
+        if (!is_frame(buf))
+            return false;
+        if (static_cast<std::uint8_t>(buf[1]) != VERSION)
+            return false;
+
+        out.version = static_cast<std::uint8_t>(buf[1]);
+        out.type = static_cast<FrameType>(buf[2]);
+        out.flags = static_cast<std::uint8_t>(buf[3]);
+        out.count = get_u32(buf.data() + 4);
+        out.body = buf.substr(HEADER_SIZE);
+        return true;
+    }
+
+    RecordReader::RecordReader(const FrameView &frame)
+        : body_(frame.body), left_(frame.count)
+    {
+    }
+
+    bool RecordReader::next(RecordView &out)
+    {
+        if (!ok_ || left_ == 0)
+            return false;
+
+        const std::size_t fixed = 8 * 3 + 2;
+        if (body_.size() - pos_ < fixed)
+            return ok_ = false;
+
+        const char *p = body_.data() + pos_;
+        out.msg_id = get_u64(p);
+        out.sender_id = get_u64(p + 8);
+        out.timestamp = get_u64(p + 16);
+        std::uint16_t nick_len = get_u16(p + 24);
+        pos_ += fixed;
+
+        if (body_.size() - pos_ < std::size_t(nick_len) + 4)
+            return ok_ = false;
+        out.nick = body_.substr(pos_, nick_len);
+        pos_ += nick_len;
+
+        std::uint32_t text_len = get_u32(body_.data() + pos_);
+        pos_ += 4;
+        if (body_.size() - pos_ < text_len)
+            return ok_ = false;
+        out.text = body_.substr(pos_, text_len);
+        pos_ += text_len;
+
+        --left_;
+        return true;
+    }
+
+    FrameWriter::FrameWriter(FrameType type, std::size_t reserve)
+    {
+        buf_.reserve(HEADER_SIZE + reserve);
+        buf_.push_back(static_cast<char>(MAGIC));
+        buf_.push_back(static_cast<char>(VERSION));
+        buf_.push_back(static_cast<char>(type));
+        buf_.push_back(0);
+        put_u32(buf_, 0);
+    }
+
+    void FrameWriter::add_record(std::uint64_t msg_id, std::uint64_t sender_id, std::uint64_t timestamp,
+                                 std::string_view nick, std::string_view text)
+    {
+        append_record(buf_, msg_id, sender_id, timestamp, nick, text);
+        ++count_;
+    }
+
+    void FrameWriter::add_high_water(const HighWater &mark)
+    {
+        put_u64(buf_, mark.sender_id);
+        put_u64(buf_, mark.seq);
+        ++count_;
+    }
+
+    void FrameWriter::set_flags(std::uint8_t flags)
+    {
+        buf_[3] = static_cast<char>(flags);
+    }
+
+    void FrameWriter::append_body(std::string_view bytes, std::uint32_t records)
+    {
+        buf_.append(bytes);
+        count_ += records;
+    }
+
+    std::string FrameWriter::finish()
+    {
+        for (int i = 0; i < 4; ++i)
+            buf_[4 + i] = static_cast<char>(count_ >> (8 * i));
+        return std::move(buf_);
+    }
+
+    std::size_t record_size(std::string_view nick, std::string_view text)
+    {
+        return record_size(nick.size(), text.size());
+    }
+
+    std::size_t record_size(std::size_t nick_bytes, std::size_t text_bytes)
+    {
+        return 8 * 3 + 2 + std::min<std::size_t>(nick_bytes, 0xFFFF) + 4 + text_bytes;
+    }
+
+    void append_record(std::string &out, std::uint64_t msg_id, std::uint64_t sender_id, std::uint64_t timestamp,
+                       std::string_view nick, std::string_view text)
+    {
+        if (nick.size() > 0xFFFF)
+            nick = nick.substr(0, 0xFFFF);
+
+        put_u64(out, msg_id);
+        put_u64(out, sender_id);
+        put_u64(out, timestamp);
+        put_u16(out, static_cast<std::uint16_t>(nick.size()));
+        out.append(nick);
+        put_u32(out, static_cast<std::uint32_t>(text.size()));
+        out.append(text);
+    }
+
+    std::string encode_sync_request(const std::vector<HighWater> &marks, const BloomFilter *filter, std::uint64_t since)
+    {
+        std::string bits = filter && !filter->empty() ? filter->serialize() : std::string();
+        FrameWriter w(FrameType::SyncRequest, marks.size() * 16 + (bits.empty() ? 0 : 13 + bits.size()));
+        for (const auto &m : marks)
+            w.add_high_water(m);
+        if (!bits.empty())
+        {
+            std::string tail;
+            tail.reserve(13);
+            put_u64(tail, since);
+            put_u32(tail, filter->bit_count());
+            tail.push_back(static_cast<char>(filter->hash_count()));
+            w.set_flags(SYNC_FLAG_FILTER);
+            w.append_body(tail);
+            w.append_body(bits);
+        }
+        return w.finish();
+    }
+
+    bool decode_sync_request(const FrameView &frame, std::vector<HighWater> &out)
+    {
+        out.clear();
+        if (frame.body.size() / 16 < frame.count)
+            return false;
+        out.reserve(frame.count);
+        for (std::uint32_t i = 0; i < frame.count; ++i)
+        {
+            const char *p = frame.body.data() + std::size_t(i) * 16;
+            out.push_back({ get_u64(p), get_u64(p + 8) });
+        }
+        return true;
+    }
+
+    bool decode_sync_filter(const FrameView &frame, BloomFilter &out, std::uint64_t &since)
+    {
+        if (!(frame.flags & SYNC_FLAG_FILTER) || frame.body.size() / 16 < frame.count)
+            return false;
+        std::string_view rest = frame.body.substr(std::size_t(frame.count) * 16);
+        if (rest.size() < 13)
+            return false;
+        since = get_u64(rest.data());
+        std::uint32_t bit_count = get_u32(rest.data() + 8);
+        std::uint8_t hash_count = static_cast<std::uint8_t>(rest[12]);
+        return out.deserialize(bit_count, hash_count, rest.substr(13));
+    }
+
+    std::string encode_chat(std::uint64_t msg_id, std::uint64_t sender_id, std::uint64_t timestamp,
+                            std::string_view nick, std::string_view text)
+    {
+        FrameWriter w(FrameType::Chat, record_size(nick, text));
+        w.add_record(msg_id, sender_id, timestamp, nick, text);
+        return w.finish();
+    }
+}
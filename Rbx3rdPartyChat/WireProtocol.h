@@ -0,0 +1,128 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "BloomFilter.h"
+
+// binary chat frames, all integers little endian
+//
+//   u8  magic (0xFE, never the first byte of utf-8 text)
+//   u8  version
+//   u8  type
+//   u8  flags
+//   u32 record count
+//   records...
+//
+// record:
+//   u64 msg_id (per sender sequence), u64 sender_id (peer id), u64 timestamp (hybrid logical clock)
+//   u16 nick length, nick bytes (utf-8)
+//   u32 text length, text bytes (utf-8)
+//
+// a sync request carries no records, its count is the number of high water marks:
+//   u64 sender_id, u64 seq   (the highest seq we hold from that sender)
+// with SYNC_FLAG_FILTER the marks are followed by a bloom filter of every id we hold:
+//   u64 since (hlc of our oldest message when our history is full, else 0)
+//   u32 bit count, u8 hash count, bits
+// the answer is a sync response with the records the requester is missing
+namespace wire
+{
+    constexpr std::uint8_t MAGIC = 0xFE;
+    constexpr std::uint8_t VERSION = 1;
+    constexpr std::size_t HEADER_SIZE = 8;
+    constexpr std::uint8_t SYNC_FLAG_FILTER = 0x01;
+
+    enum class FrameType : std::uint8_t
+    {
+        Chat = 1,
+        SyncRequest = 2,
+        SyncResponse = 3,
+    };
+
+    // views point into the received buffer, nothing is copied while decoding
+    struct FrameView
+    {
+        std::uint8_t version = 0;
+        FrameType type = FrameType::Chat;
+        std::uint8_t flags = 0;
+        std::uint32_t count = 0;
+        std::string_view body;
+    };
+
+    struct RecordView
+    {
+        std::uint64_t msg_id = 0;
+        std::uint64_t sender_id = 0;
+        std::uint64_t timestamp = 0;
+        std::string_view nick;
+        std::string_view text;
+    };
+
+    struct HighWater
+    {
+        std::uint64_t sender_id = 0;
+        std::uint64_t seq = 0;
+    };
+
+    bool is_frame(std::string_view buf);
+    bool decode_frame(std::string_view buf, FrameView &out);
+
+    class RecordReader
+    {
+    public:
+        explicit RecordReader(const FrameView &frame);
+
+        // false at the end of the frame or on a truncated record
+        bool next(RecordView &out);
+        bool ok() const { return ok_; }
+
+    private:
+        std::string_view body_;
+        std::size_t pos_ = 0;
+        std::uint32_t left_ = 0;
+        bool ok_ = true;
+    };
+
+    class FrameWriter
+    {
+    public:
+        explicit FrameWriter(FrameType type, std::size_t reserve = 0);
+
+        void add_record(std::uint64_t msg_id, std::uint64_t sender_id, std::uint64_t timestamp,
+                        std::string_view nick, std::string_view text);
+        void add_high_water(const HighWater &mark);
+        void set_flags(std::uint8_t flags);
+        // raw bytes, records counts how many whole records they hold
+        void append_body(std::string_view bytes, std::uint32_t records = 0);
+
+        std::uint32_t count() const { return count_; }
+        std::string finish();
+
+    private:
+        std::string buf_;
+        std::uint32_t count_ = 0;
+    };
+
+    std::size_t record_size(std::string_view nick, std::string_view text);
+    // one record onto the end of out, for callers that keep encoded records around
+    void append_record(std::string &out, std::uint64_t msg_id, std::uint64_t sender_id, std::uint64_t timestamp,
+                       std::string_view nick, std::string_view text);
+    std::size_t record_size(std::size_t nick_bytes, std::size_t text_bytes);
+
+    std::string encode_sync_request(const std::vector<HighWater> &marks, const BloomFilter *filter = nullptr,
+                                    std::uint64_t since = 0);
+    // false on a short body
+    bool decode_sync_request(const FrameView &frame, std::vector<HighWater> &out);
+    // false if the request has no filter or it is malformed
+    bool decode_sync_filter(const FrameView &frame, BloomFilter &out, std::uint64_t &since);
+
+    std::string encode_chat(std::uint64_t msg_id, std::uint64_t sender_id, std::uint64_t timestamp,
+                            std::string_view nick, std::string_view text);
+
+    void put_u16(std::string &out, std::uint16_t v);
+    void put_u32(std::string &out, std::uint32_t v);
+    void put_u64(std::string &out, std::uint64_t v);
+    std::uint16_t get_u16(const char *p);
+    std::uint32_t get_u32(const char *p);
+    std::uint64_t get_u64(const char *p);
+}
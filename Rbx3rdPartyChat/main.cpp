@@ -12,6 +12,11 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLine
         return 1;
     }
 
+    if (lpCmdLine && std::strstr(lpCmdLine, "--relay"))
+        global_relay_mode = true;
+    if (lpCmdLine && std::strstr(lpCmdLine, "--sync-marks"))
+        global_sync_marks_only = true;
+
     std::wstring localNick;
 
     if (SetupWindow::Run(hInstance, localNick)) {
@@ -19,9 +19,17 @@
 #include <algorithm>
 #include <thread>
 #include <map>
+#include <unordered_map>
+#include <unordered_set>
+#include <cstring>
+#include <cmath>
 #include <deque>
 #include <iostream>
 #include <set>
+#include <atomic>
+#include <random>
+#include <string_view>
+#include <charconv>
 #include <commctrl.h> // subxlass
 #pragma comment(lib, "comctl32.lib") 
 using Microsoft::WRL::ComPtr;
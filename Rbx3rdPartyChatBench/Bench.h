@@ -0,0 +1,94 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <map>
+#include <string>
+#include <string_view>
+#include <thread>
+
+// benches take --name=value arguments, anything not given keeps its default
+class BenchArgs
+{
+public:
+    BenchArgs(int argc, char **argv)
+    {
+        for (int i = 0; i < argc; ++i)
+        {
+            std::string_view a = argv[i];
+            if (a.substr(0, 2) != "--")
+                continue;
+            a.remove_prefix(2);
+            auto eq = a.find('=');
+            if (eq == std::string_view::npos)
+                values_[std::string(a)] = "1";
+            else
+                values_[std::string(a.substr(0, eq))] = std::string(a.substr(eq + 1));
+        }
+    }
+
+    std::uint64_t get(const std::string &name, std::uint64_t def) const
+    {
+        auto it = values_.find(name);
+        return it == values_.end() ? def : std::stoull(it->second);
+    }
+
+    std::string get(const std::string &name, const std::string &def) const
+    {
+        auto it = values_.find(name);
+        return it == values_.end() ? def : it->second;
+    }
+
+private:
+    std::map<std::string, std::string> values_;
+};
+
+using BenchClock = std::chrono::steady_clock;
+
+inline double elapsed_ms(BenchClock::time_point since)
+{
+    return std::chrono::duration<double, std::milli>(BenchClock::now() - since).count();
+}
+
+inline std::uint64_t now_us()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(BenchClock::now().time_since_epoch()).count();
+}
+
+// polls until done() or the timeout, false on timeout
+template <class Pred>
+bool wait_until(Pred done, std::chrono::milliseconds timeout)
+{
+    auto deadline = BenchClock::now() + timeout;
+    while (!done())
+    {
+        if (BenchClock::now() > deadline)
+            return false;
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    return true;
+}
+
+// feed results in here so the optimizer cannot drop the work that made them
+inline void keep(std::uint64_t value)
+{
+    static volatile std::uint64_t sink;
+    sink = sink + value;
+}
+
+// one per bench, registered in main.cpp
+int loopback_bench(const BenchArgs &args);
+int wire_bench(const BenchArgs &args);
+int registry_bench(const BenchArgs &args);
+int handshake_bench(const BenchArgs &args);
+int startup_bench(const BenchArgs &args);
+int inbound_bench(const BenchArgs &args);
+int relay_bench(const BenchArgs &args);
+int sync_bench(const BenchArgs &args);
+int snapshot_bench(const BenchArgs &args);
+int bulk_bench(const BenchArgs &args);
+int journal_bench(const BenchArgs &args);
+int history_bench(const BenchArgs &args);
+int memory_bench(const BenchArgs &args);
+int cold_bench(const BenchArgs &args);
+int redial_bench(const BenchArgs &args);
@@ -0,0 +1,104 @@
+#include "pch.h"
+#include "Bench.h"
+#include "NetworkEngine.h"
+
+// chat while a big sync answer is on its way. each round sends one bulk payload to the peer
+// and then chat lines a couple of ms apart, which stamp their send time. once with bulk sent
+// whole, as before MessageClass::Bulk, once cut into bulk_chunk_bytes pieces
+namespace
+{
+    struct Result
+    {
+        LatencySnapshot chat;
+        std::size_t lines = 0;
+        double bulk_ms = 0;
+        NetworkStats stats;
+    };
+
+    Result run(std::size_t chunk, std::size_t rounds, std::size_t bulk_bytes, std::size_t lines,
+               std::chrono::milliseconds gap, int port)
+    {
+        NetworkOptions o;
+        o.io_threads = 2;
+        o.ping_interval = std::chrono::milliseconds(0);
+        o.enable_deflate = false;
+        o.bulk_chunk_bytes = chunk;
+
+        auto tx = std::make_shared<NetworkEngine>(o);
+        auto rx = std::make_shared<NetworkEngine>(o);
+        LatencyHistogram latency;
+        std::atomic<std::size_t> chat{0}, bulk{0};
+        std::atomic<std::uint64_t> session{0};
+        tx->setSessionCallback([&](std::uint64_t id, std::uint64_t) { session = id; });
+        rx->setUiCallback([&](const RxMessage &m)
+                          {
+                              if (m.size() >= bulk_bytes)
+                              {
+                                  bulk++;
+                                  return;
+                              }
+                              std::uint64_t sent = 0;
+                              std::from_chars(m.data(), m.data() + 20, sent);
+                              latency.record(now_us() - sent);
+                              chat++; });
+        tx->start();
+        rx->start();
+        tx->waitForCertificate();
+        rx->waitForCertificate();
+        tx->startListening(port);
+        rx->addPersistentPeer("127.0.0.1", port);
+        wait_until([&] { return session.load() != 0; }, std::chrono::seconds(10));
+
+        std::string pad(44, 'c');
+        auto t0 = BenchClock::now();
+        for (std::size_t r = 0; r < rounds; ++r)
+        {
+            tx->sendTo(session, std::string(bulk_bytes, 'h'), MessageClass::Bulk);
+            for (std::size_t i = 0; i < lines; ++i)
+            {
+                char head[24];
+                std::snprintf(head, sizeof(head), "%020llu", (unsigned long long)now_us());
+                tx->broadcast(std::string(head) + pad);
+                std::this_thread::sleep_for(gap);
+            }
+            wait_until([&] { return bulk.load() > r; }, std::chrono::seconds(30));
+        }
+
+        Result res;
+        res.bulk_ms = elapsed_ms(t0);
+        wait_until([&] { return chat.load() >= rounds * lines; }, std::chrono::seconds(5));
+        res.lines = chat.load();
+        res.chat = latency.snapshot();
+        res.stats = tx->getStats();
+
+        tx->clearCallbacks();
+        rx->clearCallbacks();
+        rx->stop();
+        tx->stop();
+        return res;
+    }
+}
+
+int bulk_bench(const BenchArgs &args)
+{
+    std::size_t rounds = args.get("rounds", 3);
+    std::size_t bulk_bytes = args.get("bulk-mb", 6) * 1024 * 1024;
+    std::size_t lines = args.get("lines", 40);
+    std::chrono::milliseconds gap(args.get("gap-ms", 2));
+    std::size_t chunk = args.get("chunk", 16 * 1024);
+    int port = static_cast<int>(args.get("port", 19900));
+
+    std::printf("%zu rounds of one %zu MB bulk send with %zu chat lines %lld ms apart, %u hardware threads\n\n",
+                rounds, bulk_bytes >> 20, lines, (long long)gap.count(), std::thread::hardware_concurrency());
+    std::printf("bulk           lines   chat p50 us   chat p99 us   queue p99 us   bulk ms   chunks\n");
+    for (std::size_t c : {std::size_t(0), chunk})
+    {
+        Result r = run(c, rounds, bulk_bytes, lines, gap, port++);
+        std::string name = c ? std::to_string(c / 1024) + " KB chunks" : "whole";
+        std::printf("%-13s  %5zu  %12llu  %12llu  %13llu  %8.0f  %7llu\n", name.c_str(), r.lines,
+                    (unsigned long long)r.chat.p50_us, (unsigned long long)r.chat.p99_us,
+                    (unsigned long long)r.stats.chat_queue_delay.p99_us, r.bulk_ms,
+                    (unsigned long long)r.stats.bulk_chunks);
+    }
+    return 0;
+}
@@ -0,0 +1,230 @@
+#include "pch.h"
+#include "Bench.h"
+#include "ChatHistory.h"
+#include "ChatJournal.h"
+#include "ColdHistory.h"
+#include "GlobalNetwork.h"
+#include <random>
+
+// a long session through the hot window into cold segments, then what reading it back costs:
+// 100-message pages at random positions right after a reopen and again once mapped, lookups
+// by time and by id, a scan of everything, the same session replayed after a restart, a torn
+// segment. senders get random 64-bit ids like real peers, small ones hid a header offset bug once.
+// --dir picks the folder, its segments are deleted first
+namespace
+{
+    struct Session
+    {
+        std::vector<std::string> nicks;
+        std::vector<std::uint64_t> ids;
+
+        Session()
+        {
+            std::mt19937_64 rng(1);
+            for (int i = 0; i < 60; ++i)
+            {
+                nicks.push_back("player_" + std::to_string(i * 37));
+                ids.push_back(rng());
+            }
+        }
+
+        // the same messages every run, a few late like sync backfill
+        void play(std::uint64_t count, ChatHistory &hot) const
+        {
+            std::mt19937_64 rng(2);
+            std::string text;
+            for (std::uint64_t i = 0; i < count; ++i)
+            {
+                text = "message " + std::to_string(i) + std::string(rng() % 60, 'x');
+                ChatMessage m{nicks[i % 60], text, false, ids[i % 60], i / 60 + 1, (i + 1) << 16};
+                if (i % 50 == 0 && i > 10)
+                    m.hlc -= 5 << 16;
+                hot.insert(m);
+            }
+        }
+    };
+
+    void delete_segments(const std::wstring &dir)
+    {
+        WIN32_FIND_DATAW fd;
+        HANDLE find = FindFirstFileW((dir + L"\\seg-*.seg").c_str(), &fd);
+        if (find == INVALID_HANDLE_VALUE)
+            return;
+        do
+            DeleteFileW((dir + L"\\" + fd.cFileName).c_str());
+        while (FindNextFileW(find, &fd));
+        FindClose(find);
+    }
+
+    // cuts the newest segment in half, what a crash mid-seal would leave without the flush
+    std::size_t tear_last_segment(const std::wstring &dir)
+    {
+        std::vector<std::wstring> files;
+        WIN32_FIND_DATAW fd;
+        HANDLE find = FindFirstFileW((dir + L"\\seg-*.seg").c_str(), &fd);
+        if (find == INVALID_HANDLE_VALUE)
+            return 0;
+        do
+            files.push_back(fd.cFileName);
+        while (FindNextFileW(find, &fd));
+        FindClose(find);
+        std::sort(files.begin(), files.end());
+
+        HANDLE h = CreateFileW((dir + L"\\" + files.back()).c_str(), GENERIC_READ | GENERIC_WRITE, 0, nullptr,
+                               OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (h != INVALID_HANDLE_VALUE)
+        {
+            LARGE_INTEGER size{};
+            GetFileSizeEx(h, &size);
+            size.QuadPart /= 2;
+            SetFilePointerEx(h, size, nullptr, FILE_BEGIN);
+            SetEndOfFile(h);
+            CloseHandle(h);
+        }
+        return files.size();
+    }
+
+    double pct(std::vector<double> v, double p)
+    {
+        std::sort(v.begin(), v.end());
+        return v.empty() ? 0 : v[static_cast<std::size_t>(p * (v.size() - 1))];
+    }
+}
+
+int cold_bench(const BenchArgs &args)
+{
+    std::uint64_t count = args.get("messages", 1000000);
+    std::size_t window = args.get("window", 1000);
+    std::size_t pages = args.get("pages", 200);
+    std::string arg = args.get("dir", std::string());
+    std::wstring dir = arg.empty() ? ChatJournal::data_dir() + L"\\bench-cold" : StringToWString(arg);
+    CreateDirectoryW(dir.c_str(), nullptr);
+    delete_segments(dir);
+    Session session;
+    std::mt19937_64 rng(3);
+
+    {
+        ColdHistory cold;
+        cold.open(dir);
+        ChatHistory hot(window);
+        hot.set_spill([&](const ChatMessage &m) { cold.spill(m); });
+        auto t0 = BenchClock::now();
+        session.play(count, hot);
+        double ms = elapsed_ms(t0);
+        ColdStats s = cold.stats();
+        std::printf("%llu messages through a %zu message window: %.0f ms, %llu spilled, %llu segments\n",
+                    (unsigned long long)count, window, ms, (unsigned long long)s.spilled,
+                    (unsigned long long)s.segments);
+    }
+
+    ColdHistory cold;
+    auto t0 = BenchClock::now();
+    cold.open(dir);
+    std::printf("reopen: %llu messages in %llu segments, %.0f us\n", (unsigned long long)cold.size(),
+                (unsigned long long)cold.stats().segments, elapsed_ms(t0) * 1000);
+
+    // every 20 pages the store is reopened so the next page maps its segment again
+    std::vector<double> first, mapped;
+    std::size_t short_reads = 0;
+    for (std::size_t k = 0; k < pages; ++k)
+    {
+        if (k % 20 == 0)
+        {
+            cold.close();
+            cold.open(dir);
+        }
+        std::uint64_t pos = rng() % (cold.size() - 100);
+        std::size_t bytes = 0;
+        auto visit = [&](const ChatMessage &m, std::string_view) { bytes += m.text.size(); };
+        auto a = BenchClock::now();
+        if (cold.read(pos, 100, visit) != 100)
+            short_reads++;
+        first.push_back(elapsed_ms(a) * 1000);
+        a = BenchClock::now();
+        cold.read(pos, 100, visit);
+        mapped.push_back(elapsed_ms(a) * 1000);
+        keep(bytes);
+    }
+    ColdStats s = cold.stats();
+    std::printf("page of 100, first read: p50 %.0f us, p99 %.0f us; mapped: p50 %.1f us, p99 %.1f us\n",
+                pct(first, .5), pct(first, .99), pct(mapped, .5), pct(mapped, .99));
+    std::printf("  %llu page-ins, %llu segments mapped, %zu short reads\n", (unsigned long long)s.page_ins,
+                (unsigned long long)s.mapped_segments, short_reads);
+
+    std::vector<double> lookups;
+    std::size_t wrong = 0;
+    for (int k = 0; k < 1000; ++k)
+    {
+        std::uint64_t hlc = (1 + rng() % count) << 16;
+        auto a = BenchClock::now();
+        std::uint64_t p = cold.lower_bound(hlc);
+        lookups.push_back(elapsed_ms(a) * 1000);
+        std::uint64_t at = 0, before = 0;
+        if (p < cold.size())
+            cold.read(p, 1, [&](const ChatMessage &m, std::string_view) { at = m.hlc; });
+        if (p > 0)
+            cold.read(p - 1, 1, [&](const ChatMessage &m, std::string_view) { before = m.hlc; });
+        if ((p < cold.size() && at < hlc) || (p > 0 && before >= hlc))
+            wrong++;
+    }
+    std::printf("lookup by time: p50 %.1f us, p99 %.1f us, %zu wrong\n", pct(lookups, .5), pct(lookups, .99), wrong);
+
+    // by (sender, seq): held ids at random positions must come back at that position, ids
+    // nobody sent must come back as size(). the sender tables decide how many segments get searched
+    std::vector<double> hits, misses;
+    wrong = 0;
+    ColdStats before = cold.stats();
+    for (int k = 0; k < 1000; ++k)
+    {
+        std::uint64_t p = rng() % cold.size();
+        std::uint64_t sender = 0, seq = 0;
+        cold.read(p, 1, [&](const ChatMessage &m, std::string_view)
+                  {
+                      sender = m.senderId;
+                      seq = m.seq; });
+        auto a = BenchClock::now();
+        if (cold.find(sender, seq) != p)
+            wrong++;
+        hits.push_back(elapsed_ms(a) * 1000);
+        a = BenchClock::now();
+        if (cold.find(session.ids[k % 60], count + k) != cold.size())
+            wrong++;
+        misses.push_back(elapsed_ms(a) * 1000);
+    }
+    ColdStats after = cold.stats();
+    std::printf("lookup by id: hit p50 %.0f us, p99 %.0f us; miss p50 %.1f us, p99 %.1f us; %zu wrong\n",
+                pct(hits, .5), pct(hits, .99), pct(misses, .5), pct(misses, .99), wrong);
+    std::printf("  %.2f segments searched and %.1f skipped by their sender table per lookup\n",
+                (after.id_searches - before.id_searches) / 2000.0, (after.id_skips - before.id_skips) / 2000.0);
+
+    std::uint64_t scanned = 0, last = 0;
+    bool ordered = true;
+    t0 = BenchClock::now();
+    for (std::uint64_t p = 0; p < cold.size(); p += 4096)
+        scanned += cold.read(p, 4096, [&](const ChatMessage &m, std::string_view)
+                             {
+                                 ordered = ordered && m.hlc >= last;
+                                 last = m.hlc; });
+    std::printf("full scan: %llu messages in %.0f ms, in order %s\n", (unsigned long long)scanned, elapsed_ms(t0),
+                ordered ? "yes" : "no");
+    cold.close();
+
+    {
+        // the journal replays the same messages on every start, the cold store must skip them
+        ColdHistory again;
+        again.open(dir);
+        std::uint64_t before = again.size();
+        ChatHistory hot(window);
+        hot.set_spill([&](const ChatMessage &m) { again.spill(m); });
+        session.play(count, hot);
+        std::printf("replay after restart: size %llu -> %llu, skipped %llu\n", (unsigned long long)before,
+                    (unsigned long long)again.size(), (unsigned long long)again.stats().skipped);
+    }
+
+    std::size_t files = tear_last_segment(dir);
+    ColdHistory torn;
+    torn.open(dir);
+    std::printf("torn last segment: %zu files -> %llu segments, %llu messages\n", files,
+                (unsigned long long)torn.stats().segments, (unsigned long long)torn.size());
+    return 0;
+}
@@ -0,0 +1,113 @@
+#include "pch.h"
+#include "Bench.h"
+#include "NetworkEngine.h"
+
+// reconnects after a drop, the case session resumption is for. the server cuts the client off
+// as a slow consumer by overrunning a tiny write queue, the client's connector redials, and
+// every redial after the first should offer the session it got last time. then the client
+// streams chat to see what each tls profile costs per write
+namespace
+{
+    NetworkOptions bench_options(TlsProfile profile)
+    {
+        NetworkOptions o;
+        o.io_threads = 1;
+        o.ping_interval = std::chrono::milliseconds(0);
+        o.enable_deflate = false;
+        o.reconnect_min_delay = std::chrono::milliseconds(5);
+        o.reconnect_max_delay = std::chrono::milliseconds(50);
+        o.tls_profile = profile;
+        return o;
+    }
+
+    struct Row
+    {
+        NetworkStats stats;
+        PeerStats peer;
+        double write_us_per_msg = 0;
+        bool complete = true;
+    };
+
+    Row run_profile(TlsProfile profile, std::size_t drops, std::size_t messages, int port)
+    {
+        NetworkOptions server_opts = bench_options(profile);
+        server_opts.queue_policy = QueueOverflowPolicy::DisconnectSlowConsumer;
+        server_opts.max_queue_messages = 4;
+
+        Row row;
+        std::atomic<std::size_t> sessions{0};
+        std::atomic<std::size_t> received{0};
+        auto server = std::make_shared<NetworkEngine>(server_opts);
+        auto client = std::make_shared<NetworkEngine>(bench_options(profile));
+        server->setSessionCallback([&](std::uint64_t, std::uint64_t) { sessions++; });
+        server->setUiCallback([&](const RxMessage &) { received++; });
+        server->start();
+        client->start();
+        server->waitForCertificate();
+        client->waitForCertificate();
+        server->startListening(port);
+        client->addPersistentPeer("127.0.0.1", port);
+
+        row.complete = wait_until([&] { return sessions.load() == 1; }, std::chrono::seconds(10));
+        std::string payload(1024, 'x');
+        for (std::size_t i = 0; i < drops && row.complete; ++i)
+        {
+            std::size_t before = sessions.load();
+            // far more than the queue holds in one go, so the session is closed before it drains
+            while (server->getStats().slow_consumer_disconnects <= i)
+            {
+                for (int k = 0; k < 64; ++k)
+                    server->broadcast(payload);
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+            row.complete = wait_until([&] { return sessions.load() > before; }, std::chrono::seconds(10));
+        }
+        row.stats = server->getStats();
+
+        // one chat line at a time, so each write is one record and not a coalesced batch
+        std::string line(80, 'z');
+        std::size_t base = received.load();
+        for (std::size_t i = 0; i < messages && row.complete; ++i)
+        {
+            client->broadcast(line);
+            row.complete = wait_until([&] { return received.load() > base + i; }, std::chrono::seconds(10));
+        }
+        auto peers = client->getPeerStats();
+        if (!peers.empty())
+        {
+            row.peer = peers.front();
+            if (row.peer.messages_out)
+                row.write_us_per_msg = double(row.peer.write_cpu_us) / row.peer.messages_out;
+        }
+
+        server->clearCallbacks();
+        client->stop();
+        server->stop();
+        return row;
+    }
+}
+
+int handshake_bench(const BenchArgs &args)
+{
+    std::size_t drops = args.get("drops", 20);
+    std::size_t messages = args.get("messages", 2000);
+    int port = static_cast<int>(args.get("port", 19500));
+    std::string only = args.get("profile", std::string());
+
+    std::printf("%zu forced drops and redials per profile, then %zu 80-byte lines one by one, aes-ni %s\n\n",
+                drops, messages, TlsHelper::cpu_has_aes_ni() ? "yes" : "no");
+    std::printf("profile     version  cipher                         full p50   resumed p50 (n)   write us/msg\n");
+    for (TlsProfile profile : {TlsProfile::Tls12, TlsProfile::Tls12Or13, TlsProfile::Tls13Only})
+    {
+        if (!only.empty() && only != TlsHelper::profile_name(profile))
+            continue;
+        Row r = run_profile(profile, drops, messages, port++);
+        std::printf("%-10s  %-7s  %-29s  %6llu us  %7llu us (%3llu)  %13.1f%s\n", TlsHelper::profile_name(profile),
+                    r.peer.tls_version ? r.peer.tls_version : "-", r.peer.tls_cipher ? r.peer.tls_cipher : "-",
+                    (unsigned long long)r.stats.tls_full_handshake.p50_us,
+                    (unsigned long long)r.stats.tls_resumed_handshake.p50_us,
+                    (unsigned long long)r.stats.tls_resumed_handshakes, r.write_us_per_msg,
+                    r.complete ? "" : "  (timed out)");
+    }
+    return 0;
+}
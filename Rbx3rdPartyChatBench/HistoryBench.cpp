@@ -0,0 +1,208 @@
+#include "pch.h"
+#include "Bench.h"
+#include "ChatHistory.h"
+#include <random>
+
+// inserts into a full history, the ring against the stores it replaced: the vector trimmed
+// with erase(begin()) and the deque ChatHistory kept before the ring. those held messages with
+// wstring name and text, so they get theirs built up front like the ring gets utf-8 views.
+// then a check that ring and deque agree on every insert under random late arrivals
+namespace
+{
+    struct OldMessage
+    {
+        std::wstring name;
+        std::wstring text;
+        bool isMine = false;
+        std::uint64_t senderId = 0;
+        std::uint64_t seq = 0;
+        std::uint64_t hlc = 0;
+    };
+
+    bool before(const OldMessage &a, const OldMessage &b)
+    {
+        if (a.hlc != b.hlc)
+            return a.hlc < b.hlc;
+        if (a.senderId != b.senderId)
+            return a.senderId < b.senderId;
+        return a.seq < b.seq;
+    }
+
+    class VectorHistory
+    {
+    public:
+        explicit VectorHistory(std::size_t capacity) : capacity_(capacity) {}
+
+        bool insert(OldMessage &&m)
+        {
+            messages_.push_back(std::move(m));
+            if (messages_.size() > capacity_)
+                messages_.erase(messages_.begin());
+            return true;
+        }
+        std::size_t size() const { return messages_.size(); }
+
+    private:
+        std::size_t capacity_;
+        std::vector<OldMessage> messages_;
+    };
+
+    class DequeHistory
+    {
+    public:
+        explicit DequeHistory(std::size_t capacity) : capacity_(capacity) { ids_.reserve(capacity); }
+
+        bool insert(OldMessage &&msg)
+        {
+            if (messages_.size() >= capacity_ && before(msg, messages_.front()))
+                return false;
+            if (!ids_.insert({msg.senderId, msg.seq}).second)
+                return false;
+            auto &high = high_[msg.senderId];
+            high = std::max(high, msg.seq);
+
+            if (messages_.empty() || !before(msg, messages_.back()))
+            {
+                messages_.push_back(std::move(msg));
+            }
+            else
+            {
+                messages_.insert(std::upper_bound(messages_.begin(), messages_.end(), msg, before), std::move(msg));
+                ++reorders_;
+            }
+            while (messages_.size() > capacity_)
+            {
+                ids_.erase({messages_.front().senderId, messages_.front().seq});
+                messages_.pop_front();
+                ++evicted_;
+            }
+            return true;
+        }
+
+        std::size_t size() const { return messages_.size(); }
+        const OldMessage &operator[](std::size_t i) const { return messages_[i]; }
+        std::uint64_t evicted() const { return evicted_; }
+        std::uint64_t reorders() const { return reorders_; }
+
+    private:
+        std::size_t capacity_;
+        std::deque<OldMessage> messages_;
+        std::unordered_set<MessageKey, MessageKeyHash> ids_;
+        std::unordered_map<std::uint64_t, std::uint64_t> high_;
+        std::uint64_t evicted_ = 0;
+        std::uint64_t reorders_ = 0;
+    };
+
+    struct Utf8Message
+    {
+        std::string name;
+        std::string text;
+        std::uint64_t senderId = 0;
+        std::uint64_t seq = 0;
+        std::uint64_t hlc = 0;
+
+        ChatMessage view() const { return {name, text, false, senderId, seq, hlc}; }
+    };
+
+    Utf8Message make(std::uint64_t i, std::uint64_t hlc)
+    {
+        return {"player" + std::to_string(i % 16), "message number " + std::to_string(i) + " with a bit of text to look real",
+                1000 + i % 16, i + 1, hlc};
+    }
+
+    OldMessage widen(const Utf8Message &m)
+    {
+        return {std::wstring(m.name.begin(), m.name.end()), std::wstring(m.text.begin(), m.text.end()), false,
+                m.senderId, m.seq, m.hlc};
+    }
+
+    // ns per insert once the store is full. late_pct of the messages come a few places late
+    template <class Store>
+    double run(std::size_t capacity, std::size_t inserts, std::size_t late_pct)
+    {
+        constexpr bool ring = std::is_same_v<Store, ChatHistory>;
+        std::vector<Utf8Message> utf8;
+        std::vector<OldMessage> old;
+        for (std::size_t i = 0; i < capacity + inserts; ++i)
+        {
+            std::uint64_t hlc = (i + 1) << 16;
+            if (late_pct && i % 100 < late_pct && i > 8)
+                hlc = (i - 5) << 16 | 1;
+            Utf8Message m = make(i, hlc);
+            if (ring)
+                utf8.push_back(std::move(m));
+            else
+                old.push_back(widen(m));
+        }
+
+        Store store(capacity);
+        auto insert = [&](std::size_t i)
+        {
+            if constexpr (ring)
+                store.insert(utf8[i].view());
+            else
+                store.insert(std::move(old[i]));
+        };
+        for (std::size_t i = 0; i < capacity; ++i)
+            insert(i);
+        auto t0 = BenchClock::now();
+        for (std::size_t i = capacity; i < capacity + inserts; ++i)
+            insert(i);
+        double ns = elapsed_ms(t0) * 1e6 / inserts;
+        keep(store.size());
+        return ns;
+    }
+
+    bool check(std::size_t inserts)
+    {
+        std::mt19937_64 rng(7);
+        ChatHistory ring(500);
+        DequeHistory deque(500);
+        for (std::uint64_t i = 0; i < inserts; ++i)
+        {
+            std::uint64_t hlc = ((i + 1) << 16) - (rng() % 4 == 0 ? (rng() % 300) << 16 : 0);
+            Utf8Message m = make(rng() % 400000, hlc);
+            bool a = ring.insert(m.view());
+            bool b = deque.insert(widen(m));
+            if (a != b || ring.size() != deque.size() || ring.evicted() != deque.evicted() ||
+                ring.reorders() != deque.reorders())
+                return false;
+        }
+        for (std::size_t i = 0; i < ring.size(); ++i)
+            if (ring[i].seq != deque[i].seq || ring[i].hlc != deque[i].hlc)
+                return false;
+
+        // shrinking keeps the newest
+        ring.set_capacity(100);
+        for (std::size_t i = 0; i < 100; ++i)
+            if (ring[i].seq != deque[deque.size() - 100 + i].seq)
+                return false;
+        return true;
+    }
+}
+
+int history_bench(const BenchArgs &args)
+{
+    std::size_t inserts = args.get("inserts", 200000);
+    // erase(begin()) moves the whole store per insert, keep its runs short
+    std::size_t vector_work = args.get("vector-work", 200000000);
+
+    std::printf("ns per insert into a full history, %zu inserts (vector fewer)\n\n", inserts);
+    std::printf("capacity  late   vector erase      deque       ring\n");
+    for (std::size_t capacity : {std::size_t(1000), std::size_t(10000), std::size_t(100000)})
+    {
+        for (std::size_t late : {std::size_t(0), std::size_t(5)})
+        {
+            std::printf("%8zu  %3zu%%", capacity, late);
+            if (late)
+                std::printf("  %13s", "-");
+            else
+                std::printf("  %13.0f", run<VectorHistory>(capacity, std::min(inserts, vector_work / capacity), 0));
+            std::printf("  %9.0f  %9.0f\n", run<DequeHistory>(capacity, inserts, late),
+                        run<ChatHistory>(capacity, inserts, late));
+        }
+    }
+    std::printf("\nring matches deque over %zu random inserts and a shrink: %s\n", inserts,
+                check(inserts) ? "yes" : "no");
+    return 0;
+}
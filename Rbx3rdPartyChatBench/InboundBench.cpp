@@ -0,0 +1,123 @@
+#include "pch.h"
+#include "Bench.h"
+#include "NetworkEngine.h"
+#include <condition_variable>
+
+// io threads handing received lines to a consumer thread, the way the chat window gets them.
+// the consumer sleeps on a condition variable that stands in for the window's message queue.
+// callback: one handoff per message, as setUiCallback + PostMessageW did.
+// ring: setInboundWake signals once per batch and the consumer drains the ring
+namespace
+{
+    struct Result
+    {
+        std::size_t received = 0;
+        double seconds = 0;
+        std::uint64_t handoffs = 0;
+        NetworkStats stats;
+    };
+
+    Result run(bool ring, std::size_t messages, std::size_t size, int port)
+    {
+        NetworkOptions o;
+        o.io_threads = 2;
+        o.coalesce_writes = true;
+        o.ping_interval = std::chrono::milliseconds(0);
+        o.max_queue_messages = 1 << 20;
+        o.max_queue_bytes = std::size_t(1) << 30;
+        o.inbound_capacity = 1 << 16;
+
+        auto rx = std::make_shared<NetworkEngine>(o);
+        auto tx = std::make_shared<NetworkEngine>(o);
+        std::atomic<std::size_t> got{0};
+        std::atomic<std::uint64_t> handoffs{0};
+        std::mutex m;
+        std::condition_variable cv;
+        bool woke = false;
+        std::atomic<bool> done{false};
+        auto signal = [&]
+        {
+            {
+                std::lock_guard<std::mutex> lock(m);
+                woke = true;
+            }
+            cv.notify_one();
+            handoffs++;
+        };
+
+        std::thread consumer;
+        if (ring)
+        {
+            rx->setInboundWake(signal);
+            consumer = std::thread([&]
+                                   {
+                                       while (!done)
+                                       {
+                                           {
+                                               std::unique_lock<std::mutex> lock(m);
+                                               cv.wait_for(lock, std::chrono::milliseconds(50), [&] { return woke; });
+                                               woke = false;
+                                           }
+                                           rx->drainInbound([&](const RxMessage &) { got++; }, 512);
+                                       } });
+        }
+        else
+        {
+            rx->setUiCallback([&](const RxMessage &)
+                              {
+                                  signal();
+                                  got++; });
+        }
+
+        rx->start();
+        tx->start();
+        rx->waitForCertificate();
+        tx->waitForCertificate();
+        rx->startListening(port);
+        std::atomic<bool> up{false};
+        tx->setSessionCallback([&](std::uint64_t, std::uint64_t) { up = true; });
+        tx->addPersistentPeer("127.0.0.1", port);
+        wait_until([&] { return up.load(); }, std::chrono::seconds(10));
+
+        std::string line(size, 'z');
+        auto t0 = BenchClock::now();
+        for (std::size_t i = 0; i < messages; ++i)
+            tx->broadcast(line);
+        wait_until([&] { return got.load() >= messages; }, std::chrono::seconds(30));
+
+        Result r;
+        r.seconds = elapsed_ms(t0) / 1000.0;
+        r.received = got.load();
+        r.handoffs = handoffs.load();
+        r.stats = rx->getStats();
+
+        done = true;
+        if (consumer.joinable())
+            consumer.join();
+        rx->clearCallbacks();
+        tx->clearCallbacks();
+        tx->stop();
+        rx->stop();
+        return r;
+    }
+}
+
+int inbound_bench(const BenchArgs &args)
+{
+    std::size_t messages = args.get("messages", 200000);
+    std::size_t size = args.get("size", 60);
+    int port = static_cast<int>(args.get("port", 19700));
+
+    std::printf("%zu messages of %zu bytes over loopback, %u hardware threads\n\n", messages, size,
+                std::thread::hardware_concurrency());
+    std::printf("path      received      msg/s   handoffs   msgs/handoff   dropped   rx allocations\n");
+    for (bool ring : {false, true})
+    {
+        Result r = run(ring, messages, size, port++);
+        std::printf("%-8s  %8zu  %9.0f  %9llu  %13.1f  %8llu  %15llu\n", ring ? "ring" : "callback", r.received,
+                    r.received / r.seconds, (unsigned long long)r.handoffs,
+                    r.handoffs ? double(r.received) / r.handoffs : 0.0, (unsigned long long)r.stats.inbound_dropped,
+                    (unsigned long long)r.stats.rx_allocations);
+    }
+    return 0;
+}
@@ -0,0 +1,201 @@
+#include "pch.h"
+#include "Bench.h"
+#include "ChatJournal.h"
+#include "GlobalNetwork.h"
+
+// the history journal on a real file: a flush after every append against group commit, a full
+// recovery checked field by field, a torn tail and a flipped byte, then compaction down to
+// the newest window. --path picks the file, it is deleted first and left behind at the end
+namespace
+{
+    struct Message
+    {
+        std::string name;
+        std::string text;
+        ChatMessage view(std::uint64_t i) const
+        {
+            ChatMessage m;
+            m.name = name;
+            m.text = text;
+            m.isMine = i % 7 == 0;
+            m.senderId = 1000 + i % 16;
+            m.seq = i / 16 + 1;
+            m.hlc = (i + 1) << 16;
+            return m;
+        }
+    };
+
+    Message make(std::uint64_t i)
+    {
+        return {"player" + std::to_string(i % 16),
+                "message number " + std::to_string(i) + " with some text, \xd0\xbf\xd1\x80\xd0\xb8\xd0\xb2\xd0\xb5\xd1\x82"};
+    }
+
+    bool same(const ChatMessage &a, const ChatMessage &b)
+    {
+        return a.name == b.name && a.text == b.text && a.isMine == b.isMine && a.senderId == b.senderId &&
+               a.seq == b.seq && a.hlc == b.hlc;
+    }
+
+    std::uint64_t file_size(const std::wstring &path)
+    {
+        HANDLE h = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING,
+                               FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (h == INVALID_HANDLE_VALUE)
+            return 0;
+        LARGE_INTEGER size{};
+        GetFileSizeEx(h, &size);
+        CloseHandle(h);
+        return static_cast<std::uint64_t>(size.QuadPart);
+    }
+
+    // cut bytes off the end, or with flip set xor one byte that far from the end
+    void damage(const std::wstring &path, std::uint64_t from_end, bool flip)
+    {
+        HANDLE h = CreateFileW(path.c_str(), GENERIC_READ | GENERIC_WRITE, 0, nullptr, OPEN_EXISTING,
+                               FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (h == INVALID_HANDLE_VALUE)
+            return;
+        LARGE_INTEGER size{}, at{};
+        GetFileSizeEx(h, &size);
+        at.QuadPart = size.QuadPart - static_cast<LONGLONG>(from_end);
+        SetFilePointerEx(h, at, nullptr, FILE_BEGIN);
+        if (flip)
+        {
+            char c = 0;
+            DWORD n = 0;
+            ReadFile(h, &c, 1, &n, nullptr);
+            c ^= 0x40;
+            SetFilePointerEx(h, at, nullptr, FILE_BEGIN);
+            WriteFile(h, &c, 1, &n, nullptr);
+        }
+        else
+        {
+            SetEndOfFile(h);
+        }
+        CloseHandle(h);
+    }
+
+    std::uint64_t replay(const std::wstring &path, JournalStats &stats)
+    {
+        ChatJournal j;
+        std::uint64_t n = 0;
+        j.open(path, [&](const ChatMessage &) { ++n; });
+        stats = j.stats();
+        return n;
+    }
+}
+
+int journal_bench(const BenchArgs &args)
+{
+    std::uint64_t count = args.get("messages", 1000000);
+    std::uint64_t flushed = args.get("flushed", 2000);
+    std::uint64_t keep_last = args.get("keep", 1000);
+    std::string arg = args.get("path", std::string());
+    std::wstring path = arg.empty() ? ChatJournal::data_dir() + L"\\bench.journal" : StringToWString(arg);
+    DeleteFileW(path.c_str());
+
+    {
+        ChatJournal j;
+        j.open(path, [](const ChatMessage &) {});
+        auto t0 = BenchClock::now();
+        for (std::uint64_t i = 0; i < flushed; ++i)
+        {
+            Message m = make(i);
+            j.append(m.view(i));
+            j.flush();
+        }
+        double ms = elapsed_ms(t0);
+        std::printf("flush per message: %llu messages in %.1f ms, %.0f msg/s\n", (unsigned long long)flushed, ms,
+                    flushed / ms * 1000);
+    }
+    DeleteFileW(path.c_str());
+
+    std::vector<Message> messages;
+    messages.reserve(count);
+    for (std::uint64_t i = 0; i < count; ++i)
+        messages.push_back(make(i));
+    {
+        ChatJournal j;
+        j.open(path, [](const ChatMessage &) {});
+        double worst = 0;
+        auto t0 = BenchClock::now();
+        for (std::uint64_t i = 0; i < count; ++i)
+        {
+            auto a = BenchClock::now();
+            j.append(messages[i].view(i));
+            worst = std::max(worst, elapsed_ms(a));
+        }
+        double appended = elapsed_ms(t0);
+        j.flush();
+        double durable = elapsed_ms(t0);
+        JournalStats s = j.stats();
+        std::printf("group commit: %llu messages appended in %.1f ms (worst append %.3f ms), durable after %.1f ms, "
+                    "%.0f msg/s\n",
+                    (unsigned long long)count, appended, worst, durable, count / durable * 1000);
+        std::printf("  %llu commits, up to %llu records each, %.1f MB, %llu write errors\n",
+                    (unsigned long long)s.commits, (unsigned long long)s.max_batch_records, s.bytes_written / 1e6,
+                    (unsigned long long)s.write_errors);
+    }
+
+    {
+        ChatJournal j;
+        std::uint64_t got = 0;
+        bool intact = true;
+        j.open(path, [&](const ChatMessage &m)
+               {
+                   intact = intact && got < count && same(m, messages[got].view(got));
+                   ++got; });
+        JournalStats s = j.stats();
+        std::printf("recovery: %llu records of %.1f MB in %.1f ms, intact %s, truncated %llu bytes\n",
+                    (unsigned long long)got, file_size(path) / 1e6, s.recovery_us / 1000.0, intact ? "yes" : "no",
+                    (unsigned long long)s.truncated_bytes);
+    }
+
+    JournalStats s;
+    damage(path, 20, false);
+    std::uint64_t n = replay(path, s);
+    std::printf("torn tail: replayed %llu, truncated %llu bytes\n", (unsigned long long)n,
+                (unsigned long long)s.truncated_bytes);
+    damage(path, 200, true);
+    n = replay(path, s);
+    std::printf("flipped byte near the end: replayed %llu, truncated %llu bytes\n", (unsigned long long)n,
+                (unsigned long long)s.truncated_bytes);
+    n = replay(path, s);
+    std::printf("reopen: replayed %llu, truncated %llu bytes\n", (unsigned long long)n,
+                (unsigned long long)s.truncated_bytes);
+
+    {
+        // what ChatWindow keeps: the newest window. the caller only pays for the snapshot, the
+        // writer does the rewrite, and appends made meanwhile have to land after the snapshot
+        ChatJournal j;
+        j.open(path, [](const ChatMessage &) {});
+        std::uint64_t from = n > keep_last ? n - keep_last : 0;
+        auto t0 = BenchClock::now();
+        bool ok = j.compact([&](const std::function<void(const ChatMessage &)> &emit)
+                            {
+                                for (std::uint64_t i = from; i < n; ++i)
+                                    emit(messages[i].view(i)); });
+        double ms = elapsed_ms(t0);
+        for (std::uint64_t i = n; i < n + 10 && i < count; ++i)
+            j.append(messages[i].view(i));
+        j.flush();
+        JournalStats js = j.stats();
+        std::printf("compact to the newest %llu: %s, caller %.2f ms, writer %.1f ms, dropped %llu records\n",
+                    (unsigned long long)keep_last, ok && js.compactions == 1 ? "ok" : "failed", ms,
+                    js.compaction_us / 1000.0, (unsigned long long)js.compacted_records);
+    }
+    std::uint64_t expect = n > keep_last ? n - keep_last : 0;
+    bool ordered = true;
+    {
+        ChatJournal j;
+        j.open(path, [&](const ChatMessage &m)
+               { ordered = ordered && expect < count && same(m, messages[expect].view(expect));
+                 ++expect; });
+        s = j.stats();
+    }
+    n = s.recovered_records;
+    std::printf("reopen after compaction: replayed %llu of %.1f KB in %.1f ms, in order %s\n", (unsigned long long)n,
+                file_size(path) / 1024.0, s.recovery_us / 1000.0, ordered ? "yes" : "no");
+    return 0;
+}
@@ -0,0 +1,115 @@
+#include "pch.h"
+#include "Bench.h"
+#include "NetworkEngine.h"
+
+// one engine with 1..n io threads against a crowd of single-threaded client engines on
+// loopback. the clients all dial at once like a group coming back after an outage, then
+// stream chat at the server and take its fan-out. only the server's thread count changes,
+// so on a machine with fewer cores than engines the client side caps the numbers
+namespace
+{
+    NetworkOptions bench_options(std::size_t io_threads)
+    {
+        NetworkOptions o;
+        o.io_threads = io_threads;
+        o.ping_interval = std::chrono::milliseconds(0);
+        o.enable_deflate = false;
+        o.max_queue_messages = 1 << 20;
+        o.max_queue_bytes = std::size_t(1) << 30;
+        return o;
+    }
+
+    struct Row
+    {
+        double handshake_ms = 0;
+        LatencySnapshot handshake;
+        double inbound_per_s = 0;
+        double fanout_per_s = 0;
+        bool complete = true;
+    };
+
+    Row run_once(std::size_t threads, std::size_t clients, std::size_t messages, std::size_t size, int port)
+    {
+        Row row;
+        std::atomic<std::size_t> sessions{0};
+        std::atomic<std::size_t> server_got{0};
+        std::atomic<std::size_t> clients_got{0};
+
+        auto server = std::make_shared<NetworkEngine>(bench_options(threads));
+        server->setSessionCallback([&](std::uint64_t, std::uint64_t) { sessions++; });
+        server->setUiCallback([&](const RxMessage &) { server_got++; });
+        server->start();
+        server->startListening(port);
+
+        std::vector<std::shared_ptr<NetworkEngine>> peers;
+        for (std::size_t i = 0; i < clients; ++i)
+        {
+            auto c = std::make_shared<NetworkEngine>(bench_options(1));
+            c->setUiCallback([&](const RxMessage &) { clients_got++; });
+            c->start();
+            peers.push_back(c);
+        }
+        // keygen is a startup cost, not what is measured here
+        server->waitForCertificate();
+        for (auto &c : peers)
+            c->waitForCertificate();
+
+        auto t0 = BenchClock::now();
+        for (auto &c : peers)
+            c->addPersistentPeer("127.0.0.1", port);
+        row.complete &= wait_until([&] { return sessions.load() == clients; }, std::chrono::seconds(30));
+        row.handshake_ms = elapsed_ms(t0);
+        row.handshake = server->getStats().tls_full_handshake;
+
+        std::string payload(size, 'x');
+        std::size_t per_client = std::max<std::size_t>(messages / clients, 1);
+        std::size_t inbound_total = per_client * clients;
+        t0 = BenchClock::now();
+        std::vector<std::thread> senders;
+        for (auto &c : peers)
+            senders.emplace_back([&, c] {
+                for (std::size_t i = 0; i < per_client; ++i)
+                    c->broadcast(payload);
+            });
+        for (auto &s : senders)
+            s.join();
+        row.complete &= wait_until([&] { return server_got.load() >= inbound_total; }, std::chrono::seconds(60));
+        row.inbound_per_s = server_got.load() / (elapsed_ms(t0) / 1000.0);
+
+        std::size_t fanout_total = messages * clients;
+        t0 = BenchClock::now();
+        for (std::size_t i = 0; i < messages; ++i)
+            server->broadcast(payload);
+        row.complete &= wait_until([&] { return clients_got.load() >= fanout_total; }, std::chrono::seconds(60));
+        row.fanout_per_s = clients_got.load() / (elapsed_ms(t0) / 1000.0);
+
+        server->clearCallbacks();
+        for (auto &c : peers)
+            c->clearCallbacks();
+        for (auto &c : peers)
+            c->stop();
+        server->stop();
+        return row;
+    }
+}
+
+int loopback_bench(const BenchArgs &args)
+{
+    std::size_t max_threads = args.get("max-threads", 4);
+    std::size_t clients = args.get("clients", 16);
+    std::size_t messages = args.get("messages", 20000);
+    std::size_t size = args.get("size", 80);
+    int port = static_cast<int>(args.get("port", 19400));
+
+    std::printf("%zu clients, %zu messages of %zu bytes each way, %u hardware threads\n\n", clients, messages, size,
+                std::thread::hardware_concurrency());
+    std::printf("threads  all handshakes  handshake p50/p99      inbound msg/s  fan-out msg/s\n");
+    for (std::size_t t = 1; t <= max_threads; ++t)
+    {
+        Row r = run_once(t, clients, messages, size, port + static_cast<int>(t));
+        std::printf("%7zu  %11.1f ms  %7llu / %7llu us  %13.0f  %13.0f%s\n", t, r.handshake_ms,
+                    (unsigned long long)r.handshake.p50_us, (unsigned long long)r.handshake.p99_us,
+                    r.inbound_per_s, r.fanout_per_s, r.complete ? "" : "  (timed out)");
+    }
+    return 0;
+}
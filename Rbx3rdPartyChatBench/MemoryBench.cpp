@@ -0,0 +1,215 @@
+#include "pch.h"
+#include "Bench.h"
+#include "ChatHistory.h"
+#include "GlobalNetwork.h"
+#include <new>
+#include <random>
+
+// heap per message of a full history, counted by replacing global new/delete. this replaces
+// them for the whole bench binary, the counters are relaxed atomics so other benches barely
+// notice. before is the deque of messages with two utf-16 strings each, u16string has the
+// layout and small string buffer of msvc's wstring so the numbers carry over
+namespace
+{
+    std::atomic<std::int64_t> live_bytes{0};
+    std::atomic<std::int64_t> live_blocks{0};
+
+    // the requested size sits in front of the block so delete can take it off again
+    constexpr std::size_t HEADER = alignof(std::max_align_t);
+
+    void *counted_alloc(std::size_t n)
+    {
+        void *p = std::malloc(n + HEADER);
+        if (!p)
+            throw std::bad_alloc();
+        *static_cast<std::size_t *>(p) = n;
+        live_bytes.fetch_add(static_cast<std::int64_t>(n), std::memory_order_relaxed);
+        live_blocks.fetch_add(1, std::memory_order_relaxed);
+        return static_cast<char *>(p) + HEADER;
+    }
+
+    void counted_free(void *p)
+    {
+        if (!p)
+            return;
+        void *base = static_cast<char *>(p) - HEADER;
+        live_bytes.fetch_sub(static_cast<std::int64_t>(*static_cast<std::size_t *>(base)), std::memory_order_relaxed);
+        live_blocks.fetch_sub(1, std::memory_order_relaxed);
+        std::free(base);
+    }
+
+    // 60 nicks with a few chatty ones, 1-12 words a line, every fifth line cyrillic
+    struct ChatGen
+    {
+        std::mt19937_64 rng{42};
+        std::vector<std::string> nicks;
+
+        ChatGen()
+        {
+            const char *base[] = {"xX_Slayer", "noob", "builderman", "Guest", "Kitty",
+                                  "ProGamer", "vanya", "masha_cool", "Shadow", "Zed"};
+            for (int i = 0; i < 60; ++i)
+                nicks.push_back(std::string(base[i % 10]) + std::to_string(1000 + i * 37));
+        }
+
+        std::string nick()
+        {
+            std::size_t r = rng() % 100;
+            return nicks[r < 50 ? r % 6 : rng() % nicks.size()];
+        }
+
+        std::string text()
+        {
+            static const char *words[] = {"lol", "gg", "anyone", "trade", "me", "pls", "where", "is", "the", "obby",
+                                          "wait", "brb", "ok", "nice", "how", "do", "you", "get", "that", "hat"};
+            // privet, kto, igraet, da, net, spasibo
+            static const char *ru[] = {"\xd0\xbf\xd1\x80\xd0\xb8\xd0\xb2\xd0\xb5\xd1\x82", "\xd0\xba\xd1\x82\xd0\xbe",
+                                       "\xd0\xb8\xd0\xb3\xd1\x80\xd0\xb0\xd0\xb5\xd1\x82", "\xd0\xb4\xd0\xb0",
+                                       "\xd0\xbd\xd0\xb5\xd1\x82",
+                                       "\xd1\x81\xd0\xbf\xd0\xb0\xd1\x81\xd0\xb8\xd0\xb1\xd0\xbe"};
+            std::size_t n = 1 + rng() % 12;
+            bool cyrillic = rng() % 5 == 0;
+            std::string s;
+            for (std::size_t i = 0; i < n; ++i)
+            {
+                if (i)
+                    s += ' ';
+                s += cyrillic ? ru[rng() % 6] : words[rng() % 20];
+            }
+            return s;
+        }
+    };
+
+    struct OldMessage
+    {
+        std::u16string name;
+        std::u16string text;
+        bool isMine = false;
+        std::uint64_t senderId = 0;
+        std::uint64_t seq = 0;
+        std::uint64_t hlc = 0;
+    };
+
+    std::u16string utf16(const std::string &s)
+    {
+        std::wstring w = StringToWString(s);
+        return std::u16string(w.begin(), w.end());
+    }
+
+    struct Line
+    {
+        std::string name;
+        std::string text;
+        std::uint64_t senderId;
+    };
+
+    void report(const char *what, std::size_t count, std::int64_t bytes, std::int64_t blocks, const char *extra)
+    {
+        std::printf("%-24s  %9.1f  %10.3f  %s\n", what, double(bytes) / count, double(blocks) / count, extra);
+    }
+}
+
+void *operator new(std::size_t n)
+{
+    return counted_alloc(n);
+}
+
+void *operator new[](std::size_t n)
+{
+    return counted_alloc(n);
+}
+
+void operator delete(void *p) noexcept
+{
+    counted_free(p);
+}
+
+void operator delete[](void *p) noexcept
+{
+    counted_free(p);
+}
+
+void operator delete(void *p, std::size_t) noexcept
+{
+    counted_free(p);
+}
+
+void operator delete[](void *p, std::size_t) noexcept
+{
+    counted_free(p);
+}
+
+int memory_bench(const BenchArgs &args)
+{
+    std::size_t count = args.get("messages", 100000);
+    std::size_t more = args.get("more", 1000000);
+
+    ChatGen gen;
+    std::vector<Line> lines;
+    std::size_t text_bytes = 0;
+    for (std::size_t i = 0; i < count; ++i)
+    {
+        std::string nick = gen.nick();
+        std::uint64_t sender = 1 + std::hash<std::string>()(nick) % 1000;
+        lines.push_back({nick, gen.text(), sender});
+        text_bytes += lines.back().text.size();
+    }
+    std::printf("%zu message history, %.1f bytes of utf-8 text per message on average\n\n", count,
+                double(text_bytes) / count);
+    std::printf("layout                    bytes/msg  blocks/msg\n");
+
+    {
+        // the strings move into the history, so they are counted from when they are made
+        std::int64_t bytes0 = live_bytes, blocks0 = live_blocks;
+        std::vector<OldMessage> converted;
+        converted.reserve(count);
+        for (std::size_t i = 0; i < count; ++i)
+            converted.push_back({utf16(lines[i].name), utf16(lines[i].text), false, lines[i].senderId, i + 1,
+                                 (i + 1) << 16});
+        {
+            std::deque<OldMessage> messages;
+            std::unordered_set<MessageKey, MessageKeyHash> ids;
+            std::unordered_map<std::uint64_t, std::uint64_t> high;
+            ids.reserve(count);
+            for (auto &m : converted)
+            {
+                ids.insert({m.senderId, m.seq});
+                auto &h = high[m.senderId];
+                h = std::max(h, m.seq);
+                messages.push_back(std::move(m));
+            }
+            std::vector<OldMessage>().swap(converted);
+            report("deque, utf-16 strings", count, live_bytes - bytes0, live_blocks - blocks0, "");
+        }
+    }
+
+    std::int64_t bytes0 = live_bytes, blocks0 = live_blocks;
+    bool intact = true;
+    {
+        ChatHistory h(count);
+        for (std::size_t i = 0; i < count; ++i)
+            h.insert({lines[i].name, lines[i].text, false, lines[i].senderId, i + 1, (i + 1) << 16});
+        char extra[96];
+        std::snprintf(extra, sizeof(extra), "records + text %.1f bytes/msg, %zu names", double(h.storage_bytes()) / count,
+                      h.name_count());
+        report("ring + text arena", count, live_bytes - bytes0, live_blocks - blocks0, extra);
+
+        for (std::size_t i = 0; i < more; ++i)
+        {
+            const Line &l = lines[i % count];
+            h.insert({l.name, l.text, false, 7, count + i + 1, (count + i + 1) << 16});
+        }
+        std::snprintf(extra, sizeof(extra), "%zu names, %llu evicted", h.name_count(), (unsigned long long)h.evicted());
+        report("  after more traffic", count, live_bytes - bytes0, live_blocks - blocks0, extra);
+
+        for (std::size_t i = 0; i < h.size(); i += 997)
+        {
+            ChatMessage m = h[i];
+            const Line &l = lines[(m.seq - count - 1) % count];
+            intact = intact && m.text == l.text && m.name == l.name;
+        }
+    }
+    std::printf("\ncontents intact: %s, left allocated after destroying the ring: %lld bytes\n", intact ? "yes" : "no",
+                (long long)(live_bytes - bytes0));
+    return 0;
+}
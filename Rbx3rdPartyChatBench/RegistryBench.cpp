@@ -0,0 +1,221 @@
+#include "pch.h"
+#include "Bench.h"
+#include "SessionRegistry.h"
+
+// broadcasts racing session churn. readers walk the peer list the way broadcast does while
+// one writer keeps connecting, establishing and dropping sessions. the locked vector is the
+// registry this replaced: broadcast took the session mutex and built a set of ips per call.
+// first the tie-break is checked for each pair of dialing sides
+namespace
+{
+    struct FakeSession
+    {
+        std::uint64_t session_id = 0;
+        std::string endpoint;
+        std::uint64_t peer_id = 0;
+        std::uint64_t initiator = 0;
+
+        std::uint64_t id() const { return session_id; }
+        std::string getRemoteEndpoint() const { return endpoint; }
+        std::uint64_t remote_peer_id() const { return peer_id; }
+        std::uint64_t initiator_id() const { return initiator; }
+    };
+
+    using SessionPtr = std::shared_ptr<FakeSession>;
+
+    // we are peer 1, the other end is peer 2. a session to it is listed, a second one completes
+    // its handshake, and the registry has to keep the one both ends would keep
+    bool tie_break(std::uint64_t old_initiator, std::uint64_t new_initiator, bool new_wins)
+    {
+        SessionRegistry<FakeSession> reg;
+        auto make = [](std::uint64_t id, std::uint64_t initiator)
+        {
+            auto s = std::make_shared<FakeSession>();
+            s->session_id = id;
+            s->endpoint = "10.147.17.2";
+            s->peer_id = 2;
+            s->initiator = initiator;
+            return s;
+        };
+        auto old_session = make(1, old_initiator);
+        auto new_session = make(2, new_initiator);
+        reg.insert(old_session);
+        if (reg.establish(old_session->id(), 1))
+            return false;
+        reg.insert(new_session);
+        SessionPtr loser = reg.establish(new_session->id(), 1);
+        SessionPtr winner = new_wins ? new_session : old_session;
+        auto snap = reg.snapshot();
+        return loser == (new_wins ? old_session : new_session) && snap->peers.size() == 1 &&
+               snap->peers.front() == winner && reg.find_peer(winner->id()) == winner && reg.has_peer(2) &&
+               !reg.find_peer(loser->id());
+    }
+
+    class LockedVector
+    {
+    public:
+        void insert(const SessionPtr &s)
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            sessions_.push_back(s);
+        }
+
+        void remove(std::uint64_t id)
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            sessions_.erase(std::remove_if(sessions_.begin(), sessions_.end(),
+                                           [&](const SessionPtr &s) { return s->id() == id; }),
+                            sessions_.end());
+        }
+
+        std::uint64_t broadcast()
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            std::set<std::string> sent_ips;
+            std::uint64_t sum = 0;
+            for (auto &s : sessions_)
+            {
+                std::string ip = s->getRemoteEndpoint();
+                if (sent_ips.count(ip))
+                    continue;
+                sum += s->id();
+                sent_ips.insert(ip);
+            }
+            return sum;
+        }
+
+    private:
+        std::mutex mutex_;
+        std::vector<SessionPtr> sessions_;
+    };
+
+    class Snapshots
+    {
+    public:
+        void insert(const SessionPtr &s)
+        {
+            registry_.insert(s);
+            registry_.establish(s->id(), 1);
+        }
+
+        void remove(std::uint64_t id) { registry_.remove(id); }
+
+        std::uint64_t broadcast()
+        {
+            auto snap = registry_.snapshot();
+            std::uint64_t sum = 0;
+            for (auto &s : snap->peers)
+                sum += s->id();
+            return sum;
+        }
+
+    private:
+        SessionRegistry<FakeSession> registry_;
+    };
+
+    struct Result
+    {
+        double broadcasts_per_s = 0;
+        double churn_per_s = 0;
+    };
+
+    template <class Registry>
+    Result run(std::size_t peers, std::size_t readers, bool churn, std::chrono::milliseconds duration)
+    {
+        Registry reg;
+        std::uint64_t next_id = 1;
+        std::deque<std::uint64_t> live;
+        auto connect = [&]
+        {
+            auto s = std::make_shared<FakeSession>();
+            s->session_id = next_id++;
+            s->peer_id = 0x1000 + s->session_id;
+            s->initiator = s->peer_id;
+            s->endpoint = "10.147.17." + std::to_string(s->session_id % 250 + 2);
+            reg.insert(s);
+            live.push_back(s->session_id);
+        };
+        for (std::size_t i = 0; i < peers; ++i)
+            connect();
+
+        std::atomic<bool> stop{false};
+        std::atomic<std::uint64_t> broadcasts{0};
+        std::uint64_t churned = 0;
+        std::vector<std::thread> threads;
+        for (std::size_t r = 0; r < readers; ++r)
+            threads.emplace_back([&]
+                                 {
+                                     std::uint64_t n = 0, sum = 0;
+                                     while (!stop.load(std::memory_order_relaxed))
+                                     {
+                                         sum += reg.broadcast();
+                                         ++n;
+                                     }
+                                     keep(sum);
+                                     broadcasts += n; });
+
+        auto t0 = BenchClock::now();
+        if (churn)
+        {
+            // a peer drops and another one comes back, the population stays the same
+            while (BenchClock::now() - t0 < duration)
+            {
+                reg.remove(live.front());
+                live.pop_front();
+                connect();
+                ++churned;
+            }
+        }
+        else
+        {
+            std::this_thread::sleep_for(duration);
+        }
+        stop = true;
+        for (auto &t : threads)
+            t.join();
+
+        double s = elapsed_ms(t0) / 1000.0;
+        return {broadcasts.load() / s, churned / s};
+    }
+}
+
+int registry_bench(const BenchArgs &args)
+{
+    std::size_t peers = args.get("peers", 16);
+    std::size_t max_readers = args.get("max-readers", 4);
+    std::chrono::milliseconds duration(args.get("ms", 500));
+
+    struct
+    {
+        const char *what;
+        std::uint64_t old_initiator, new_initiator;
+        bool new_wins;
+    } cases[] = {
+        {"lower id dialed the new one", 2, 1, true},
+        {"lower id dialed the old one", 1, 2, false},
+        {"we redialed, old one still listed", 1, 1, true},
+        {"peer redialed, old one still listed", 2, 2, true},
+    };
+    std::printf("tie-break, we are peer 1 and the other end peer 2\n");
+    for (auto &c : cases)
+        std::printf("  %-38s %s kept: %s\n", c.what, c.new_wins ? "new" : "old",
+                    tie_break(c.old_initiator, c.new_initiator, c.new_wins) ? "ok" : "WRONG");
+    std::printf("\n");
+
+    std::printf("%zu peers, %lld ms per cell, %u hardware threads, atomic<shared_ptr> lock free: %s\n\n", peers,
+                (long long)duration.count(), std::thread::hardware_concurrency(),
+                std::atomic<std::shared_ptr<const int>>().is_lock_free() ? "yes" : "no");
+    std::printf("                          broadcasts/s (churn/s)\n");
+    std::printf("readers  churn     locked vector                 snapshots\n");
+    for (std::size_t readers = 1; readers <= max_readers; readers *= 2)
+    {
+        for (bool churn : {false, true})
+        {
+            Result locked = run<LockedVector>(peers, readers, churn, duration);
+            Result snap = run<Snapshots>(peers, readers, churn, duration);
+            std::printf("%7zu  %5s  %12.0f (%8.0f)  %12.0f (%8.0f)\n", readers, churn ? "yes" : "no",
+                        locked.broadcasts_per_s, locked.churn_per_s, snap.broadcasts_per_s, snap.churn_per_s);
+        }
+    }
+    return 0;
+}
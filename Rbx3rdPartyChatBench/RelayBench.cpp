@@ -0,0 +1,144 @@
+#include "pch.h"
+#include "Bench.h"
+#include "NetworkEngine.h"
+
+// a group on loopback: the full mesh setup builds, with relay off and on, and a sparse graph
+// (a ring plus one chord per node, degree 4) that only works with relay. every node gets its
+// own 127.0.0.x so sessions are told apart by host. each line carries its send time and number
+// so delivery, duplicates and latency can be checked at every node
+namespace
+{
+    std::string host(std::size_t node)
+    {
+        return "127.0.0." + std::to_string(node + 2);
+    }
+
+    std::uint64_t wire_out(const std::vector<std::shared_ptr<NetworkEngine>> &nodes)
+    {
+        std::uint64_t total = 0;
+        for (auto &n : nodes)
+            for (auto &p : n->getPeerStats())
+                total += p.wire_bytes_out;
+        return total;
+    }
+
+    void run(bool relay, bool sparse, std::size_t count, std::size_t messages, int base_port)
+    {
+        std::vector<std::shared_ptr<NetworkEngine>> nodes;
+        LatencyHistogram latency;
+        std::atomic<std::size_t> delivered{0};
+        // per node, how often each message arrived
+        std::vector<std::unique_ptr<std::atomic<int>[]>> seen(count);
+        for (auto &s : seen)
+        {
+            s = std::make_unique<std::atomic<int>[]>(messages);
+            for (std::size_t k = 0; k < messages; ++k)
+                s[k] = 0;
+        }
+
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            NetworkOptions o;
+            o.io_threads = 1;
+            o.relay = relay;
+            o.ping_interval = std::chrono::milliseconds(0);
+            o.enable_deflate = false;
+            auto n = std::make_shared<NetworkEngine>(o);
+            n->setUiCallback([&, i](const RxMessage &m)
+                             {
+                                 std::uint64_t sent = 0, k = 0;
+                                 std::from_chars(m.data(), m.data() + 20, sent);
+                                 std::from_chars(m.data() + 20, m.data() + 28, k);
+                                 latency.record(now_us() - sent);
+                                 if (k < messages)
+                                     seen[i][k]++;
+                                 delivered++; });
+            n->start();
+            n->startListening(base_port + static_cast<int>(i));
+            nodes.push_back(n);
+        }
+        for (auto &n : nodes)
+            n->waitForCertificate();
+
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            if (sparse)
+            {
+                std::size_t a = (i + 1) % count, b = (i + 5) % count;
+                nodes[i]->addPersistentPeer(host(a), base_port + static_cast<int>(a));
+                nodes[i]->addPersistentPeer(host(b), base_port + static_cast<int>(b));
+            }
+            else
+            {
+                for (std::size_t j = i + 1; j < count; ++j)
+                    nodes[i]->addPersistentPeer(host(j), base_port + static_cast<int>(j));
+            }
+        }
+        // tie-breaks and redials settle on their own time, give them a moment after the last one
+        std::size_t expected = sparse ? count * 2 : count * (count - 1) / 2;
+        wait_until([&]
+                   {
+                       std::size_t s = 0;
+                       for (auto &n : nodes)
+                           s += n->getPeerStats().size();
+                       return s / 2 >= expected; },
+                   std::chrono::seconds(20));
+        std::this_thread::sleep_for(std::chrono::milliseconds(500));
+        std::size_t sessions = 0;
+        for (auto &n : nodes)
+            sessions += n->getPeerStats().size();
+
+        std::uint64_t wire_before = wire_out(nodes);
+        std::string pad(200, 'p');
+        for (std::size_t k = 0; k < messages; ++k)
+        {
+            char head[32];
+            std::snprintf(head, sizeof(head), "%020llu%08zu", (unsigned long long)now_us(), k);
+            nodes[k % count]->broadcast(std::string(head) + pad);
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        std::size_t want = messages * (count - 1);
+        wait_until([&] { return delivered.load() >= want; }, std::chrono::seconds(10));
+        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+        std::uint64_t wire = wire_out(nodes) - wire_before;
+
+        std::size_t wrong = 0;
+        for (std::size_t i = 0; i < count; ++i)
+            for (std::size_t k = 0; k < messages; ++k)
+                if (k % count != i && seen[i][k] != 1)
+                    wrong++;
+
+        std::uint64_t dups = 0, forwarded = 0;
+        for (auto &n : nodes)
+        {
+            auto st = n->getStats();
+            dups += st.relay_duplicates;
+            forwarded += st.relay_forwarded;
+        }
+        auto lat = latency.snapshot();
+        std::printf("%-9s  %-5s  %8zu  %5zu/%-5zu  %5zu  %7llu  %7llu  %10.1f  %9llu  %9llu\n", sparse ? "sparse" : "full mesh",
+                    relay ? "on" : "off", sessions / 2, delivered.load(), want, wrong, (unsigned long long)lat.p50_us,
+                    (unsigned long long)lat.p99_us, wire / 1024.0 / messages, (unsigned long long)forwarded,
+                    (unsigned long long)dups);
+
+        for (auto &n : nodes)
+            n->clearCallbacks();
+        for (auto &n : nodes)
+            n->stop();
+    }
+}
+
+int relay_bench(const BenchArgs &args)
+{
+    std::size_t count = args.get("nodes", 30);
+    std::size_t messages = args.get("messages", 100);
+    int port = static_cast<int>(args.get("port", 19800));
+
+    std::printf("%zu nodes, %zu lines of ~230 bytes 10 ms apart, %u hardware threads\n\n", count, messages,
+                std::thread::hardware_concurrency());
+    std::printf("graph      relay  sessions  delivered    wrong  p50 us   p99 us   KB/line   forwarded  duplicates\n");
+    run(false, false, count, messages, port);
+    run(true, false, count, messages, port + static_cast<int>(count));
+    run(true, true, count, messages, port + 2 * static_cast<int>(count));
+    return 0;
+}
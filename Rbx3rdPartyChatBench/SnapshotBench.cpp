@@ -0,0 +1,153 @@
+#include "pch.h"
+#include "Bench.h"
+#include "ChatHistory.h"
+#include "GlobalNetwork.h"
+#include "HistorySnapshot.h"
+#include "WireProtocol.h"
+#include <random>
+
+// first a check that HistorySnapshot stays equal to a fresh encode while the history takes
+// appends, late messages and id-less ones, then a stampede of full sync answers with no change
+// in between. re-encode is what SendSyncResponse did before the snapshot, the utf-16 row adds
+// the conversion it paid while the history still held wstrings
+namespace
+{
+    std::string fresh(const ChatHistory &h)
+    {
+        std::string out;
+        for (const auto &m : h)
+            if (m.senderId || m.seq)
+                wire::append_record(out, m.seq, m.senderId, m.hlc, m.name, m.text);
+        return out;
+    }
+
+    struct Check
+    {
+        std::size_t checks = 0;
+        std::size_t mismatches = 0;
+        std::uint64_t encoded = 0;
+        std::uint64_t rebuilds = 0;
+    };
+
+    Check check(std::size_t capacity, std::size_t inserts, std::uint32_t seed)
+    {
+        std::mt19937 rng(seed);
+        ChatHistory h(capacity);
+        HistorySnapshot snap;
+        std::uint64_t hlc = 1000, seq = 0;
+        Check c;
+        for (std::size_t step = 0; step < inserts; ++step)
+        {
+            std::string name = "nick" + std::to_string(rng() % 9);
+            std::string text = "text " + std::to_string(step);
+            ChatMessage m{name, text, false, 1 + rng() % 4, ++seq, 0};
+            int kind = rng() % 100;
+            if (kind < 3)
+            {
+                // late, lands somewhere in the middle
+                m.hlc = hlc - rng() % 500;
+            }
+            else if (kind < 5)
+            {
+                m.senderId = 0;
+                m.seq = 0;
+                m.hlc = ++hlc;
+            }
+            else
+            {
+                m.hlc = ++hlc;
+            }
+            h.insert(m);
+
+            if (rng() % 7)
+                continue;
+            snap.refresh(h);
+            c.checks++;
+            bool ok = snap.body() == fresh(h);
+            for (std::size_t i = 0; i < h.size() && ok; i += 97)
+            {
+                ChatMessage x = h[i];
+                std::string one;
+                if (x.senderId || x.seq)
+                    wire::append_record(one, x.seq, x.senderId, x.hlc, x.name, x.text);
+                ok = snap.record(i) == one;
+            }
+            SharedPayload frame = snap.full_frame();
+            wire::FrameView view;
+            ok = ok && wire::decode_frame(*frame, view) && view.count == snap.record_count() &&
+                 snap.full_frame() == frame;
+            if (!ok)
+                c.mismatches++;
+        }
+        c.encoded = snap.records_encoded();
+        c.rebuilds = snap.rebuilds();
+        return c;
+    }
+}
+
+int snapshot_bench(const BenchArgs &args)
+{
+    std::size_t history = args.get("history", 1000);
+    std::size_t answers = args.get("answers", 20);
+    std::size_t inserts = args.get("inserts", 20000);
+
+    Check c = check(history, inserts, static_cast<std::uint32_t>(args.get("seed", 3)));
+    std::printf("%zu random inserts into a %zu message history: %zu checks, %zu mismatches, %llu records encoded, "
+                "%llu rebuilds\n\n",
+                inserts, history, c.checks, c.mismatches, (unsigned long long)c.encoded,
+                (unsigned long long)c.rebuilds);
+
+    ChatHistory h(history);
+    std::vector<std::wstring> names, texts;
+    for (std::size_t i = 0; i < history; ++i)
+    {
+        std::string text = "gg that was a close one " + std::to_string(i);
+        h.insert({"Player", text, false, 1, i + 1, i + 1});
+        names.push_back(L"Player");
+        texts.push_back(StringToWString(text));
+    }
+
+    std::printf("%zu full answers over %zu messages\n", answers, history);
+    // every re-encoded answer is a buffer of its own, snapshot answers share theirs
+    std::printf("path               total us   records encoded   distinct buffers\n");
+    for (int path = 0; path < 3; ++path)
+    {
+        std::uint64_t encoded = 0, sum = 0;
+        std::set<const void *> buffers;
+        HistorySnapshot snap;
+        auto t0 = BenchClock::now();
+        for (std::size_t a = 0; a < answers; ++a)
+        {
+            if (path < 2)
+            {
+                wire::FrameWriter w(wire::FrameType::SyncResponse);
+                for (std::size_t i = 0; i < h.size(); ++i)
+                {
+                    ChatMessage m = h[i];
+                    if (path == 0)
+                        w.add_record(m.seq, m.senderId, m.hlc, m.name, m.text);
+                    else
+                        w.add_record(m.seq, m.senderId, m.hlc, WStringToString(names[i]), WStringToString(texts[i]));
+                }
+                encoded += w.count();
+                std::string frame = w.finish();
+                sum += frame.size();
+            }
+            else
+            {
+                snap.refresh(h);
+                SharedPayload frame = snap.full_frame();
+                sum += frame->size();
+                buffers.insert(frame.get());
+            }
+        }
+        double us = elapsed_ms(t0) * 1000.0;
+        keep(sum);
+        if (path == 2)
+            encoded = snap.records_encoded();
+        const char *name = path == 0 ? "re-encode" : path == 1 ? "re-encode + utf-16" : "snapshot";
+        std::printf("%-18s  %8.0f  %16llu  %17zu\n", name, us, (unsigned long long)encoded,
+                    path == 2 ? buffers.size() : answers);
+    }
+    return 0;
+}
@@ -0,0 +1,85 @@
+#include "pch.h"
+#include "Bench.h"
+#include "NetworkEngine.h"
+
+// how long from constructing an engine until it carries traffic, per cert key type.
+// two fresh engines each run, one listens and one dials, timings come from the dialer
+namespace
+{
+    struct Run
+    {
+        double construct_ms = 0;
+        StartupTimings timings;
+        bool connected = false;
+    };
+
+    Run run_once(CertKeyType type, int port)
+    {
+        NetworkOptions o;
+        o.io_threads = 1;
+        o.ping_interval = std::chrono::milliseconds(0);
+        o.cert_key_type = type;
+
+        Run r;
+        auto server = std::make_shared<NetworkEngine>(o);
+        server->start();
+        server->startListening(port);
+        // only the dialer's own startup is timed
+        server->waitForCertificate();
+
+        auto t0 = BenchClock::now();
+        auto client = std::make_shared<NetworkEngine>(o);
+        r.construct_ms = elapsed_ms(t0);
+        std::atomic<bool> up{false};
+        client->setSessionCallback([&](std::uint64_t, std::uint64_t) { up = true; });
+        client->start();
+        client->addPersistentPeer("127.0.0.1", port);
+
+        r.connected = wait_until([&] { return up.load(); }, std::chrono::seconds(10));
+        r.timings = client->getStartupTimings();
+        client->clearCallbacks();
+        client->stop();
+        server->stop();
+        return r;
+    }
+
+    double median(std::vector<double> v)
+    {
+        std::sort(v.begin(), v.end());
+        return v.empty() ? 0 : v[v.size() / 2];
+    }
+}
+
+int startup_bench(const BenchArgs &args)
+{
+    std::size_t runs = args.get("runs", 5);
+    int port = static_cast<int>(args.get("port", 19600));
+
+    std::printf("medians of %zu runs, ms since the dialing engine was constructed\n\n", runs);
+    std::printf("key type     construct   keygen   cert ready   first dial   first session\n");
+    for (CertKeyType type : {CertKeyType::Rsa2048, CertKeyType::EcdsaP256, CertKeyType::Ed25519})
+    {
+        std::vector<double> construct, keygen, ready, dial, session;
+        std::size_t failed = 0;
+        for (std::size_t i = 0; i < runs; ++i)
+        {
+            Run r = run_once(type, port++);
+            if (!r.connected || r.timings.cert_failed)
+            {
+                failed++;
+                continue;
+            }
+            construct.push_back(r.construct_ms);
+            keygen.push_back(r.timings.cert_generate_us / 1000.0);
+            ready.push_back(r.timings.cert_ready_us / 1000.0);
+            dial.push_back(r.timings.first_dial_us / 1000.0);
+            session.push_back(r.timings.first_session_us / 1000.0);
+        }
+        std::printf("%-10s  %9.2f  %7.1f  %11.1f  %11.1f  %14.1f", CertHelper::key_type_name(type), median(construct),
+                    median(keygen), median(ready), median(dial), median(session));
+        if (failed)
+            std::printf("   (%zu runs failed)", failed);
+        std::printf("\n");
+    }
+    return 0;
+}
@@ -0,0 +1,154 @@
+#include "pch.h"
+#include "Bench.h"
+#include "BloomFilter.h"
+#include "ChatHistory.h"
+#include "HistorySnapshot.h"
+#include "WireProtocol.h"
+#include <random>
+
+// one sync round between two histories that diverged, bytes on the wire for request + response
+// and how many of the missing messages came back. request and answer follow
+// ChatWindow::SendSyncRequest / SendSyncResponse without the cold storage part. full dump is
+// what sync did before marks: an empty request and every record back. --history runs one size
+// and --tail sets how many of its newest messages the tail row loses, 10% by default
+namespace
+{
+    enum class Mode
+    {
+        FullDump,
+        HighWater,
+        Filter
+    };
+
+    struct Result
+    {
+        std::size_t bytes = 0;
+        std::size_t recovered = 0;
+    };
+
+    std::string request(const ChatHistory &h, Mode mode)
+    {
+        if (mode == Mode::FullDump)
+            return wire::FrameWriter(wire::FrameType::SyncRequest).finish();
+        std::vector<wire::HighWater> marks;
+        bool holes = false;
+        for (const auto &[sender, mark] : h.high_water())
+        {
+            marks.push_back({sender, mark.seq});
+            holes = holes || mark.has_gaps();
+        }
+        BloomFilter filter;
+        std::uint64_t since = 0;
+        if ((mode == Mode::Filter || holes) && !h.empty())
+        {
+            filter = BloomFilter(h.size(), 0.01);
+            for (const auto &m : h)
+                filter.add(m.senderId, m.seq);
+            if (h.size() >= h.capacity())
+                since = h[0].hlc;
+        }
+        return wire::encode_sync_request(marks, filter.empty() ? nullptr : &filter, since);
+    }
+
+    std::string answer(const ChatHistory &h, HistorySnapshot &snap, std::string_view req)
+    {
+        wire::FrameView frame;
+        std::vector<wire::HighWater> marks;
+        if (!wire::decode_frame(req, frame) || !wire::decode_sync_request(frame, marks))
+            return {};
+        std::unordered_map<std::uint64_t, std::uint64_t> have;
+        for (const auto &m : marks)
+            have[m.sender_id] = std::max(have[m.sender_id], m.seq);
+        BloomFilter filter;
+        std::uint64_t since = 0;
+        bool hasFilter = wire::decode_sync_filter(frame, filter, since);
+
+        snap.refresh(h);
+        wire::FrameWriter w(wire::FrameType::SyncResponse);
+        for (std::size_t i = 0; i < h.size(); ++i)
+        {
+            ChatMessage m = h[i];
+            auto it = have.find(m.senderId);
+            bool pastMark = it == have.end() || m.seq > it->second;
+            if (hasFilter)
+            {
+                if (m.hlc < since || (!pastMark && filter.maybe_contains(m.senderId, m.seq)))
+                    continue;
+            }
+            else if (!pastMark)
+            {
+                continue;
+            }
+            w.append_body(snap.record(i), 1);
+        }
+        return w.count() ? w.finish() : std::string();
+    }
+
+    Result sync(const ChatHistory &requester, const ChatHistory &responder, Mode mode)
+    {
+        HistorySnapshot snap;
+        std::string req = request(requester, mode);
+        std::string resp = answer(responder, snap, req);
+
+        Result r;
+        r.bytes = req.size() + resp.size();
+        wire::FrameView frame;
+        if (!resp.empty() && wire::decode_frame(resp, frame))
+        {
+            wire::RecordReader reader(frame);
+            wire::RecordView rec;
+            while (reader.next(rec))
+                if (!requester.contains(rec.sender_id, rec.msg_id))
+                    r.recovered++;
+        }
+        return r;
+    }
+}
+
+int sync_bench(const BenchArgs &args)
+{
+    std::size_t senders = args.get("senders", 5);
+    std::size_t only = args.get("history", 0);
+    std::size_t lost = args.get("tail", 0);
+    std::mt19937 rng(static_cast<std::uint32_t>(args.get("seed", 7)));
+    std::vector<std::size_t> sizes = {100, 1000, 10000};
+    if (only)
+        sizes = {only};
+
+    std::printf("%zu senders, one sync round, bytes are request + response, got is missing messages recovered\n\n",
+                senders);
+    std::printf("%6s   %-8s  %7s | %-14s | %-14s | %s\n", "hist", "diverge", "missing", "full dump", "high-water",
+                "filter");
+    std::printf("%26s | %7s %6s | %7s %6s | %7s %6s\n", "", "bytes", "got", "bytes", "got", "bytes", "got");
+    for (std::size_t n : sizes)
+    {
+        std::size_t cut = lost && lost < n ? lost : n / 10;
+        for (const char *kind : {"none", "holes1%", "holes10%", "tail10%"})
+        {
+            double frac = kind[0] == 'n' ? 0 : std::strcmp(kind, "holes1%") == 0 ? 0.01 : 0.10;
+            bool tail = kind[0] == 't';
+            ChatHistory full(n), partial(n);
+            std::size_t missing = 0;
+            for (std::size_t i = 0; i < n; ++i)
+            {
+                std::string name = "Player" + std::to_string(i % senders);
+                std::string text = "gg that was a close one " + std::to_string(i);
+                ChatMessage m{name, text, false, i % senders + 1, i / senders + 1, 1000 + i};
+                full.insert(m);
+                bool drop = tail ? i >= n - cut : std::uniform_real_distribution<>(0, 1)(rng) < frac;
+                if (drop)
+                    missing++;
+                else
+                    partial.insert(m);
+            }
+            std::printf("%6zu   %-8s  %7zu", n, tail && cut != n / 10 ? "tail" : kind, missing);
+            for (Mode mode : {Mode::FullDump, Mode::HighWater, Mode::Filter})
+            {
+                Result r = sync(partial, full, mode);
+                std::printf(" | %7zu %6zu", r.bytes, r.recovered);
+            }
+            std::printf("\n");
+        }
+    }
+    return 0;
+}
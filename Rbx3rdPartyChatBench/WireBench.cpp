@@ -0,0 +1,157 @@
+#include "pch.h"
+#include "Bench.h"
+#include "GlobalNetwork.h"
+#include "WireProtocol.h"
+
+// the receive side of a chat line before and after the binary frames. the old path is what
+// the ui callback and WM_USER + 1 did with a "nick:text" string: widen it, copy it into the
+// posted message, sniff SYS/SYNC and split on the first ':'. the new one decodes the frame
+// in place and leaves the text as utf-8
+namespace
+{
+    struct OldChatMessage
+    {
+        std::wstring name;
+        std::wstring text;
+        bool isMine = false;
+    };
+
+    struct Line
+    {
+        std::string nick;
+        std::string text;
+    };
+
+    std::vector<Line> make_lines(std::size_t count, std::size_t text_bytes, std::size_t colon_every)
+    {
+        static const char *const nicks[] = {"alex", "Builderman_2009", "xX_noob_Xx", "ana", "korol_robux"};
+        // one cyrillic word so widening is not pure ascii
+        static const char *const words[] = {"ok", "lol", "where", "are", "you", "\xD0\xBF\xD1\x80\xD0\xB8\xD0\xB2\xD0\xB5\xD1\x82",
+                                            "go", "back", "to", "spawn", "gg"};
+        std::mt19937 rng(42);
+        std::vector<Line> out(count);
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            out[i].nick = nicks[rng() % std::size(nicks)];
+            // a colon in the nick is legal, the old split takes it for the separator
+            if (colon_every && i % colon_every == 0)
+                out[i].nick += ":3";
+            while (out[i].text.size() < text_bytes)
+            {
+                out[i].text += words[rng() % std::size(words)];
+                out[i].text += ' ';
+            }
+        }
+        return out;
+    }
+
+    bool old_parse(const std::string &msg, OldChatMessage &out)
+    {
+        // the callback widened the line and posted a heap copy to the window
+        std::wstring wmsg = StringToWString(msg);
+        std::wstring *raw = new std::wstring(wmsg);
+
+        std::wstring s = *raw;
+        delete raw;
+
+        if (s.find(L"SYS") == 0 || s.find(L"SYNC") == 0)
+            return false;
+
+        size_t delimPos = s.find(L':');
+        out.name = L"Peer";
+        out.text = s;
+        if (delimPos != std::wstring::npos)
+        {
+            out.name = s.substr(0, delimPos);
+            out.text = s.substr(delimPos + 1);
+        }
+        out.isMine = false;
+        return true;
+    }
+
+    bool new_parse(std::string_view bytes, wire::RecordView &out)
+    {
+        wire::FrameView frame;
+        if (!wire::decode_frame(bytes, frame) || frame.type != wire::FrameType::Chat)
+            return false;
+        wire::RecordReader reader(frame);
+        return reader.next(out);
+    }
+
+    // best of several rounds, in ns per message
+    template <class Fn>
+    double time_rounds(std::size_t rounds, std::size_t count, Fn &&fn)
+    {
+        double best = 1e300;
+        for (std::size_t r = 0; r < rounds; ++r)
+        {
+            auto t0 = BenchClock::now();
+            fn();
+            best = std::min(best, elapsed_ms(t0) * 1e6 / count);
+        }
+        return best;
+    }
+}
+
+int wire_bench(const BenchArgs &args)
+{
+    std::size_t count = args.get("messages", 200000);
+    std::size_t text_bytes = args.get("size", 60);
+    std::size_t rounds = args.get("rounds", 5);
+    std::size_t colon_every = args.get("colon-every", 20);
+
+    auto lines = make_lines(count, text_bytes, colon_every);
+    std::vector<std::string> old_frames, new_frames;
+    old_frames.reserve(count);
+    new_frames.reserve(count);
+    for (std::size_t i = 0; i < count; ++i)
+    {
+        old_frames.push_back(lines[i].nick + ":" + lines[i].text);
+        new_frames.push_back(wire::encode_chat(i + 1, 0x9E3779B97F4A7C15ull, now_us(), lines[i].nick, lines[i].text));
+    }
+
+    std::size_t old_wrong = 0, new_wrong = 0;
+    for (std::size_t i = 0; i < count; ++i)
+    {
+        OldChatMessage m;
+        if (!old_parse(old_frames[i], m) || m.name != StringToWString(lines[i].nick))
+            old_wrong++;
+        wire::RecordView rec;
+        if (!new_parse(new_frames[i], rec) || rec.nick != lines[i].nick || rec.text != lines[i].text)
+            new_wrong++;
+    }
+
+    double old_ns = time_rounds(rounds, count, [&]
+                                {
+                                    OldChatMessage m;
+                                    for (auto &f : old_frames)
+                                    {
+                                        old_parse(f, m);
+                                        keep(m.text.size());
+                                    } });
+    double new_ns = time_rounds(rounds, count, [&]
+                                {
+                                    wire::RecordView rec;
+                                    for (auto &f : new_frames)
+                                    {
+                                        new_parse(f, rec);
+                                        keep(rec.text.size());
+                                    } });
+    // what the ui pays when it does want wide text, e.g. to lay a line out
+    double new_wide_ns = time_rounds(rounds, count, [&]
+                                     {
+                                         wire::RecordView rec;
+                                         for (auto &f : new_frames)
+                                         {
+                                             new_parse(f, rec);
+                                             keep(StringToWString(rec.text).size());
+                                         } });
+
+    std::printf("%zu chat lines, ~%zu bytes of text, every %zuth nick has a colon, best of %zu rounds\n\n",
+                count, text_bytes, colon_every, rounds);
+    std::printf("                          ns/msg   misparsed\n");
+    std::printf("old nick:text split    %9.1f   %9zu\n", old_ns, old_wrong);
+    std::printf("wire decode in place   %9.1f   %9zu\n", new_ns, new_wrong);
+    std::printf("wire decode + widen    %9.1f\n", new_wide_ns);
+    return 0;
+}
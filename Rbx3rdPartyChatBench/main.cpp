@@ -0,0 +1,66 @@
+#include "pch.h"
+#include "Bench.h"
+
+struct BenchEntry
+{
+    const char *name;
+    int (*run)(const BenchArgs &args);
+    const char *usage;
+};
+
+static const BenchEntry benches[] = {
+    {"loopback", loopback_bench, "--max-threads=4 --clients=16 --messages=20000 --size=80 --port=19400"},
+    {"wire", wire_bench, "--messages=200000 --size=60 --rounds=5 --colon-every=20"},
+    {"registry", registry_bench, "--peers=16 --max-readers=4 --ms=500"},
+    {"handshake", handshake_bench, "--drops=20 --messages=2000 --profile=TLS1.2|TLS1.2/1.3|TLS1.3 --port=19500"},
+    {"startup", startup_bench, "--runs=5 --port=19600"},
+    {"inbound", inbound_bench, "--messages=200000 --size=60 --port=19700"},
+    {"relay", relay_bench, "--nodes=30 --messages=100 --port=19800"},
+    {"sync", sync_bench, "--senders=5 --seed=7"},
+    {"snapshot", snapshot_bench, "--history=1000 --answers=20 --inserts=20000 --seed=3"},
+    {"bulk", bulk_bench, "--rounds=3 --bulk-mb=6 --lines=40 --gap-ms=2 --chunk=16384 --port=19900"},
+    {"journal", journal_bench, "--messages=1000000 --flushed=2000 --keep=1000 --path=<file>"},
+    {"history", history_bench, "--inserts=200000 --vector-work=200000000"},
+    {"memory", memory_bench, "--messages=100000 --more=1000000"},
+    {"cold", cold_bench, "--messages=1000000 --window=1000 --pages=200 --dir=<folder>"},
+    {"redial", redial_bench, "--ms=3000 --host=localhost --port=20000"},
+};
+
+static void print_usage()
+{
+    std::printf("usage: Rbx3rdPartyChatBench <bench> [--name=value ...]\n\n");
+    for (auto &b : benches)
+        std::printf("  %-10s %s\n", b.name, b.usage);
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2)
+    {
+        print_usage();
+        return 1;
+    }
+
+    WSADATA wsaData;
+    if (WSAStartup(MAKEWORD(2, 2), &wsaData) != 0)
+    {
+        std::printf("WSAStartup failed\n");
+        return 1;
+    }
+
+    int rc = 1;
+    bool found = false;
+    for (auto &b : benches)
+    {
+        if (std::string_view(argv[1]) == b.name)
+        {
+            found = true;
+            rc = b.run(BenchArgs(argc - 2, argv + 2));
+        }
+    }
+    if (!found)
+        print_usage();
+
+    WSACleanup();
+    return rc;
+}